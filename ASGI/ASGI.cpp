@@ -6,6 +6,7 @@
 #include <io.h>
 #include  <stdio.h>
 #include "GraphicsContextManager.h"
+#include "CmdBufferTaskScheduler.h"
 
 namespace ASGI {
 	bool GSupportParallelCommandBuffer = false;
@@ -122,13 +123,13 @@ namespace ASGI {
 		GraphicsContextManager::Instance()->RemoveContext(this);
 	}
 
-	graphics_context_ptr CreateContext(GIType driver, SwapchainCreateInfo* swapchainInfo, const char* device_name) {
+	graphics_context_ptr CreateContext(GIType driver, SwapchainCreateInfo* swapchainInfo, const char* device_name, ICmdBufferTaskQueue* cmdBufferTaskQueue) {
 		if (driver == GIType::GI_VULKAN) {
 			auto pGI = new VulkanGI();
 			auto pContext = new VKContext();
 			GraphicsContextManager::Instance()->AddContext(pContext);
 			//
-			if (pGI->Init(device_name)) {
+			if (pGI->Init(device_name, cmdBufferTaskQueue)) {
 				Swapchain* pSwapchain = nullptr;
 				if (swapchainInfo != nullptr) {
 					pSwapchain = pGI->CreateSwapchain(*swapchainInfo);
@@ -142,6 +143,10 @@ namespace ASGI {
 					//
 					return pContext;
 				}
+				//headless context, e.g. for ReplayCapture
+				pContext->Set(nullptr, pGI);
+				//
+				return pContext;
 			}
 			else {
 				GraphicsContextManager::Instance()->RemoveContext(pContext);
@@ -152,6 +157,10 @@ namespace ASGI {
 		return nullptr;
 	}
 
+	ICmdBufferTaskQueue* CreateCmdBufferTaskScheduler(const CmdBufferTaskSchedulerCreateInfo& create_info) {
+		return new CmdBufferTaskScheduler(create_info);
+	}
+
 	void SetCurrentContext(GraphicsContext* context) {
 		GraphicsContextManager::Instance()->SetCurrentContext(context);
 	}
@@ -207,6 +216,15 @@ namespace ASGI {
 		return GraphicsContextManager::Instance()->GetDynamicGI()->CreateGraphicsPipeline(create_info);
 	}
 
+	bool CreateGraphicsPipelines(uint32_t numPipelines, const GraphicsPipelineCreateInfo* createInfos, graphics_pipeline_ptr* pipelines) {
+		std::vector<GraphicsPipeline*> tmp(numPipelines);
+		auto res = GraphicsContextManager::Instance()->GetDynamicGI()->CreateGraphicsPipelines(numPipelines, createInfos, tmp.data());
+		for (uint32_t i = 0; i < numPipelines; ++i) {
+			pipelines[i] = tmp[i];
+		}
+		return res;
+	}
+
 	frame_buffer_ptr CreateFrameBuffer(RenderPass* targetRenderPass, uint8_t numAttachment, ImageView** attachments, ClearValue* clearValues, uint32_t width, uint32_t height) {
 		return GraphicsContextManager::Instance()->GetDynamicGI()->CreateFrameBuffer(targetRenderPass, numAttachment, attachments, clearValues, width, height);
 	}
@@ -227,6 +245,10 @@ namespace ASGI {
 		GetDynamicGI(pbuffer->GetContext())->UpdateBuffer(pbuffer, offset, size, pdata, pUpdateContext);
 	}
 
+	bool WaitBufferUpdated(Buffer* pbuffer) {
+		return GetDynamicGI(pbuffer->GetContext())->WaitBufferUpdated(pbuffer);
+	}
+
 	void* MapBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, MapMode mapMode) {
 		return nullptr;
 	}
@@ -277,24 +299,69 @@ namespace ASGI {
 		return GetDynamicGI(pimg->GetContext())->UpdateImage2D(pimg, level, offsetX, offsetY, sizeX, sizeY, pdata, pUpdateContext);
 	}
 
-	ExcuteQueue* AcquireExcuteQueue(QueueType queueType) {
-		return GraphicsContextManager::Instance()->GetDynamicGI()->AcquireExcuteQueue(queueType);
+	ExcuteQueue* AcquireExcuteQueue(QueueType queueType, uint64_t timeout) {
+		return GraphicsContextManager::Instance()->GetDynamicGI()->AcquireExcuteQueue(queueType, timeout);
+	}
+
+	QueueStatistics GetQueueStatistics(ExcuteQueue* excuteQueue) {
+		return GetDynamicGI(excuteQueue->GetContext())->GetQueueStatistics(excuteQueue);
 	}
 
 	void WaitQueueExcuteFinished(uint32_t numWaiteQueue, ExcuteQueue** excuteQueues) {
 		GraphicsContextManager::Instance()->GetDynamicGI()->WaitQueueExcuteFinished(numWaiteQueue, excuteQueues);
 	}
 
-	bool SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished) {
+	submission_ptr SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished) {
 		return GetDynamicGI(excuteQueue->GetContext())->SubmitCommands(excuteQueue, numBuffers, cmdBuffers, numWaiteQueue, waiteQueues, numSwapchain, waiteSwapchains, waiteFinished);
 	}
 
+	submission_ptr SubmitCommandsAfter(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteSubmission, Submission** waiteSubmissions, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished) {
+		return GetDynamicGI(excuteQueue->GetContext())->SubmitCommandsAfter(excuteQueue, numBuffers, cmdBuffers, numWaiteSubmission, waiteSubmissions, numSwapchain, waiteSwapchains, waiteFinished);
+	}
+
+	submission_ptr SubmitBatches(ExcuteQueue* excuteQueue, uint32_t numBatches, const SubmitBatch* batches, bool waiteFinished) {
+		return GetDynamicGI(excuteQueue->GetContext())->SubmitBatches(excuteQueue, numBatches, batches, waiteFinished);
+	}
+
+	bool WaitSubmission(Submission* submission) {
+		return GetDynamicGI(submission->GetContext())->WaitSubmission(submission);
+	}
+
+	bool IsSubmissionFinished(Submission* submission) {
+		return GetDynamicGI(submission->GetContext())->IsSubmissionFinished(submission);
+	}
+
+	bool WaitSubmissionFinished(Submission* submission, uint64_t timeout) {
+		return GetDynamicGI(submission->GetContext())->WaitSubmissionFinished(submission, timeout);
+	}
+
 	void Present(ExcuteQueue* excuteQueue, uint32_t numSwapchain, Swapchain** swapchains, bool waiteFinished) {
 		GetDynamicGI(excuteQueue->GetContext())->Present(excuteQueue, numSwapchain, swapchains, waiteFinished);
 	}
 
-	command_buffer_ptr CreateCmdBuffer() {
-		return GraphicsContextManager::Instance()->GetDynamicGI()->CreateCmdBuffer();
+	uint32_t BeginFrame(Swapchain* swapchain) {
+		return GetDynamicGI(swapchain->GetContext())->BeginFrame(swapchain);
+	}
+
+	void EndFrame(ExcuteQueue* excuteQueue, Swapchain* swapchain) {
+		GetDynamicGI(excuteQueue->GetContext())->EndFrame(excuteQueue, swapchain);
+	}
+
+	void EnableSubmitThread(bool enable) {
+		GraphicsContextManager::Instance()->GetDynamicGI()->EnableSubmitThread(enable);
+	}
+
+	SubmitThreadStatistics GetSubmitThreadStatistics() {
+		return GraphicsContextManager::Instance()->GetDynamicGI()->GetSubmitThreadStatistics();
+	}
+
+	//thread state only, an allocation hook must not take the lock of the context manager
+	bool IsReplayingCommands() {
+		return VKCommandBuffer::IsReplaying();
+	}
+
+	command_buffer_ptr CreateCmdBuffer(const CommandBufferCreateInfo& create_info) {
+		return GraphicsContextManager::Instance()->GetDynamicGI()->CreateCmdBuffer(create_info);
 	}
 
 	void BeginCmdBuffer(CommandBuffer* cmdBuffer) {
@@ -305,6 +372,10 @@ namespace ASGI {
 		return GetDynamicGI(cmdBuffer->GetContext())->EndCmdBuffer(cmdBuffer);
 	}
 
+	CommandBufferStatistics GetCmdBufferStatistics(CommandBuffer* cmdBuffer) {
+		return GetDynamicGI(cmdBuffer->GetContext())->GetCmdBufferStatistics(cmdBuffer);
+	}
+
 	bool BeginRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, FrameBuffer* frameBuffer) {
 		return GetDynamicGI(cmdBuffer->GetContext())->BeginRenderPass(cmdBuffer, renderPass, frameBuffer);
 	}
@@ -348,6 +419,10 @@ namespace ASGI {
 		GetDynamicGI(cmdBuffer->GetContext())->CmdBindVertexBuffer(cmdBuffer, bindingIndex, pBuffer, offset);
 	}
 
+	void CmdBindVertexBuffers(CommandBuffer* cmdBuffer, uint32_t firstBinding, uint32_t bindingCount, Buffer** ppBuffers, uint32_t* pOffsets) {
+		GetDynamicGI(cmdBuffer->GetContext())->CmdBindVertexBuffers(cmdBuffer, firstBinding, bindingCount, ppBuffers, pOffsets);
+	}
+
 	void CmdDraw(CommandBuffer* cmdBuffer, uint32_t vertexCount, uint32_t  instanceCount, uint32_t firstVertex, uint32_t  firstInstance) {
 		GetDynamicGI(cmdBuffer->GetContext())->CmdDraw(cmdBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
 	}
@@ -355,4 +430,20 @@ namespace ASGI {
 	void CmdDrawIndexed(CommandBuffer* cmdBuffer, uint32_t indexCount, uint32_t   instanceCount, uint32_t  firstIndex, int32_t  vertexOffset, uint32_t  firstInstance) {
 		GetDynamicGI(cmdBuffer->GetContext())->CmdDrawIndexed(cmdBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
 	}
+
+	void CmdFillBuffer(CommandBuffer* cmdBuffer, Buffer* dstBuffer, uint32_t dstOffset, uint32_t size, uint32_t  data) {
+		GetDynamicGI(cmdBuffer->GetContext())->CmdFillBuffer(cmdBuffer, dstBuffer, dstOffset, size, data);
+	}
+
+	void EnableCapture(bool enable) {
+		GraphicsContextManager::Instance()->GetDynamicGI()->EnableCapture(enable);
+	}
+
+	bool CaptureCmdBuffer(CommandBuffer* cmdBuffer, const char* path) {
+		return GetDynamicGI(cmdBuffer->GetContext())->CaptureCmdBuffer(cmdBuffer, path);
+	}
+
+	bool ReplayCapture(const char* path, uint32_t numFrames, uint32_t numExternalResources, GraphicsResource** externalResources, CaptureReplayStatistics* pStatistics, const CommandBufferCreateInfo& create_info) {
+		return GraphicsContextManager::Instance()->GetDynamicGI()->ReplayCapture(path, numFrames, numExternalResources, externalResources, pStatistics, create_info);
+	}
 }
@@ -1,20 +1,30 @@
 #pragma once
 #include "ASGI.hpp"
+#include "ICmdBufferTaskQueue.h"
 
 namespace ASGI {
-	ASGI_API graphics_context_ptr CreateContext(GIType driver, SwapchainCreateInfo* swapchainInfo = nullptr, const char* device_name = nullptr);
+	//the second command buffers of EndRenderPass/EndSubRenderPass are translated on cmdBufferTaskQueue, it must outlive the context
+	ASGI_API graphics_context_ptr CreateContext(GIType driver, SwapchainCreateInfo* swapchainInfo = nullptr, const char* device_name = nullptr, ICmdBufferTaskQueue* cmdBufferTaskQueue = nullptr);
+	//the built-in work stealing ICmdBufferTaskQueue, delete it after the contexts that use it
+	ASGI_API ICmdBufferTaskQueue* CreateCmdBufferTaskScheduler(const CmdBufferTaskSchedulerCreateInfo& create_info = CmdBufferTaskSchedulerCreateInfo());
 	ASGI_API void SetCurrentContext(GraphicsContext* context);
 	//
 	ASGI_API shader_module_ptr CreateShaderModule(const char* shaderPath);
 	ASGI_API shader_program_ptr CreateShaderProgram(ShaderModule* pVertexShader, ShaderModule* pGeomteryShader, ShaderModule* pTessControlShader, ShaderModule* pTessEvaluationShader, ShaderModule* pFragmentShader);
 	ASGI_API render_pass_ptr CreateRenderPass(const RenderPassCreateInfo& create_info);
 	ASGI_API graphics_pipeline_ptr CreateGraphicsPipeline(const GraphicsPipelineCreateInfo& create_info);
+	//create numPipelines pipelines at once, the batch is compiled in chunks on the cmdBufferTaskQueue of the context.
+	//false if any of them failed, its entry of pipelines is nullptr.
+	//must not be called from a task of the cmdBufferTaskQueue, it waits for the tasks it pushed to return
+	ASGI_API bool CreateGraphicsPipelines(uint32_t numPipelines, const GraphicsPipelineCreateInfo* createInfos, graphics_pipeline_ptr* pipelines);
 	ASGI_API frame_buffer_ptr CreateFrameBuffer(RenderPass* targetRenderPass, uint8_t numAttachment, ImageView** attachments, ClearValue* clearValues, uint32_t width, uint32_t height);
 	//
 	ASGI_API buffer_ptr CreateBuffer(uint64_t size, BufferUsageFlags usageFlags);
 	ASGI_API buffer_update_contex_ptr BeginUpdateBuffer();
 	ASGI_API bool EndUpdateBuffer(BufferUpdateContext* pUpdateContext);
 	ASGI_API void UpdateBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, void* pdata, BufferUpdateContext* pUpdateContext = nullptr);
+	//block until the copies of the updates made to the buffer so far are finished, false if one of them failed
+	ASGI_API bool WaitBufferUpdated(Buffer* pbuffer);
 	ASGI_API void* MapBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, MapMode mapMode = MapMode::MAP_MODE_WRITE);
 	ASGI_API void UnMapBuffer(Buffer* pbuffer);
 	ASGI_API void BindUniformBuffer(ShaderProgram* pProgram, uint8_t setIndex, uint32_t bindingIndex, Buffer* pbuffer, uint32_t offset, uint32_t size);
@@ -37,14 +47,43 @@ namespace ASGI {
 	ASGI_API bool EndUpdateImage(ImageUpdateContext* pUpdateContext);
 	ASGI_API bool UpdateImage2D(Image2D* pimg, uint32_t level, uint32_t offsetX, uint32_t offsetY, uint32_t sizeX, uint32_t sizeY, void* pdata, ImageUpdateContext* pUpdateContext = nullptr);
 
-	ASGI_API ExcuteQueue* AcquireExcuteQueue(QueueType queueType);
+	//an idle queue of the type, successive calls rotate over the idle queues. blocks while every queue of the type is busy,
+	//nullptr if none is finished before timeout in nanoseconds runs out
+	ASGI_API ExcuteQueue* AcquireExcuteQueue(QueueType queueType, uint64_t timeout = UINT64_MAX);
+	ASGI_API QueueStatistics GetQueueStatistics(ExcuteQueue* excuteQueue);
 	ASGI_API void WaitQueueExcuteFinished(uint32_t numWaiteQueue, ExcuteQueue** excuteQueues);
-	ASGI_API bool SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false);
+	//returns at once, the command buffers are handed to the queue when their second command buffers are translated.
+	//a command buffer must not be recorded into before it is encoded, BeginCmdBuffer and Present wait for it.
+	//nullptr if waiteFinished is set and the submission failed
+	ASGI_API submission_ptr SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false);
+	//chained after waiteSubmissions instead of the last submissions of queues, a submission on another queue is waited on with a semaphore
+	ASGI_API submission_ptr SubmitCommandsAfter(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteSubmission, Submission** waiteSubmissions, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false);
+	//the batches of a frame (shadow, main, post) as one submission, they go to the queue in one vkQueueSubmit with one fence.
+	//nullptr if numBatches is 0 or more than MAX_SUBMIT_BATCHES
+	ASGI_API submission_ptr SubmitBatches(ExcuteQueue* excuteQueue, uint32_t numBatches, const SubmitBatch* batches, bool waiteFinished = false);
+	//block until the submission is handed to the queue, false if it failed
+	ASGI_API bool WaitSubmission(Submission* submission);
+	//the GPU has finished the submission, every submission has a fence of its own so one submission is waited on and not its whole queue.
+	//false if the submission failed or timeout in nanoseconds ran out
+	ASGI_API bool IsSubmissionFinished(Submission* submission);
+	ASGI_API bool WaitSubmissionFinished(Submission* submission, uint64_t timeout = UINT64_MAX);
 	ASGI_API void Present(ExcuteQueue* excuteQueue, uint32_t numSwapchain, Swapchain** swapchains, bool waiteFinished = false);
+	//frames in flight, BeginFrame waits only for the frame numFramesInFlight frames ago and returns the acquired attachment.
+	//the submissions waiting on the swapchain belong to the frame, EndFrame presents it without waiting for the queue
+	ASGI_API uint32_t BeginFrame(Swapchain* swapchain);
+	ASGI_API void EndFrame(ExcuteQueue* excuteQueue, Swapchain* swapchain);
+	//hand the submits and presents of the current context to a thread of their own, the encoded submissions are queued to it
+	//and the recording thread does not wait for the driver. switch it while no submission is pending
+	ASGI_API void EnableSubmitThread(bool enable);
+	ASGI_API SubmitThreadStatistics GetSubmitThreadStatistics();
 
-	ASGI_API command_buffer_ptr CreateCmdBuffer();
+	ASGI_API command_buffer_ptr CreateCmdBuffer(const CommandBufferCreateInfo& create_info = CommandBufferCreateInfo());
 	ASGI_API void BeginCmdBuffer(CommandBuffer* cmdBuffer);
 	ASGI_API void EndCmdBuffer(CommandBuffer* cmdBuffer);
+	ASGI_API CommandBufferStatistics GetCmdBufferStatistics(CommandBuffer* cmdBuffer);
+	//the calling thread is translating recorded commands into the command buffer of the driver. for allocation hooks
+	//of tests, replay of a warmed up command buffer does not allocate
+	ASGI_API bool IsReplayingCommands();
 	ASGI_API bool BeginRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, FrameBuffer* frameBuffer);
 	ASGI_API void EndSubRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers);
 	ASGI_API void EndRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers);
@@ -57,6 +96,20 @@ namespace ASGI {
 	ASGI_API void CmdSetLineWidth(CommandBuffer*  cmdBuffer, float   lineWidth);
 	ASGI_API void CmdBindIndexBuffer(CommandBuffer* cmdBuffer, Buffer* pBuffer, uint32_t offset, Format indexFormat);
 	ASGI_API void CmdBindVertexBuffer(CommandBuffer* cmdBuffer, uint32_t  bindingIndex, Buffer*  pBuffer, uint32_t offset);
+	ASGI_API void CmdBindVertexBuffers(CommandBuffer* cmdBuffer, uint32_t firstBinding, uint32_t bindingCount, Buffer** ppBuffers, uint32_t* pOffsets);
 	ASGI_API void CmdDraw(CommandBuffer* cmdBuffer, uint32_t vertexCount, uint32_t  instanceCount, uint32_t firstVertex, uint32_t  firstInstance);
 	ASGI_API void CmdDrawIndexed(CommandBuffer* cmdBuffer, uint32_t indexCount, uint32_t   instanceCount, uint32_t  firstIndex, int32_t  vertexOffset, uint32_t  firstInstance);
+	//outside of a render pass, dstBuffer needs BUFFER_USAGE_TRANSFER_DST_BIT. offset and size are multiples of 4
+	ASGI_API void CmdFillBuffer(CommandBuffer* cmdBuffer, Buffer* dstBuffer, uint32_t dstOffset, uint32_t size, uint32_t  data);
+
+	//the device local buffers created while capture is enabled can be copied from, so CaptureCmdBuffer can read them back.
+	//buffers in host visible memory or created with BUFFER_USAGE_TRANSFER_SRC_BIT can always be captured
+	ASGI_API void EnableCapture(bool enable);
+	//write the recorded stream of a deferred command buffer and the resources it references to a file, call after EndCmdBuffer.
+	//fails for immediate command buffers, for streams with second command buffers excuted in parallel and for streams
+	//that reference a device local buffer created while capture was disabled without BUFFER_USAGE_TRANSFER_SRC_BIT
+	ASGI_API bool CaptureCmdBuffer(CommandBuffer* cmdBuffer, const char* path);
+	//record, translate and submit a captured stream numFrames times, the buffers are rebuilt from the capture.
+	//render passes, frame buffers and graphics pipelines are taken from externalResources in the order the stream first uses them
+	ASGI_API bool ReplayCapture(const char* path, uint32_t numFrames, uint32_t numExternalResources, GraphicsResource** externalResources, CaptureReplayStatistics* pStatistics, const CommandBufferCreateInfo& create_info = CommandBufferCreateInfo());
 }
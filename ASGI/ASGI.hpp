@@ -27,6 +27,8 @@ namespace ASGI {
 		Format preferredPixelFormat;
 		Format preferredDepthStencilFormat;
 		bool vsync;
+		//frames the CPU records ahead of the GPU with BeginFrame/EndFrame, 0 is 2. at most 3
+		uint32_t numFramesInFlight;
 	};
 
 	struct AttachmentDescription {
@@ -212,11 +214,137 @@ namespace ASGI {
 	};
 
 	struct CommandBufferCreateInfo {
+		//translate the Cmd* calls into the VkCommandBuffer at once instead of deferring them to SubmitCommands.
+		//only for buffers that are submitted directly, the second command buffers passed to EndRenderPass must be deferred.
+		//what is recorded can be submitted until the frame it was begun in comes around again, the submission fails after that
+		bool immediateRecord;
+		//pack runs of CmdDrawIndexed into an indirect buffer and draw each run with one indirect draw.
+		//ignored for immediate command buffer or when the device has no multiDrawIndirect
+		bool mergeDrawIndexed;
+		//
+		CommandBufferCreateInfo() {
+			immediateRecord = false;
+			mergeDrawIndexed = false;
+		}
+	};
 
+	//the scheduler created by CreateCmdBufferTaskScheduler
+	struct CmdBufferTaskSchedulerCreateInfo {
+		//0 starts one worker per core, minus the core of the thread that records the primary buffers
+		uint32_t numWorkers;
+		//pin worker i to core firstCore + i
+		bool pinWorkers;
+		uint32_t firstCore;
+		//tasks each worker can hold, rounded up to a power of 2. a task pushed while every worker is full runs on the pushing thread
+		uint32_t queueCapacity;
+		//
+		CmdBufferTaskSchedulerCreateInfo() {
+			numWorkers = 0;
+			pinWorkers = false;
+			firstCore = 0;
+			queueCapacity = 1024;
+		}
 	};
 
 	
 
+	struct CommandBufferStatistics {
+		//commands written into the command buffer
+		uint32_t numEmittedCommands;
+		//bind/set commands dropped because the same state is already bound
+		uint32_t numFilteredCommands;
+		//pipeline binds that kept the bound descriptor sets
+		uint32_t numFilteredDescriptorSetBinds;
+		//submits that reused the VkCommandBuffer encoded by a previous submit. only a submit made on the same thread during the same
+		//frame reuses it, the next frame takes its buffers from other pools, so an unchanged buffer is still encoded once per frame
+		uint32_t numReusedEncodes;
+		//CmdDrawIndexed calls packed into indirect draws, and the indirect draws emitted for them
+		uint32_t numMergedDraws;
+		uint32_t numIndirectDraws;
+		//
+		CommandBufferStatistics() {
+			numEmittedCommands = 0;
+			numFilteredCommands = 0;
+			numFilteredDescriptorSetBinds = 0;
+			numReusedEncodes = 0;
+			numMergedDraws = 0;
+			numIndirectDraws = 0;
+		}
+	};
+
+	//one batch of SubmitBatches. a batch may overlap with the batches before it on the queue unless waiteBatchMask has
+	//bit i set for each batch i before it that it waits on. the swapchains are the ones the batch renders to.
+	//waiteStages has a stage for each of waiteSubmissions, the commands of the batch before it run while the submission
+	//still runs on another queue. nullptr waits at PIPELINE_STAGE_ALL_COMMANDS_BIT
+	struct SubmitBatch {
+		uint32_t numCmdBuffers;
+		CommandBuffer** cmdBuffers;
+		uint32_t waiteBatchMask;
+		uint32_t numWaiteSubmission;
+		Submission** waiteSubmissions;
+		const PipelineStageFlags* waiteStages;
+		uint32_t numSwapchain;
+		Swapchain** waiteSwapchains;
+	};
+
+	struct SubmitThreadStatistics {
+		//packets handed to the queues by the submit thread, the packets waiting in its ring now and the most that ever waited
+		uint64_t numPackets;
+		uint32_t queueDepth;
+		uint32_t maxQueueDepth;
+		//milliseconds from pushing a packet until the submit thread takes it, and spent in the queue calls of a packet
+		double averageLatency;
+		double maxLatency;
+		double averageQueueTime;
+		//
+		SubmitThreadStatistics() {
+			numPackets = 0;
+			queueDepth = 0;
+			maxQueueDepth = 0;
+			averageLatency = 0.0;
+			maxLatency = 0.0;
+			averageQueueTime = 0.0;
+		}
+	};
+
+	struct QueueStatistics {
+		//times AcquireExcuteQueue handed the queue out and submissions made to it
+		uint64_t numAcquires;
+		uint64_t numSubmissions;
+		//acquires that found every queue of the type busy and blocked until this one was finished, and their average wait in milliseconds
+		uint64_t numBlockedAcquires;
+		double averageBlockedTime;
+		//the last submission made to the queue is finished
+		bool idle;
+		//
+		QueueStatistics() {
+			numAcquires = 0;
+			numSubmissions = 0;
+			numBlockedAcquires = 0;
+			averageBlockedTime = 0.0;
+			idle = true;
+		}
+	};
+
+	struct CaptureReplayStatistics {
+		//frames replayed and commands recorded per frame
+		uint32_t numFrames;
+		uint32_t numCommands;
+		//average per frame in milliseconds: the Cmd* calls, the translation into the VkCommandBuffer,
+		//and the queue submission including the wait for the GPU
+		double recordTime;
+		double translateTime;
+		double submitTime;
+		//
+		CaptureReplayStatistics() {
+			numFrames = 0;
+			numCommands = 0;
+			recordTime = 0.0;
+			translateTime = 0.0;
+			submitTime = 0.0;
+		}
+	};
+
 	struct  Texture2DCreateInfo
 	{
 
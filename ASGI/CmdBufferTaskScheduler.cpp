@@ -0,0 +1,114 @@
+#include "CmdBufferTaskScheduler.h"
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace ASGI {
+	CmdBufferTaskScheduler::CmdBufferTaskScheduler(const CmdBufferTaskSchedulerCreateInfo& create_info) {
+		mNextRing = 0;
+		mNumPending = 0;
+		mNumSleeping = 0;
+		mExit = false;
+		//the thread that records the primary buffers keeps a core for itself
+		uint32_t numWorkers = create_info.numWorkers;
+		if (numWorkers == 0) {
+			auto numCores = std::thread::hardware_concurrency();
+			numWorkers = numCores > 1 ? numCores - 1 : 1;
+		}
+		//
+		for (uint32_t i = 0; i < numWorkers; ++i) {
+			mRings.push_back(new MPMCRing<CmdBufferTask>(create_info.queueCapacity));
+		}
+		for (uint32_t i = 0; i < numWorkers; ++i) {
+			mWorkers.push_back(std::thread(&CmdBufferTaskScheduler::workerLoop, this, i));
+			if (!create_info.pinWorkers) {
+				continue;
+			}
+			//
+			auto core = create_info.firstCore + i;
+#ifdef _WIN32
+			if (core < 64) {
+				SetThreadAffinityMask(mWorkers.back().native_handle(), (DWORD_PTR)1 << core);
+			}
+#elif defined(__linux__)
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(core, &cpuset);
+			pthread_setaffinity_np(mWorkers.back().native_handle(), sizeof(cpuset), &cpuset);
+#endif
+		}
+	}
+
+	CmdBufferTaskScheduler::~CmdBufferTaskScheduler() {
+		{
+			std::lock_guard<std::mutex> lock(mMtxIdle);
+			mExit = true;
+		}
+		mCond.notify_all();
+		//the workers run the tasks left before they exit
+		for (auto &worker : mWorkers) {
+			worker.join();
+		}
+		for (auto pring : mRings) {
+			delete pring;
+		}
+	}
+
+	void CmdBufferTaskScheduler::PushTask(const CmdBufferTask& task) {
+		//counted before it is visible, so a worker never takes it while the count is still 0
+		mNumPending.fetch_add(1, std::memory_order_seq_cst);
+		uint32_t numRings = (uint32_t)mRings.size();
+		auto first = mNextRing.fetch_add(1, std::memory_order_relaxed);
+		uint32_t i = 0;
+		for (; i < numRings; ++i) {
+			if (mRings[(first + i) % numRings]->Push(task)) {
+				break;
+			}
+		}
+		if (i == numRings) {
+			mNumPending.fetch_sub(1, std::memory_order_relaxed);
+			task.Run();
+			return;
+		}
+		//
+		//a worker counts itself as sleeping before it checks mNumPending, so one of the two sees the other
+		if (mNumSleeping.load(std::memory_order_seq_cst) > 0) {
+			{
+				std::lock_guard<std::mutex> lock(mMtxIdle);
+			}
+			mCond.notify_one();
+		}
+	}
+
+	void CmdBufferTaskScheduler::workerLoop(uint32_t workerIndex) {
+		CmdBufferTask task;
+		while (true) {
+			if (takeTask(workerIndex, task)) {
+				task.Run();
+				continue;
+			}
+			//
+			std::unique_lock<std::mutex> lk(mMtxIdle);
+			mNumSleeping.fetch_add(1, std::memory_order_seq_cst);
+			mCond.wait(lk, [&] {return mExit || mNumPending.load(std::memory_order_seq_cst) > 0; });
+			mNumSleeping.fetch_sub(1, std::memory_order_relaxed);
+			if (mExit && mNumPending.load(std::memory_order_acquire) == 0) {
+				return;
+			}
+		}
+	}
+
+	bool CmdBufferTaskScheduler::takeTask(uint32_t workerIndex, CmdBufferTask& task) {
+		uint32_t numRings = (uint32_t)mRings.size();
+		for (uint32_t i = 0; i < numRings; ++i) {
+			if (mRings[(workerIndex + i) % numRings]->Pop(task)) {
+				mNumPending.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		//
+		return false;
+	}
+}
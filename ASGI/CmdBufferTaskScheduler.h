@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "ICmdBufferTaskQueue.h"
+#include "MPMCRing.h"
+#include "ASGI.hpp"
+
+namespace ASGI {
+	//work stealing scheduler for the second command buffers, every worker owns a ring.
+	//PushTask deals the tasks round robin, a worker takes the tasks of its own ring first and steals from the others when it runs dry.
+	//if every ring is full the task runs on the pushing thread
+	class CmdBufferTaskScheduler : public ICmdBufferTaskQueue {
+	public:
+		CmdBufferTaskScheduler(const CmdBufferTaskSchedulerCreateInfo& create_info);
+		~CmdBufferTaskScheduler() override;
+		//
+		void PushTask(const CmdBufferTask& task) override;
+
+		inline uint32_t GetNumWorkers() {
+			return (uint32_t)mWorkers.size();
+		}
+	private:
+		void workerLoop(uint32_t workerIndex);
+		bool takeTask(uint32_t workerIndex, CmdBufferTask& task);
+	private:
+		std::vector<std::thread> mWorkers;
+		std::vector<MPMCRing<CmdBufferTask>*> mRings;
+		std::atomic<uint32_t> mNextRing;
+		//tasks pushed and not taken yet, and the workers sleeping on mCond
+		std::atomic<uint32_t> mNumPending;
+		std::atomic<uint32_t> mNumSleeping;
+		std::mutex mMtxIdle;
+		std::condition_variable mCond;
+		bool mExit;
+	};
+}
@@ -15,6 +15,18 @@ typedef unsigned __int64 uint64_t;
 
 namespace ASGI {
 	const uint32_t SUBPASS_EXTERNAL = ~0U;
+	//SubmitBatch::waiteBatchMask has a bit per batch
+	const uint32_t MAX_SUBMIT_BATCHES = 32;
+	//the staging ring of the uploads starts at STAGING_RING_SIZE bytes and doubles while full up to MAX_STAGING_RING_SIZE,
+	//an upload that doesn't fit gets a staging buffer of its own
+	const uint64_t STAGING_RING_SIZE = 16 * 1024 * 1024;
+	const uint64_t MAX_STAGING_RING_SIZE = 256 * 1024 * 1024;
+	//built with ASGI_NO_STAGING_RING every upload creates and destroys a staging buffer of its own, the path before the ring
+#ifdef ASGI_NO_STAGING_RING
+	const bool STAGING_RING_ENABLED = false;
+#else
+	const bool STAGING_RING_ENABLED = true;
+#endif
 
 	enum GIType {
 		GI_VULKAN,
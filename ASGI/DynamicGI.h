@@ -16,6 +16,7 @@ namespace ASGI {
 
 		virtual RenderPass* CreateRenderPass(const RenderPassCreateInfo& create_info) = 0;
 		virtual GraphicsPipeline* CreateGraphicsPipeline(const GraphicsPipelineCreateInfo& create_info) = 0;
+		virtual bool CreateGraphicsPipelines(uint32_t numPipelines, const GraphicsPipelineCreateInfo* createInfos, GraphicsPipeline** pipelines) = 0;
 		virtual Swapchain* CreateSwapchain(const SwapchainCreateInfo& create_info) = 0;
 		virtual FrameBuffer* CreateFrameBuffer(RenderPass* targetRenderPass, uint8_t numAttachment, ImageView** attachments, ClearValue* clearValues, uint32_t width, uint32_t height) = 0;
 
@@ -26,6 +27,7 @@ namespace ASGI {
 		virtual BufferUpdateContext* BeginUpdateBuffer() = 0;
 		virtual bool EndUpdateBuffer(BufferUpdateContext* pUpdateContext) = 0;
 		virtual void UpdateBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, void* pdata, BufferUpdateContext* pUpdateContext = nullptr) = 0;
+		virtual bool WaitBufferUpdated(Buffer* pbuffer) = 0;
 		virtual void* MapBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, MapMode mapMode = MapMode::MAP_MODE_WRITE) = 0;
 		virtual void UnMapBuffer(Buffer* pbuffer) = 0;
 
@@ -50,14 +52,25 @@ namespace ASGI {
 		virtual bool EndUpdateImage(ImageUpdateContext* pUpdateContext) = 0;
 		virtual bool UpdateImage2D(Image2D* pimg, uint32_t level, uint32_t offsetX, uint32_t offsetY, uint32_t sizeX, uint32_t sizeY, void* pdata, ImageUpdateContext* pUpdateContext = nullptr) = 0;
 		//render command
-		virtual ExcuteQueue* AcquireExcuteQueue(QueueType queueType) = 0;
+		virtual ExcuteQueue* AcquireExcuteQueue(QueueType queueType, uint64_t timeout = UINT64_MAX) = 0;
+		virtual QueueStatistics GetQueueStatistics(ExcuteQueue* excuteQueue) = 0;
 		virtual void WaitQueueExcuteFinished(uint32_t numWaiteQueue, ExcuteQueue** excuteQueues) = 0;
-		virtual bool SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false) = 0;
+		virtual Submission* SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false) = 0;
+		virtual Submission* SubmitCommandsAfter(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteSubmission, Submission** waiteSubmissions, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false) = 0;
+		virtual Submission* SubmitBatches(ExcuteQueue* excuteQueue, uint32_t numBatches, const SubmitBatch* batches, bool waiteFinished = false) = 0;
+		virtual bool WaitSubmission(Submission* submission) = 0;
+		virtual bool IsSubmissionFinished(Submission* submission) = 0;
+		virtual bool WaitSubmissionFinished(Submission* submission, uint64_t timeout = UINT64_MAX) = 0;
 		virtual void Present(ExcuteQueue* excuteQueue, uint32_t numSwapchain, Swapchain** swapchains, bool waiteFinished = false) = 0;
+		virtual uint32_t BeginFrame(Swapchain* swapchain) = 0;
+		virtual void EndFrame(ExcuteQueue* excuteQueue, Swapchain* swapchain) = 0;
+		virtual void EnableSubmitThread(bool enable) = 0;
+		virtual SubmitThreadStatistics GetSubmitThreadStatistics() = 0;
 		//
-		virtual CommandBuffer* CreateCmdBuffer() = 0;
+		virtual CommandBuffer* CreateCmdBuffer(const CommandBufferCreateInfo& create_info) = 0;
 		virtual void BeginCmdBuffer(CommandBuffer* cmdBuffer) = 0;
 		virtual void EndCmdBuffer(CommandBuffer* cmdBuffer) = 0;
+		virtual CommandBufferStatistics GetCmdBufferStatistics(CommandBuffer* cmdBuffer) = 0;
 		virtual bool BeginRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, FrameBuffer* frameBuffer) = 0;
 		virtual void EndSubRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers) = 0;
 		virtual void EndRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers) = 0;
@@ -70,8 +83,14 @@ namespace ASGI {
 		virtual void CmdSetLineWidth(CommandBuffer*  commandBuffer, float   lineWidth) = 0;
 		virtual void CmdBindIndexBuffer(CommandBuffer* commandBuffer, Buffer* pBuffer, uint32_t offset, Format indexFormat) = 0;
 		virtual void CmdBindVertexBuffer(CommandBuffer* commandBuffer, uint32_t  bindingIndex, Buffer*  pBuffer, uint32_t offset) = 0;
+		virtual void CmdBindVertexBuffers(CommandBuffer* commandBuffer, uint32_t firstBinding, uint32_t bindingCount, Buffer** ppBuffers, uint32_t* pOffsets) = 0;
 		virtual void CmdDraw(CommandBuffer* commandBuffer, uint32_t vertexCount, uint32_t  instanceCount, uint32_t firstVertex, uint32_t  firstInstance) = 0;
 		virtual void CmdDrawIndexed(CommandBuffer* commandBuffer, uint32_t indexCount, uint32_t   instanceCount, uint32_t  firstIndex, int32_t  vertexOffset, uint32_t  firstInstance) = 0;
+		virtual void CmdFillBuffer(CommandBuffer* commandBuffer, Buffer* dstBuffer, uint32_t dstOffset, uint32_t size, uint32_t  data) = 0;
+		//command stream capture
+		virtual void EnableCapture(bool enable) = 0;
+		virtual bool CaptureCmdBuffer(CommandBuffer* cmdBuffer, const char* path) = 0;
+		virtual bool ReplayCapture(const char* path, uint32_t numFrames, uint32_t numExternalResources, GraphicsResource** externalResources, CaptureReplayStatistics* pStatistics, const CommandBufferCreateInfo& create_info) = 0;
 		/*
 		
 		virtual void CmdBindPipeline(CommandBuffer*  commandBuffer, ComputePipeline* pipeline) = 0;
@@ -93,7 +112,6 @@ namespace ASGI {
 		//CmdCopyBufferToImage
 		//CmdCopyImageToBuffer;
 		virtual void CmdUpdateBuffer(CommandBuffer* commandBuffer, Buffer* dstBuffer, uint32_t dstOffset, uint32_t dataSize, const void*  pData) = 0;
-		virtual void CmdFillBuffer(CommandBuffer* commandBuffer, Buffer* dstBuffer, uint32_t dstOffset, uint32_t size, uint32_t  data) = 0;
 		virtual void CmdClearColorImage(CommandBuffer* commandBuffer, Image* image, void*  pColor) = 0;
 		virtual void CmdClearDepthStencilImage(CommandBuffer* commandBuffer, Image* image, float depth, uint32_t stencil) = 0;
 		//CmdClearAttachments
@@ -1,24 +1,36 @@
 #pragma once
-#include<functional>
+#include <cstdint>
+#include <type_traits>
 
 namespace ASGI {
 	class CommandBuffer;
+	//userData is the word passed to the CmdBufferTask
+	typedef void(*CmdBufferTaskFunc)(CommandBuffer* cmdBuffer, CommandBuffer* secondCmdBuffer, uintptr_t userData);
+	//plain descriptor, a task queue can copy it around with memcpy and never allocates for it
 	struct CmdBufferTask {
+		CmdBufferTaskFunc excute;
 		CommandBuffer* mCmdBuffer;
 		CommandBuffer* mSecondCmdBuffer;
-		std::function<void(CommandBuffer*, CommandBuffer*)> excute;
+		uintptr_t mUserData;
 		//
 		CmdBufferTask() {}
-		CmdBufferTask(CommandBuffer* cmdBuffer, CommandBuffer* secondCmdBuffer, std::function<void(CommandBuffer*, CommandBuffer*)> excute_) {
+		CmdBufferTask(CommandBuffer* cmdBuffer, CommandBuffer* secondCmdBuffer, CmdBufferTaskFunc excute_, uintptr_t userData = 0) {
+			excute = excute_;
 			mCmdBuffer = cmdBuffer;
 			mSecondCmdBuffer = secondCmdBuffer;
-			excute = excute_;
+			mUserData = userData;
+		}
+
+		inline void Run() const {
+			excute(mCmdBuffer, mSecondCmdBuffer, mUserData);
 		}
 	};
+	static_assert(std::is_trivially_copyable<CmdBufferTask>::value, "CmdBufferTask must stay trivially copyable");
+
 	class ICmdBufferTaskQueue {
 	public:
 		virtual ~ICmdBufferTaskQueue() {}
 		//
-		virtual void PushTask(CmdBufferTask) = 0;
+		virtual void PushTask(const CmdBufferTask& task) = 0;
 	};
 }
@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+namespace ASGI {
+	//bounded lock free multi producer multi consumer queue, every cell carries a sequence number
+	//telling whether it is ready to be written or read at the current lap. the capacity is a power of 2
+	template<typename T>
+	class MPMCRing {
+		static_assert(std::is_trivially_copyable<T>::value, "MPMCRing element must be trivially copyable");
+		//
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+		static const size_t CACHE_LINE_SIZE = 64;
+	public:
+		MPMCRing(size_t capacity) {
+			size_t size = 2;
+			while (size < capacity) {
+				size *= 2;
+			}
+			mCells = new Cell[size];
+			mMask = size - 1;
+			for (size_t i = 0; i < size; ++i) {
+				mCells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+			mEnqueuePos = 0;
+			mDequeuePos = 0;
+		}
+
+		~MPMCRing() {
+			delete[] mCells;
+		}
+
+		//false if the ring is full
+		inline bool Push(const T& value) {
+			auto pos = mEnqueuePos.load(std::memory_order_relaxed);
+			Cell* pcell;
+			while (true) {
+				pcell = &mCells[pos & mMask];
+				auto seq = pcell->sequence.load(std::memory_order_acquire);
+				auto diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0) {
+					if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = mEnqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+			pcell->value = value;
+			pcell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		//false if the ring is empty
+		inline bool Pop(T& value) {
+			auto pos = mDequeuePos.load(std::memory_order_relaxed);
+			Cell* pcell;
+			while (true) {
+				pcell = &mCells[pos & mMask];
+				auto seq = pcell->sequence.load(std::memory_order_acquire);
+				auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0) {
+					if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = mDequeuePos.load(std::memory_order_relaxed);
+				}
+			}
+			value = pcell->value;
+			pcell->sequence.store(pos + mMask + 1, std::memory_order_release);
+			return true;
+		}
+	private:
+		Cell* mCells;
+		size_t mMask;
+		//the producers and the consumers write different cache lines
+		char mPad0[CACHE_LINE_SIZE];
+		std::atomic<size_t> mEnqueuePos;
+		char mPad1[CACHE_LINE_SIZE];
+		std::atomic<size_t> mDequeuePos;
+		char mPad2[CACHE_LINE_SIZE];
+	};
+}
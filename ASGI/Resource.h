@@ -209,6 +209,14 @@ namespace ASGI {
 	};
 	typedef ref_ptr<CommandBuffer> command_buffer_ptr;
 
+	//returned by SubmitCommands, the command buffers are handed to the queue once their second command buffers are translated
+	class Submission : public GraphicsResource {
+	protected:
+		Submission(GraphicsContext* pcontext) : GraphicsResource(pcontext) {}
+		virtual ~Submission() {}
+	};
+	typedef ref_ptr<Submission> submission_ptr;
+
 	class ShaderModule : public GraphicsResource {
 	protected:
 		ShaderModule(GraphicsContext* pcontext) : GraphicsResource(pcontext) {}
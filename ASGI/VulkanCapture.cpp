@@ -0,0 +1,592 @@
+#include "VulkanCapture.h"
+#include "VulkanGI.h"
+
+#include <cstdio>
+#include <chrono>
+
+namespace ASGI {
+	//copies the packets of a command stream and replaces the resource pointers with indices into the resource table
+	class VKCaptureWriter {
+	public:
+		typedef std::pair<VKCaptureResourceType, GraphicsResource*> ResourceItem;
+		//
+		bool AddPackets(const uint8_t* pdata, size_t size) {
+			auto offset = mStream.size();
+			mStream.insert(mStream.end(), pdata, pdata + size);
+			//
+			auto pcur = mStream.data() + offset;
+			auto pend = mStream.data() + mStream.size();
+			while (pcur < pend) {
+				auto pcmd = (VKCommand*)pcur;
+				if (!translatePacket(pcmd)) {
+					return false;
+				}
+				pcur += pcmd->size;
+			}
+			//
+			return true;
+		}
+
+		inline const std::vector<ResourceItem>& GetResources() {
+			return mResources;
+		}
+
+		inline const std::vector<uint8_t>& GetStream() {
+			return mStream;
+		}
+	private:
+		template<typename T>
+		inline T* addResource(VKCaptureResourceType type, T* presource) {
+			if (presource == nullptr) {
+				return nullptr;
+			}
+			//
+			auto itr = mResourceIndices.find(presource);
+			if (itr != mResourceIndices.end()) {
+				return (T*)(uintptr_t)itr->second;
+			}
+			//
+			mResources.push_back(ResourceItem(type, presource));
+			uint32_t index = mResources.size();
+			mResourceIndices[presource] = index;
+			return (T*)(uintptr_t)index;
+		}
+
+		bool translatePacket(VKCommand* pcmd) {
+			switch (pcmd->type) {
+			case VKCmdType::CMD_BEGIN_RENDER_PASS: {
+				auto p = static_cast<VKCmdBeginRenderPass*>(pcmd);
+				p->mRenderPass = addResource(VKCaptureResourceType::RENDER_PASS, p->mRenderPass);
+				p->mFrameBuffer = addResource(VKCaptureResourceType::FRAME_BUFFER, p->mFrameBuffer);
+				break;
+			}
+			case VKCmdType::CMD_BIND_PIPELINE: {
+				auto p = static_cast<VKCmdBindPipeline*>(pcmd);
+				if (p->mComputePipeline != nullptr) {
+					return false;
+				}
+				p->mGraphicsPipeline = addResource(VKCaptureResourceType::GRAPHICS_PIPELINE, p->mGraphicsPipeline);
+				break;
+			}
+			case VKCmdType::CMD_SET_VIEWPORT:
+				return static_cast<VKCmdSetViewport*>(pcmd)->mViewportCount <= VKBoundState::MAX_VIEWPORTS;
+			case VKCmdType::CMD_SET_SCISSOR:
+				return static_cast<VKCmdSetScissor*>(pcmd)->mScissorCount <= VKBoundState::MAX_VIEWPORTS;
+			case VKCmdType::CMD_BIND_INDEX_BUFFER: {
+				auto p = static_cast<VKCmdBindIndexBuffer*>(pcmd);
+				p->mBuffer = addResource(VKCaptureResourceType::BUFFER, p->mBuffer);
+				break;
+			}
+			case VKCmdType::CMD_BIND_VERTEX_BUFFER: {
+				auto p = static_cast<VKCmdBindVertexBuffer*>(pcmd);
+				p->mBuffer = addResource(VKCaptureResourceType::BUFFER, p->mBuffer);
+				break;
+			}
+			case VKCmdType::CMD_FILL_BUFFER: {
+				auto p = static_cast<VKCmdFillBuffer*>(pcmd);
+				p->mBuffer = addResource(VKCaptureResourceType::BUFFER, p->mBuffer);
+				break;
+			}
+			case VKCmdType::CMD_BIND_VERTEX_BUFFERS: {
+				auto p = static_cast<VKCmdBindVertexBuffers*>(pcmd);
+				if (p->mBindingCount > VKBoundState::MAX_VERTEX_BINDINGS) {
+					return false;
+				}
+				//the handles are meaningless in another process
+				auto buffers = p->GetBuffers();
+				auto sourceBuffers = p->GetSourceBuffers();
+				for (uint32_t i = 0; i < p->mBindingCount; ++i) {
+					buffers[i] = VK_NULL_HANDLE;
+					sourceBuffers[i] = addResource(VKCaptureResourceType::BUFFER, sourceBuffers[i]);
+				}
+				break;
+			}
+			default:
+				break;
+			}
+			//
+			return true;
+		}
+	private:
+		std::vector<ResourceItem> mResources;
+		std::unordered_map<GraphicsResource*, uint32_t> mResourceIndices;
+		std::vector<uint8_t> mStream;
+	};
+
+	//turn the resource indices of a loaded stream back into pointers, the stream is checked on the way
+	//so replayCommands can trust it
+	class VKCaptureReader {
+	public:
+		VKCaptureReader(const std::vector<GraphicsResource*>& resources, const std::vector<VKCaptureResourceType>& resourceTypes) :
+			mResources(resources), mResourceTypes(resourceTypes) {}
+
+		bool ResolvePackets(uint8_t* pdata, uint8_t* pend) {
+			while (pdata < pend) {
+				auto pcmd = (VKCommand*)pdata;
+				if (pend - pdata < (ptrdiff_t)sizeof(VKCommand) || pcmd->size < sizeof(VKCommand) || pcmd->size > pend - pdata ||
+					(pcmd->size & (VKCommand::PACKET_ALIGNMENT - 1)) != 0) {
+					return false;
+				}
+				if (!resolvePacket(pcmd)) {
+					return false;
+				}
+				pdata += pcmd->size;
+			}
+			//
+			return true;
+		}
+	private:
+		template<typename T>
+		inline bool resolveResource(VKCaptureResourceType type, T*& presource) {
+			auto index = (uintptr_t)presource;
+			if (index >= mResources.size() || (index > 0 && mResourceTypes[index] != type)) {
+				return false;
+			}
+			presource = static_cast<T*>(mResources[index]);
+			return true;
+		}
+
+		template<typename T>
+		inline bool checkSize(const VKCommand* pcmd, uint32_t dataSize) {
+			return pcmd->size >= sizeof(T) + dataSize;
+		}
+
+		bool resolvePacket(VKCommand* pcmd) {
+			switch (pcmd->type) {
+			case VKCmdType::CMD_BEGIN_CMD_BUFFER:
+			case VKCmdType::CMD_END_CMD_BUFFER:
+			case VKCmdType::CMD_END_SUB_RENDER_PASS:
+			case VKCmdType::CMD_END_RENDER_PASS:
+			case VKCmdType::CMD_BEGIN_COMPUTE_PASS:
+			case VKCmdType::CMD_END_COMPUTE_PASS:
+				return true;
+			case VKCmdType::CMD_BEGIN_RENDER_PASS: {
+				auto p = static_cast<VKCmdBeginRenderPass*>(pcmd);
+				return checkSize<VKCmdBeginRenderPass>(pcmd, 0) &&
+					resolveResource(VKCaptureResourceType::RENDER_PASS, p->mRenderPass) &&
+					resolveResource(VKCaptureResourceType::FRAME_BUFFER, p->mFrameBuffer);
+			}
+			case VKCmdType::CMD_BIND_PIPELINE: {
+				auto p = static_cast<VKCmdBindPipeline*>(pcmd);
+				return checkSize<VKCmdBindPipeline>(pcmd, 0) && p->mComputePipeline == nullptr &&
+					resolveResource(VKCaptureResourceType::GRAPHICS_PIPELINE, p->mGraphicsPipeline);
+			}
+			case VKCmdType::CMD_SET_VIEWPORT: {
+				auto p = static_cast<VKCmdSetViewport*>(pcmd);
+				return checkSize<VKCmdSetViewport>(pcmd, 0) && p->mViewportCount <= VKBoundState::MAX_VIEWPORTS &&
+					checkSize<VKCmdSetViewport>(pcmd, sizeof(VkViewport) * p->mViewportCount);
+			}
+			case VKCmdType::CMD_SET_SCISSOR: {
+				auto p = static_cast<VKCmdSetScissor*>(pcmd);
+				return checkSize<VKCmdSetScissor>(pcmd, 0) && p->mScissorCount <= VKBoundState::MAX_VIEWPORTS &&
+					checkSize<VKCmdSetScissor>(pcmd, sizeof(VkRect2D) * p->mScissorCount);
+			}
+			case VKCmdType::CMD_SET_LINE_WIDTH:
+				return checkSize<VKCmdSetLineWidth>(pcmd, 0);
+			case VKCmdType::CMD_BIND_INDEX_BUFFER: {
+				auto p = static_cast<VKCmdBindIndexBuffer*>(pcmd);
+				return checkSize<VKCmdBindIndexBuffer>(pcmd, 0) && resolveResource(VKCaptureResourceType::BUFFER, p->mBuffer);
+			}
+			case VKCmdType::CMD_BIND_VERTEX_BUFFER: {
+				auto p = static_cast<VKCmdBindVertexBuffer*>(pcmd);
+				return checkSize<VKCmdBindVertexBuffer>(pcmd, 0) && resolveResource(VKCaptureResourceType::BUFFER, p->mBuffer);
+			}
+			case VKCmdType::CMD_BIND_VERTEX_BUFFERS: {
+				auto p = static_cast<VKCmdBindVertexBuffers*>(pcmd);
+				if (!checkSize<VKCmdBindVertexBuffers>(pcmd, 0) || p->mBindingCount > VKBoundState::MAX_VERTEX_BINDINGS ||
+					!checkSize<VKCmdBindVertexBuffers>(pcmd, VKCmdBindVertexBuffers::GetDataSize(p->mBindingCount))) {
+					return false;
+				}
+				//
+				auto sourceBuffers = p->GetSourceBuffers();
+				for (uint32_t i = 0; i < p->mBindingCount; ++i) {
+					if (!resolveResource(VKCaptureResourceType::BUFFER, sourceBuffers[i]) || sourceBuffers[i] == nullptr) {
+						return false;
+					}
+				}
+				return true;
+			}
+			case VKCmdType::CMD_DRAW:
+				return checkSize<VKCmdDraw>(pcmd, 0);
+			case VKCmdType::CMD_DRAW_INDEXED:
+				return checkSize<VKCmdDrawIndexed>(pcmd, 0);
+			case VKCmdType::CMD_FILL_BUFFER: {
+				auto p = static_cast<VKCmdFillBuffer*>(pcmd);
+				return checkSize<VKCmdFillBuffer>(pcmd, 0) && resolveResource(VKCaptureResourceType::BUFFER, p->mBuffer) && p->mBuffer != nullptr;
+			}
+			default:
+				return false;
+			}
+		}
+	private:
+		const std::vector<GraphicsResource*>& mResources;
+		const std::vector<VKCaptureResourceType>& mResourceTypes;
+	};
+
+	bool VulkanGI::readbackBuffer(VKBuffer* buffer, void* pdata) {
+		auto size = (uint32_t)buffer->GetSize();
+		auto memoryPropertyFlags = mVkDeviceMemoryProperties.memoryTypes[buffer->mMemory->GetMemoryTypeIndex()].propertyFlags;
+		//
+		if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
+			void* psrcData = nullptr;
+			if (VKMemoryManager::Instance()->MapMemory(buffer->mMemory, &psrcData) != VK_SUCCESS) {
+				return false;
+			}
+			if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0) {
+				VKMemoryManager::Instance()->InvalidateAllocation(buffer->mMemory, 0, size);
+			}
+			memcpy(pdata, psrcData, size);
+			VKMemoryManager::Instance()->UnMapMemory(buffer->mMemory);
+			//
+			return true;
+		}
+		//the buffer was created while capture was disabled, see EnableCapture
+		if ((buffer->mVkUsageFlags & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) == 0) {
+			return false;
+		}
+		//
+		VkBufferCreateInfo rbInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		rbInfo.size = size;
+		rbInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		rbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		VkBuffer stagingBuffer = VK_NULL_HANDLE;
+		VKMemory* pmemory = nullptr;
+		if (VKMemoryManager::Instance()->CreateBuffer(rbInfo, &stagingBuffer, VKMemory::MemoryUsage::VK_MEMORY_USAGE_GPU_TO_CPU, pmemory) != VK_SUCCESS) {
+			return false;
+		}
+		//
+		if (!BeginSingleTimeCommands()) {
+			VKMemoryManager::Instance()->DestoryBuffer(stagingBuffer, pmemory);
+			return false;
+		}
+		//
+		//a buffer still owned by the transfer queue is taken over before it is read
+		acquireUpload(buffer->mPendingUpload);
+		buffer->mInUse.store(true, std::memory_order_relaxed);
+		VkBufferCopy rbCopyRegion = {};
+		rbCopyRegion.srcOffset = 0;
+		rbCopyRegion.dstOffset = 0;
+		rbCopyRegion.size = size;
+		vkCmdCopyBuffer(mCmdBufferManger->GetUpLoadCmdBuffer(), buffer->mVkBuffer, stagingBuffer, 1, &rbCopyRegion);
+		//
+		VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = stagingBuffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(mCmdBufferManger->GetUpLoadCmdBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		//
+		//the readback is the one copy the host waits for
+		auto psubmission = EndSingleTimeCommands(0, nullptr);
+		auto res = psubmission != nullptr && psubmission->WaiteFinished();
+		void* psrcData = nullptr;
+		if (res && VKMemoryManager::Instance()->MapMemory(pmemory, &psrcData) == VK_SUCCESS) {
+			VKMemoryManager::Instance()->InvalidateAllocation(pmemory, 0, size);
+			memcpy(pdata, psrcData, size);
+			VKMemoryManager::Instance()->UnMapMemory(pmemory);
+		}
+		else {
+			res = false;
+		}
+		VKMemoryManager::Instance()->DestoryBuffer(stagingBuffer, pmemory);
+		//
+		return res;
+	}
+
+	bool VulkanGI::CaptureCmdBuffer(CommandBuffer* cmdBuffer, const char* path) {
+		auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+		//immediate command buffer keeps no stream to replay, parallel second command buffers are encoded from their own streams
+		if (pcmdBuffer->IsImmediateRecord() || pcmdBuffer->GetNumSecondCmdBuffer() > 0) {
+			return false;
+		}
+		//
+		VKCaptureWriter writer;
+		bool res = true;
+		pcmdBuffer->mArena.ForEachChunk([&](const uint8_t* pdata, size_t used) {
+			res = res && writer.AddPackets(pdata, used);
+		});
+		if (!res) {
+			return false;
+		}
+		//
+		FILE* pfile = fopen(path, "wb");
+		if (pfile == nullptr) {
+			return false;
+		}
+		//
+		auto &resources = writer.GetResources();
+		auto &stream = writer.GetStream();
+		VKCaptureHeader header;
+		header.magic = VKCaptureHeader::MAGIC;
+		header.version = VKCaptureHeader::VERSION;
+		header.numResources = resources.size();
+		header.streamSize = stream.size();
+		res = fwrite(&header, sizeof(header), 1, pfile) == 1;
+		//
+		std::vector<uint8_t> data;
+		for (auto &itm : resources) {
+			if (!res) {
+				break;
+			}
+			//
+			VKCaptureResource desc = {};
+			desc.type = itm.first;
+			data.clear();
+			if (itm.first == VKCaptureResourceType::BUFFER) {
+				auto pbuffer = VKBuffer::Cast(static_cast<Buffer*>(itm.second));
+				desc.usageFlags = pbuffer->GetUsageFlags();
+				desc.size = pbuffer->GetSize();
+				data.resize((size_t)desc.size);
+				res = desc.size <= UINT32_MAX && readbackBuffer(pbuffer, data.data());
+			}
+			else if (itm.first == VKCaptureResourceType::FRAME_BUFFER) {
+				auto pframeBuffer = VKFrameBuffer::Cast(static_cast<FrameBuffer*>(itm.second));
+				desc.width = pframeBuffer->GetWidth();
+				desc.height = pframeBuffer->GetHeight();
+				desc.numAttachments = pframeBuffer->GetNumAttachment();
+				data.resize(desc.numAttachments * sizeof(VkClearValue));
+				memcpy(data.data(), pframeBuffer->GetVKClearValues(), data.size());
+			}
+			desc.dataSize = data.size();
+			//
+			res = res && fwrite(&desc, sizeof(desc), 1, pfile) == 1;
+			res = res && (data.empty() || fwrite(data.data(), data.size(), 1, pfile) == 1);
+		}
+		res = res && (stream.empty() || fwrite(stream.data(), stream.size(), 1, pfile) == 1);
+		fclose(pfile);
+		//
+		return res;
+	}
+
+	void VulkanGI::replayCommands(CommandBuffer* cmdBuffer, const uint8_t* pdata, const uint8_t* pend) {
+		RenderPass* renderPass = nullptr;
+		Viewport viewports[VKBoundState::MAX_VIEWPORTS];
+		Rect2D scissors[VKBoundState::MAX_VIEWPORTS];
+		uint32_t vertexOffsets[VKBoundState::MAX_VERTEX_BINDINGS];
+		//
+		while (pdata < pend) {
+			auto pcmd = (const VKCommand*)pdata;
+			switch (pcmd->type) {
+			case VKCmdType::CMD_BEGIN_CMD_BUFFER:
+				BeginCmdBuffer(cmdBuffer);
+				break;
+			case VKCmdType::CMD_END_CMD_BUFFER:
+				EndCmdBuffer(cmdBuffer);
+				break;
+			case VKCmdType::CMD_BEGIN_RENDER_PASS: {
+				auto p = static_cast<const VKCmdBeginRenderPass*>(pcmd);
+				renderPass = p->mRenderPass;
+				BeginRenderPass(cmdBuffer, p->mRenderPass, p->mFrameBuffer);
+				break;
+			}
+			case VKCmdType::CMD_END_SUB_RENDER_PASS:
+				EndSubRenderPass(cmdBuffer, renderPass, 0, nullptr);
+				break;
+			case VKCmdType::CMD_END_RENDER_PASS:
+				EndRenderPass(cmdBuffer, renderPass, 0, nullptr);
+				break;
+			case VKCmdType::CMD_BEGIN_COMPUTE_PASS:
+				BeginComputePass(cmdBuffer, nullptr);
+				break;
+			case VKCmdType::CMD_END_COMPUTE_PASS:
+				EndComputePass(cmdBuffer, nullptr, 0, nullptr);
+				break;
+			case VKCmdType::CMD_BIND_PIPELINE:
+				CmdBindPipeline(cmdBuffer, static_cast<const VKCmdBindPipeline*>(pcmd)->mGraphicsPipeline);
+				break;
+			case VKCmdType::CMD_SET_VIEWPORT: {
+				auto p = static_cast<const VKCmdSetViewport*>(pcmd);
+				auto vkViewports = p->GetViewports();
+				for (uint32_t i = 0; i < p->mViewportCount; ++i) {
+					viewports[i].x = vkViewports[i].x;
+					viewports[i].y = vkViewports[i].y;
+					viewports[i].width = vkViewports[i].width;
+					viewports[i].height = vkViewports[i].height;
+					viewports[i].minDepth = vkViewports[i].minDepth;
+					viewports[i].maxDepth = vkViewports[i].maxDepth;
+				}
+				CmdSetViewport(cmdBuffer, p->mFirstViewport, p->mViewportCount, viewports);
+				break;
+			}
+			case VKCmdType::CMD_SET_SCISSOR: {
+				auto p = static_cast<const VKCmdSetScissor*>(pcmd);
+				auto vkScissors = p->GetScissors();
+				for (uint32_t i = 0; i < p->mScissorCount; ++i) {
+					scissors[i].offset.x = vkScissors[i].offset.x;
+					scissors[i].offset.y = vkScissors[i].offset.y;
+					scissors[i].extent.width = vkScissors[i].extent.width;
+					scissors[i].extent.height = vkScissors[i].extent.height;
+				}
+				CmdSetScissor(cmdBuffer, p->mFirstScissor, p->mScissorCount, scissors);
+				break;
+			}
+			case VKCmdType::CMD_SET_LINE_WIDTH:
+				CmdSetLineWidth(cmdBuffer, static_cast<const VKCmdSetLineWidth*>(pcmd)->mLineWidth);
+				break;
+			case VKCmdType::CMD_BIND_INDEX_BUFFER: {
+				auto p = static_cast<const VKCmdBindIndexBuffer*>(pcmd);
+				CmdBindIndexBuffer(cmdBuffer, p->mBuffer, p->mOffset, p->mFormat);
+				break;
+			}
+			case VKCmdType::CMD_BIND_VERTEX_BUFFER: {
+				auto p = static_cast<const VKCmdBindVertexBuffer*>(pcmd);
+				CmdBindVertexBuffer(cmdBuffer, p->mBindingIndex, p->mBuffer, p->mOffset);
+				break;
+			}
+			case VKCmdType::CMD_BIND_VERTEX_BUFFERS: {
+				auto p = static_cast<const VKCmdBindVertexBuffers*>(pcmd);
+				auto offsets = p->GetOffsets();
+				for (uint32_t i = 0; i < p->mBindingCount; ++i) {
+					vertexOffsets[i] = (uint32_t)offsets[i];
+				}
+				CmdBindVertexBuffers(cmdBuffer, p->mFirstBinding, p->mBindingCount, p->GetSourceBuffers(), vertexOffsets);
+				break;
+			}
+			case VKCmdType::CMD_DRAW: {
+				auto p = static_cast<const VKCmdDraw*>(pcmd);
+				CmdDraw(cmdBuffer, p->mVirtexCount, p->mInstanceCount, p->mFirstVertex, p->mFirstInstance);
+				break;
+			}
+			case VKCmdType::CMD_DRAW_INDEXED: {
+				auto p = static_cast<const VKCmdDrawIndexed*>(pcmd);
+				CmdDrawIndexed(cmdBuffer, p->mIndexCount, p->mInstanceCount, p->mFirstIndex, (int32_t)p->mVertexOffset, p->mFirstInstance);
+				break;
+			}
+			case VKCmdType::CMD_FILL_BUFFER: {
+				auto p = static_cast<const VKCmdFillBuffer*>(pcmd);
+				CmdFillBuffer(cmdBuffer, p->mBuffer, p->mOffset, p->mSize, p->mData);
+				break;
+			}
+			default:
+				break;
+			}
+			//
+			pdata += pcmd->size;
+		}
+	}
+
+	bool VulkanGI::ReplayCapture(const char* path, uint32_t numFrames, uint32_t numExternalResources, GraphicsResource** externalResources, CaptureReplayStatistics* pStatistics, const CommandBufferCreateInfo& create_info) {
+		FILE* pfile = fopen(path, "rb");
+		if (pfile == nullptr) {
+			return false;
+		}
+		//
+		VKCaptureHeader header;
+		if (fread(&header, sizeof(header), 1, pfile) != 1 || header.magic != VKCaptureHeader::MAGIC || header.version != VKCaptureHeader::VERSION) {
+			fclose(pfile);
+			return false;
+		}
+		//
+		//index 0 stands for nullptr
+		std::vector<GraphicsResource*> resources(header.numResources + 1, nullptr);
+		std::vector<VKCaptureResourceType> resourceTypes(header.numResources + 1, VKCaptureResourceType::BUFFER);
+		std::vector<buffer_ptr> buffers;
+		std::vector<uint8_t> data;
+		uint32_t externalIndex = 0;
+		bool res = true;
+		for (uint32_t i = 1; i <= header.numResources && res; ++i) {
+			VKCaptureResource desc;
+			res = fread(&desc, sizeof(desc), 1, pfile) == 1;
+			if (res && desc.dataSize > 0) {
+				data.resize(desc.dataSize);
+				res = fread(data.data(), desc.dataSize, 1, pfile) == 1;
+			}
+			if (!res) {
+				break;
+			}
+			resourceTypes[i] = desc.type;
+			//
+			if (desc.type == VKCaptureResourceType::BUFFER) {
+				//the contents go through a staging buffer if the buffer is not host visible
+				auto pbuffer = CreateBuffer(desc.size, desc.usageFlags | BufferUsageFlagBits::BUFFER_USAGE_TRANSFER_DST_BIT);
+				if (pbuffer == nullptr) {
+					res = false;
+					break;
+				}
+				buffers.push_back(pbuffer);
+				resources[i] = pbuffer;
+				res = desc.dataSize == 0 || updateBuffer(VKBuffer::Cast(pbuffer), 0, desc.dataSize, data.data(), nullptr);
+				continue;
+			}
+			//
+			if (externalIndex >= numExternalResources) {
+				res = false;
+				break;
+			}
+			auto presource = externalResources[externalIndex++];
+			resources[i] = presource;
+			if (desc.type == VKCaptureResourceType::RENDER_PASS) {
+				res = dynamic_cast<RenderPass*>(presource) != nullptr;
+			}
+			else if (desc.type == VKCaptureResourceType::GRAPHICS_PIPELINE) {
+				res = dynamic_cast<GraphicsPipeline*>(presource) != nullptr;
+			}
+			else if (desc.type == VKCaptureResourceType::FRAME_BUFFER) {
+				auto pframeBuffer = dynamic_cast<FrameBuffer*>(presource);
+				res = pframeBuffer != nullptr && pframeBuffer->GetNumAttachment() == desc.numAttachments &&
+					pframeBuffer->GetExtent().width == desc.width && pframeBuffer->GetExtent().height == desc.height &&
+					desc.dataSize == desc.numAttachments * sizeof(ClearValue);
+				//the clear values are part of the frame, the recorded ones are restored
+				for (uint32_t j = 0; res && j < desc.numAttachments; ++j) {
+					pframeBuffer->SetClearValue(j, ((ClearValue*)data.data())[j]);
+				}
+			}
+			else {
+				res = false;
+			}
+		}
+		//
+		std::vector<uint8_t> stream(header.streamSize);
+		res = res && (stream.empty() || fread(stream.data(), stream.size(), 1, pfile) == 1);
+		fclose(pfile);
+		//
+		VKCaptureReader reader(resources, resourceTypes);
+		if (!res || !reader.ResolvePackets(stream.data(), stream.data() + stream.size())) {
+			return false;
+		}
+		//
+		command_buffer_ptr cmdBuffer = CreateCmdBuffer(create_info);
+		auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+		auto excuteQueue = AcquireExcuteQueue(QueueType::QUEUE_TYPE_GRAPHICS);
+		CommandBuffer* cmdBuffers[1] = { cmdBuffer };
+		CaptureReplayStatistics statistics;
+		typedef std::chrono::high_resolution_clock Clock;
+		for (uint32_t i = 0; i < numFrames && res; ++i) {
+			auto recordStart = Clock::now();
+			replayCommands(cmdBuffer, stream.data(), stream.data() + stream.size());
+			//
+			//an unchanged stream would reuse the encoding of the previous frame, the replay measures the translation every frame
+			auto translateStart = Clock::now();
+			VKCommandBuffer::InvalidateEncodedCommands();
+			res = pcmdBuffer->Excute() == VK_SUCCESS;
+			//
+			auto submitStart = Clock::now();
+			submission_ptr submission = res ? SubmitCommands(excuteQueue, 1, cmdBuffers, 0, nullptr, 0, nullptr, true) : nullptr;
+			res = submission != nullptr;
+			//there is no present, every replayed frame is closed here
+			signalFrame(VKExcuteQueue::Cast(excuteQueue));
+			auto submitEnd = Clock::now();
+			//
+			statistics.recordTime += std::chrono::duration<double, std::milli>(translateStart - recordStart).count();
+			statistics.translateTime += std::chrono::duration<double, std::milli>(submitStart - translateStart).count();
+			statistics.submitTime += std::chrono::duration<double, std::milli>(submitEnd - submitStart).count();
+			++statistics.numFrames;
+		}
+		//
+		statistics.numCommands = pcmdBuffer->GetStatistics().numEmittedCommands;
+		if (statistics.numFrames > 0) {
+			statistics.recordTime /= statistics.numFrames;
+			statistics.translateTime /= statistics.numFrames;
+			statistics.submitTime /= statistics.numFrames;
+		}
+		if (pStatistics != nullptr) {
+			*pStatistics = statistics;
+		}
+		//
+		return res;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ASGI {
+	//layout of a command stream capture file, see VulkanGI::CaptureCmdBuffer and VulkanGI::ReplayCapture.
+	//the file is the header, numResources resource entries each followed by dataSize bytes, then streamSize bytes of packets.
+	//the packets are the VKCommand stream as recorded, every resource pointer in them is replaced with the 1 based index
+	//of its resource entry, 0 stays nullptr
+	struct VKCaptureHeader {
+		static const uint32_t MAGIC = 0x43475341;		//'ASGC'
+		static const uint32_t VERSION = 1;
+		//
+		uint32_t magic;
+		uint32_t version;
+		uint32_t numResources;
+		uint32_t streamSize;
+	};
+
+	//buffers are rebuilt from the capture, the others can not be created without the application
+	//and are passed to the replay in the order of their entries
+	enum class VKCaptureResourceType : uint32_t {
+		BUFFER,
+		RENDER_PASS,
+		FRAME_BUFFER,
+		GRAPHICS_PIPELINE,
+	};
+
+	//buffer: usageFlags, size, the contents as data.
+	//frame buffer: width, height, numAttachments, the clear values as data
+	struct VKCaptureResource {
+		VKCaptureResourceType type;
+		uint32_t usageFlags;
+		uint64_t size;
+		uint32_t dataSize;
+		uint32_t width;
+		uint32_t height;
+		uint32_t numAttachments;
+	};
+}
@@ -2,105 +2,726 @@
 #include "VulkanResource.h"
 
 namespace ASGI {
-	void VKCmdBeginRenderPass::excute(CommandBuffer* cmdBuffer) {
-		auto tmp = VKCommandBuffer::Cast(cmdBuffer);
+	std::atomic<uint64_t> VKCommandBuffer::sResourceEpoch(1);
+
+	//this thread is in excuteCommands, see IsReplaying
+	static thread_local bool tReplaying = false;
+
+	//thread slots are shared by all managers, the slot of an exited thread is handed to the next new thread
+	static std::mutex sMtxThreadSlots;
+	static std::vector<uint32_t> sFreeThreadSlots;
+	static uint32_t sNumThreadSlots = 0;
+
+	struct VKThreadSlot {
+		uint32_t index;
 		//
-		auto vkFrameBuffer = VKFrameBuffer::Cast(mFrameBuffer);
-		std::vector<VkClearValue> clearValues(vkFrameBuffer->GetNumAttachment());
-		for (int i = 0; i < clearValues.size(); ++i) {
-			auto &clearValue = vkFrameBuffer->GetClearValue(i);
-			memcpy(&clearValues[i], &clearValue, sizeof(clearValue));
+		VKThreadSlot() {
+			std::lock_guard<std::mutex> lock(sMtxThreadSlots);
+			if (!sFreeThreadSlots.empty()) {
+				index = sFreeThreadSlots.back();
+				sFreeThreadSlots.pop_back();
+			}
+			else {
+				index = sNumThreadSlots++;
+			}
+		}
+
+		~VKThreadSlot() {
+			std::lock_guard<std::mutex> lock(sMtxThreadSlots);
+			sFreeThreadSlots.push_back(index);
+		}
+	};
+	static thread_local VKThreadSlot tThreadSlot;
+
+	VKCmdBufferManager::VKCmdBufferManager(VkDevice logicDevice, uint32_t graphicsQueueFamilyIndex, uint32_t computeQueueFamilyIndex) {
+		mLogicDevice = logicDevice;
+		mGraphicsQueueFamilyIndex = graphicsQueueFamilyIndex;
+		mComputeQueueFamilyIndex = computeQueueFamilyIndex;
+		mFrameIndex = 0;
+		mNumSignaledFrames = 0;
+		mSubmitSerial = 0;
+		mCompletedSerial = 0;
+		mNumAllocated = 0;
+		mNumLive = 0;
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+			for (uint32_t j = 0; j < MAX_THREAD_POOLS; ++j) {
+				mThreadPools[i][j] = nullptr;
+			}
+		}
+		//the slots start as finished frames
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceCreateInfo.pNext = nullptr;
+		fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+			if (vkCreateFence(mLogicDevice, &fenceCreateInfo, nullptr, &mFrameFences[i]) != VK_SUCCESS) {
+				mFrameFences[i] = VK_NULL_HANDLE;
+			}
+		}
+		//
+		mUploadCmdPool = VK_NULL_HANDLE;
+		mUploadCmdBuffer = nullptr;
+		VkCommandPoolCreateInfo cmdPoolCreateInfo = {};
+		cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmdPoolCreateInfo.pNext = nullptr;
+		cmdPoolCreateInfo.queueFamilyIndex = mGraphicsQueueFamilyIndex;
+		cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		if (vkCreateCommandPool(mLogicDevice, &cmdPoolCreateInfo, nullptr, &mUploadCmdPool) != VK_SUCCESS) {
+			return;
+		}
+		//
+		VkCommandBufferAllocateInfo cmdBufferAllocInfo = {};
+		cmdBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdBufferAllocInfo.commandPool = mUploadCmdPool;
+		cmdBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmdBufferAllocInfo.pNext = nullptr;
+		cmdBufferAllocInfo.commandBufferCount = 1;
+		vkAllocateCommandBuffers(mLogicDevice, &cmdBufferAllocInfo, &mUploadCmdBuffer);
+	}
+
+	VKCmdBufferManager::~VKCmdBufferManager() {
+		//a submission without a fence was waited for when it was made
+		for (auto &submission : mSubmissions) {
+			if (submission.fence == VK_NULL_HANDLE) {
+				continue;
+			}
+			vkWaitForFences(mLogicDevice, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+			vkDestroyFence(mLogicDevice, submission.fence, nullptr);
+		}
+		for (auto fence : mFreeFences) {
+			vkDestroyFence(mLogicDevice, fence, nullptr);
+		}
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+			if (mFrameFences[i] != VK_NULL_HANDLE) {
+				vkWaitForFences(mLogicDevice, 1, &mFrameFences[i], VK_TRUE, UINT64_MAX);
+				vkDestroyFence(mLogicDevice, mFrameFences[i], nullptr);
+			}
+			//
+			for (uint32_t j = 0; j < MAX_THREAD_POOLS; ++j) {
+				auto pool = mThreadPools[i][j].load();
+				if (pool == nullptr) {
+					continue;
+				}
+				//destroying the pool frees its command buffers
+				for (uint32_t k = 0; k < 2; ++k) {
+					if (pool->cmdPools[k] != VK_NULL_HANDLE) {
+						vkDestroyCommandPool(mLogicDevice, pool->cmdPools[k], nullptr);
+					}
+				}
+				for (auto pblock : pool->blocks) {
+					delete[] pblock;
+				}
+				for (auto &page : pool->indirectPages) {
+					VKMemoryManager::Instance()->UnMapMemory(page.memory);
+					VKMemoryManager::Instance()->DestoryBuffer(page.buffer, page.memory);
+				}
+				delete pool;
+			}
+		}
+		//
+		if (mUploadCmdPool != VK_NULL_HANDLE) {
+			vkDestroyCommandPool(mLogicDevice, mUploadCmdPool, nullptr);
+		}
+	}
+
+	bool VKCmdBufferManager::NextUpLoadCmdBuffer() {
+		std::lock_guard<std::mutex> lock(mMtxUpload);
+		if (!mFreeUploadCmdBuffers.empty()) {
+			mUploadCmdBuffer = mFreeUploadCmdBuffers.back();
+			mFreeUploadCmdBuffers.pop_back();
+			return true;
+		}
+		//
+		VkCommandBufferAllocateInfo cmdBufferAllocInfo = {};
+		cmdBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdBufferAllocInfo.commandPool = mUploadCmdPool;
+		cmdBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmdBufferAllocInfo.pNext = nullptr;
+		cmdBufferAllocInfo.commandBufferCount = 1;
+		VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+		if (mUploadCmdPool == VK_NULL_HANDLE || vkAllocateCommandBuffers(mLogicDevice, &cmdBufferAllocInfo, &cmdBuffer) != VK_SUCCESS) {
+			return false;
+		}
+		mUploadCmdBuffer = cmdBuffer;
+		return true;
+	}
+
+	void VKCmdBufferManager::FreeUpLoadCmdBuffer(VkCommandBuffer cmdBuffer) {
+		std::lock_guard<std::mutex> lock(mMtxUpload);
+		mFreeUploadCmdBuffers.push_back(cmdBuffer);
+	}
+
+	uint64_t VKCmdBufferManager::AdvanceFrame() {
+		auto frameIndex = mFrameIndex.load(std::memory_order_relaxed);
+		//the fence of the next slot is signaled by the frame before this one
+		{
+			std::unique_lock<std::mutex> lk(mMtxFrame);
+			mFrameCond.wait(lk, [&] {return mNumSignaledFrames >= frameIndex; });
+		}
+		//the pools of the next frame are reset lazily by their threads, see getThreadPool
+		auto &nextFence = mFrameFences[(frameIndex + 1) % MAX_FRAMES_IN_FLIGHT];
+		if (nextFence != VK_NULL_HANDLE) {
+			vkWaitForFences(mLogicDevice, 1, &nextFence, VK_TRUE, UINT64_MAX);
+		}
+		mFrameIndex.store(frameIndex + 1, std::memory_order_release);
+		return frameIndex;
+	}
+
+	void VKCmdBufferManager::SignalFrame(VkQueue queue, uint64_t frameIndex) {
+		auto &frameFence = mFrameFences[frameIndex % MAX_FRAMES_IN_FLIGHT];
+		//a submit without batches signals the fence once all the work submitted to the queue before is finished
+		if (frameFence != VK_NULL_HANDLE && vkResetFences(mLogicDevice, 1, &frameFence) == VK_SUCCESS) {
+			if (vkQueueSubmit(queue, 0, nullptr, frameFence) != VK_SUCCESS) {
+				vkQueueWaitIdle(queue);
+				vkDestroyFence(mLogicDevice, frameFence, nullptr);
+				frameFence = VK_NULL_HANDLE;
+			}
+		}
+		else {
+			vkQueueWaitIdle(queue);
+		}
+		//
+		{
+			std::lock_guard<std::mutex> lock(mMtxFrame);
+			mNumSignaledFrames = frameIndex + 1;
+		}
+		mFrameCond.notify_all();
+	}
+
+	uint64_t VKCmdBufferManager::TrackSubmission(VkQueue queue) {
+		std::lock_guard<std::mutex> lock(mMtxSubmissions);
+		VkFence fence = VK_NULL_HANDLE;
+		if (!mFreeFences.empty()) {
+			fence = mFreeFences.back();
+			mFreeFences.pop_back();
+			vkResetFences(mLogicDevice, 1, &fence);
+		}
+		else {
+			VkFenceCreateInfo fenceCreateInfo = {};
+			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			fenceCreateInfo.pNext = nullptr;
+			fenceCreateInfo.flags = 0;
+			if (vkCreateFence(mLogicDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+				fence = VK_NULL_HANDLE;
+			}
+		}
+		//
+		auto serial = ++mSubmitSerial;
+		if (fence == VK_NULL_HANDLE || vkQueueSubmit(queue, 0, nullptr, fence) != VK_SUCCESS) {
+			//without a fence the submission is waited for right away
+			vkQueueWaitIdle(queue);
+			if (fence != VK_NULL_HANDLE) {
+				mFreeFences.push_back(fence);
+			}
+			if (mSubmissions.empty()) {
+				mCompletedSerial.store(serial, std::memory_order_release);
+			}
+			else {
+				mSubmissions.push_back({ VK_NULL_HANDLE, serial });
+			}
+			return serial;
+		}
+		mSubmissions.push_back({ fence, serial });
+		return serial;
+	}
+
+	bool VKCmdBufferManager::AllocateIndirectDraws(CmdBufferItm* pitem, uint32_t numDraws, IndirectRange& range) {
+		auto pool = pitem->ownerPool;
+		//a page without room for the draws is left for this frame, the draws of a replay are contiguous
+		while (pool->indirectPage < pool->indirectPages.size() && pool->indirectCursor + numDraws > pool->indirectPages[pool->indirectPage].capacity) {
+			++pool->indirectPage;
+			pool->indirectCursor = 0;
+		}
+		if (pool->indirectPage == pool->indirectPages.size()) {
+			IndirectPage page;
+			page.capacity = INDIRECT_PAGE_DRAWS;
+			while (page.capacity < numDraws) {
+				page.capacity *= 2;
+			}
+			VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+			bufferInfo.size = page.capacity * sizeof(VkDrawIndexedIndirectCommand);
+			bufferInfo.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+			if (VKMemoryManager::Instance()->CreateBuffer(bufferInfo, &page.buffer, VKMemory::MemoryUsage::VK_MEMORY_USAGE_CPU_TO_GPU, page.memory) != VK_SUCCESS) {
+				return false;
+			}
+			if (VKMemoryManager::Instance()->MapMemory(page.memory, (void**)&page.data) != VK_SUCCESS) {
+				VKMemoryManager::Instance()->DestoryBuffer(page.buffer, page.memory);
+				return false;
+			}
+			pool->indirectPages.push_back(page);
+		}
+		//
+		auto &page = pool->indirectPages[pool->indirectPage];
+		range.buffer = page.buffer;
+		range.memory = page.memory;
+		range.firstDraw = pool->indirectCursor;
+		range.data = page.data + pool->indirectCursor;
+		pool->indirectCursor += numDraws;
+		return true;
+	}
+
+	uint64_t VKCmdBufferManager::updateCompletedSerial() {
+		std::lock_guard<std::mutex> lock(mMtxSubmissions);
+		while (!mSubmissions.empty()) {
+			auto &submission = mSubmissions.front();
+			if (submission.fence != VK_NULL_HANDLE) {
+				if (vkGetFenceStatus(mLogicDevice, submission.fence) != VK_SUCCESS) {
+					break;
+				}
+				mFreeFences.push_back(submission.fence);
+			}
+			mCompletedSerial.store(submission.serial, std::memory_order_release);
+			mSubmissions.pop_front();
+		}
+		return mCompletedSerial.load(std::memory_order_acquire);
+	}
+
+	void VKCmdBufferManager::waiteCompletedSerial(uint64_t serial) {
+		if (updateCompletedSerial() >= serial) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mMtxSubmissions);
+		while (!mSubmissions.empty() && mSubmissions.front().serial <= serial) {
+			auto &submission = mSubmissions.front();
+			if (submission.fence != VK_NULL_HANDLE) {
+				vkWaitForFences(mLogicDevice, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+				mFreeFences.push_back(submission.fence);
+			}
+			mCompletedSerial.store(submission.serial, std::memory_order_release);
+			mSubmissions.pop_front();
+		}
+	}
+
+	void VKCmdBufferManager::resetThreadPool(ThreadPool* pool, uint64_t frameIndex) {
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (pool->cmdPools[i] != VK_NULL_HANDLE) {
+				vkResetCommandPool(mLogicDevice, pool->cmdPools[i], 0);
+			}
+		}
+		//every buffer given back since the last reset is in initial state again,
+		//the buffers still held by command buffers are given back at their next acquire
+		auto pitem = pool->returnedItems.exchange(nullptr, std::memory_order_acquire);
+		while (pitem != nullptr) {
+			auto next = pitem->next;
+			pitem->next = pool->freeItems[pitem->bindPointIndex][pitem->levelIndex];
+			pool->freeItems[pitem->bindPointIndex][pitem->levelIndex] = pitem;
+			pitem = next;
+		}
+		//the indirect draws were read by the same submissions as the buffers
+		pool->indirectPage = 0;
+		pool->indirectCursor = 0;
+		pool->frameIndex = frameIndex;
+		pool->resetCount.fetch_add(1, std::memory_order_release);
+	}
+
+	VKCmdBufferManager::ThreadPool* VKCmdBufferManager::getThreadPool() {
+		auto slot = tThreadSlot.index;
+		if (slot >= MAX_THREAD_POOLS) {
+			return nullptr;
+		}
+		//
+		auto frameIndex = mFrameIndex.load(std::memory_order_acquire);
+		auto &threadPool = mThreadPools[frameIndex % MAX_FRAMES_IN_FLIGHT][slot];
+		auto pool = threadPool.load(std::memory_order_acquire);
+		if (pool == nullptr) {
+			pool = new ThreadPool();
+			pool->cmdPools[0] = VK_NULL_HANDLE;
+			pool->cmdPools[1] = VK_NULL_HANDLE;
+			memset(pool->freeItems, 0, sizeof(pool->freeItems));
+			pool->returnedItems = nullptr;
+			pool->frameIndex = frameIndex;
+			pool->resetCount = 0;
+			pool->numUnsubmitted = 0;
+			pool->pendingSerial = 0;
+			pool->numHeld = 0;
+			pool->indirectPage = 0;
+			pool->indirectCursor = 0;
+			threadPool.store(pool, std::memory_order_release);
+		}
+		else if (pool->frameIndex != frameIndex) {
+			//EndFrame has waited for the frame that used the pools last on its queue,
+			//the buffers submitted to the other queues, the async compute ones, may still run
+			waiteCompletedSerial(pool->pendingSerial.load(std::memory_order_acquire));
+			resetThreadPool(pool, frameIndex);
+		}
+		return pool;
+	}
+
+	bool VKCmdBufferManager::allocateBlock(ThreadPool* pool, uint32_t bindPointIndex, uint32_t levelIndex) {
+		if (pool->cmdPools[bindPointIndex] == VK_NULL_HANDLE) {
+			VkCommandPoolCreateInfo cmdPoolCreateInfo = {};
+			cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			cmdPoolCreateInfo.pNext = nullptr;
+			cmdPoolCreateInfo.queueFamilyIndex = bindPointIndex == 0 ? mGraphicsQueueFamilyIndex : mComputeQueueFamilyIndex;
+			cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			if (vkCreateCommandPool(mLogicDevice, &cmdPoolCreateInfo, nullptr, &pool->cmdPools[bindPointIndex]) != VK_SUCCESS) {
+				pool->cmdPools[bindPointIndex] = VK_NULL_HANDLE;
+				return false;
+			}
+		}
+		//
+		VkCommandBuffer cmdBuffers[ALLOCATE_BLOCK_SIZE];
+		VkCommandBufferAllocateInfo cmdBufferAllocInfo = {};
+		cmdBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdBufferAllocInfo.commandPool = pool->cmdPools[bindPointIndex];
+		cmdBufferAllocInfo.level = levelIndex == 0 ? VK_COMMAND_BUFFER_LEVEL_PRIMARY : VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		cmdBufferAllocInfo.pNext = nullptr;
+		cmdBufferAllocInfo.commandBufferCount = ALLOCATE_BLOCK_SIZE;
+		if (vkAllocateCommandBuffers(mLogicDevice, &cmdBufferAllocInfo, cmdBuffers) != VK_SUCCESS) {
+			return false;
+		}
+		//
+		auto pblock = new CmdBufferItm[ALLOCATE_BLOCK_SIZE];
+		for (uint32_t i = 0; i < ALLOCATE_BLOCK_SIZE; ++i) {
+			pblock[i].cmdBuffer = cmdBuffers[i];
+			pblock[i].ownerPool = pool;
+			pblock[i].resetCount = 0;
+			pblock[i].submitSerial = 0;
+			pblock[i].held = false;
+			pblock[i].bindPointIndex = bindPointIndex;
+			pblock[i].levelIndex = levelIndex;
+			pblock[i].next = i + 1 < ALLOCATE_BLOCK_SIZE ? &pblock[i + 1] : pool->freeItems[bindPointIndex][levelIndex];
+		}
+		pool->freeItems[bindPointIndex][levelIndex] = pblock;
+		pool->blocks.push_back(pblock);
+		mNumAllocated.fetch_add(ALLOCATE_BLOCK_SIZE, std::memory_order_relaxed);
+		//
+		return true;
+	}
+
+	VKCmdBufferManager::CmdBufferItm* VKCmdBufferManager::acquireCmdBuffer(VkPipelineBindPoint bindPoint, VkCommandBufferLevel level) {
+		auto pool = getThreadPool();
+		if (pool == nullptr) {
+			return nullptr;
+		}
+		//
+		uint32_t bindPointIndex = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ? 0 : 1;
+		uint32_t levelIndex = level == VK_COMMAND_BUFFER_LEVEL_PRIMARY ? 0 : 1;
+		auto &freeItems = pool->freeItems[bindPointIndex][levelIndex];
+		//before growing the pools, reset them if every buffer they handed out has finished executing and none is held
+		if (freeItems == nullptr && pool->returnedItems.load(std::memory_order_relaxed) != nullptr &&
+			pool->numUnsubmitted.load(std::memory_order_acquire) == 0 && pool->numHeld.load(std::memory_order_acquire) == 0 &&
+			pool->pendingSerial.load(std::memory_order_acquire) <= updateCompletedSerial()) {
+			resetThreadPool(pool, pool->frameIndex);
+		}
+		if (freeItems == nullptr && !allocateBlock(pool, bindPointIndex, levelIndex)) {
+			return nullptr;
+		}
+		//
+		auto pitem = freeItems;
+		freeItems = pitem->next;
+		pitem->next = nullptr;
+		pitem->resetCount = pool->resetCount.load(std::memory_order_relaxed);
+		pitem->submitSerial = 0;
+		pitem->held = false;
+		pool->numUnsubmitted.fetch_add(1, std::memory_order_relaxed);
+		mNumLive.fetch_add(1, std::memory_order_relaxed);
+		return pitem;
+	}
+
+	VKCommandArena::~VKCommandArena() {
+		auto pchunk = mFirst;
+		while (pchunk != nullptr) {
+			auto tmp = pchunk;
+			pchunk = pchunk->next;
+			::operator delete(tmp);
+		}
+	}
+
+	void VKCommandArena::nextChunk(size_t minSize) {
+		if (mCurrent != nullptr && mCurrent->next != nullptr && mCurrent->next->capacity >= minSize) {
+			mCurrent = mCurrent->next;
+			mCurrent->used = 0;
+			return;
+		}
+		//
+		size_t capacity = minSize > CHUNK_SIZE ? minSize : CHUNK_SIZE;
+		auto pchunk = (Chunk*)::operator new(sizeof(Chunk) + capacity);
+		pchunk->capacity = capacity;
+		pchunk->used = 0;
+		if (mCurrent == nullptr) {
+			pchunk->next = mFirst;
+			mFirst = pchunk;
+		}
+		else {
+			pchunk->next = mCurrent->next;
+			mCurrent->next = pchunk;
+		}
+		mCurrent = pchunk;
+	}
+
+	void VKCommandArena::Adopt(VKCommandArena& other) {
+		if (other.mCurrent == nullptr) {
+			return;
+		}
+		//
+		auto adoptFirst = other.mFirst;
+		auto adoptLast = other.mCurrent;
+		other.mFirst = adoptLast->next;
+		//
+		auto spare = mCurrent != nullptr ? mCurrent->next : mFirst;
+		for (auto pchunk = adoptFirst; pchunk != adoptLast->next && spare != nullptr; pchunk = pchunk->next) {
+			auto tmp = spare;
+			spare = spare->next;
+			tmp->next = other.mFirst;
+			other.mFirst = tmp;
+		}
+		//
+		adoptLast->next = spare;
+		if (mCurrent != nullptr) {
+			mCurrent->next = adoptFirst;
+		}
+		else {
+			mFirst = adoptFirst;
+		}
+		mCurrent = adoptLast;
+		//
+		other.Reset();
+	}
+
+	VKCommandBuffer::~VKCommandBuffer() {
+		if (mBindingItem != nullptr) {
+			mCmdBufferManager->FreeCmdBuffer(mBindingItem);
+		}
+	}
+
+	bool VKCommandBuffer::reserveIndirectDraws(VKCommandBuffer* targetCmdBuffer, uint32_t numDraws) {
+		mIndirectCapacity = 0;
+		auto pitem = targetCmdBuffer->GetBindingItem();
+		if (pitem == nullptr || !mCmdBufferManager->AllocateIndirectDraws(pitem, numDraws, mIndirectRange)) {
+			return false;
+		}
+		//
+		mIndirectCapacity = numDraws;
+		return true;
+	}
+
+	const uint8_t* VKCommandBuffer::excuteDrawIndexedRun(const uint8_t* pdata, const uint8_t* pend, VKCommandBuffer* targetCmdBuffer, uint32_t& indirectCursor) {
+		static const uint32_t MAX_RUN_LENGTH = 65535;
+		//
+		auto canMerge = [&](const VKCommand* pcmd) {
+			return pcmd->type == VKCmdType::CMD_DRAW_INDEXED &&
+				(mIndirectFirstInstance || static_cast<const VKCmdDrawIndexed*>(pcmd)->mFirstInstance == 0);
+		};
+		//
+		uint32_t runLength = 0;
+		auto prun = pdata;
+		while (prun < pend && runLength < MAX_RUN_LENGTH && canMerge((const VKCommand*)prun)) {
+			prun += ((const VKCommand*)prun)->size;
+			++runLength;
+		}
+		if (runLength < 2 || indirectCursor + runLength > mIndirectCapacity) {
+			return nullptr;
+		}
+		//
+		auto pindirect = mIndirectRange.data + indirectCursor;
+		for (auto p = pdata; p < prun; p += ((const VKCommand*)p)->size) {
+			auto pdraw = (const VKCmdDrawIndexed*)p;
+			pindirect->indexCount = pdraw->mIndexCount;
+			pindirect->instanceCount = pdraw->mInstanceCount;
+			pindirect->firstIndex = pdraw->mFirstIndex;
+			pindirect->vertexOffset = (int32_t)pdraw->mVertexOffset;
+			pindirect->firstInstance = pdraw->mFirstInstance;
+			++pindirect;
 		}
 		//
+		vkCmdDrawIndexedIndirect(targetCmdBuffer->GetBindingCmdBuffer(), mIndirectRange.buffer,
+			(mIndirectRange.firstDraw + indirectCursor) * sizeof(VkDrawIndexedIndirectCommand), runLength, sizeof(VkDrawIndexedIndirectCommand));
+		indirectCursor += runLength;
+		mStatistics.numMergedDraws += runLength;
+		++mStatistics.numIndirectDraws;
+		//
+		return prun;
+	}
+
+	void VKCmdBeginCmdBuffer::excute(VKCommandBuffer* cmdBuffer) const {
+		VkCommandBufferBeginInfo cmd_buffer_begin_info = {};
+		cmd_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		cmd_buffer_begin_info.pNext = nullptr;
+		vkBeginCommandBuffer(cmdBuffer->GetBindingCmdBuffer(), &cmd_buffer_begin_info);
+	}
+
+	void VKCmdEndCmdBuffer::excute(VKCommandBuffer* cmdBuffer) const {
+		vkEndCommandBuffer(cmdBuffer->GetBindingCmdBuffer());
+	}
+
+	void VKCmdBeginRenderPass::excute(VKCommandBuffer* cmdBuffer) const {
+		auto vkFrameBuffer = VKFrameBuffer::Cast(mFrameBuffer);
+		//
 		VkRenderPassBeginInfo renderPassBeginInfo = {};
 		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassBeginInfo.pNext = NULL;
 		renderPassBeginInfo.renderPass = VKRenderPass::Cast(mRenderPass)->GetRenderPass();
 		renderPassBeginInfo.renderArea.offset.x = 0;
 		renderPassBeginInfo.renderArea.offset.y = 0;
-		renderPassBeginInfo.renderArea.extent.width = VKFrameBuffer::Cast(mFrameBuffer)->GetWidth();
-		renderPassBeginInfo.renderArea.extent.height = VKFrameBuffer::Cast(mFrameBuffer)->GetHeight();
-		renderPassBeginInfo.clearValueCount = clearValues.size();
-		renderPassBeginInfo.pClearValues = clearValues.data();
-		renderPassBeginInfo.framebuffer = VKFrameBuffer::Cast(mFrameBuffer)->GetFrameBuffer();
+		renderPassBeginInfo.renderArea.extent.width = vkFrameBuffer->GetWidth();
+		renderPassBeginInfo.renderArea.extent.height = vkFrameBuffer->GetHeight();
+		renderPassBeginInfo.clearValueCount = vkFrameBuffer->GetNumAttachment();
+		renderPassBeginInfo.pClearValues = vkFrameBuffer->GetVKClearValues();
+		renderPassBeginInfo.framebuffer = vkFrameBuffer->GetFrameBuffer();
 		//
-		vkCmdBeginRenderPass(tmp->GetBindingCmdBuffer(), &renderPassBeginInfo, tmp->GetNumSecondCmdBuffer() > 0 ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBeginRenderPass(cmdBuffer->GetBindingCmdBuffer(), &renderPassBeginInfo, cmdBuffer->GetNumSecondCmdBuffer() > 0 ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
 	}
 
+	void VKCmdEndRenderPass::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdEndRenderPass(cmdBuffer->GetBindingCmdBuffer());
+	}
 
-	void VKCmdBindPipeline::excute(CommandBuffer* cmdBuffer) {
+	void VKCmdBindPipeline::excute(VKCommandBuffer* cmdBuffer) const {
 		if (mGraphicsPipeline == nullptr && mComputePipeline == nullptr) {
 			return;
 		}
 		//
-		auto tmp = VKCommandBuffer::Cast(cmdBuffer);
-		//
 		VkPipelineBindPoint pipelineBindPoint = mGraphicsPipeline != nullptr ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE;
 		VkPipeline pipeline = mGraphicsPipeline != nullptr ? VKGraphicsPipeline::Cast(mGraphicsPipeline)->GetVKPipleline() : VKComputePipeline::Cast(mComputePipeline)->GetVKPiipeline();
 		VkPipelineLayout pipelineLayout = mGraphicsPipeline != nullptr ? VKGraphicsPipeline::Cast(mGraphicsPipeline)->GetPipelineLayout() : VKComputePipeline::Cast(mComputePipeline)->GetPipelineLayout();
 		//
-		vkCmdBindPipeline(tmp->GetBindingCmdBuffer(), pipelineBindPoint, pipeline);
+		vkCmdBindPipeline(cmdBuffer->GetBindingCmdBuffer(), pipelineBindPoint, pipeline);
+		if (!mBindDescriptorSets) {
+			return;
+		}
 		//
 		auto gpuProgram = mGraphicsPipeline != nullptr ? VKGraphicsPipeline::Cast(mGraphicsPipeline)->GetGPUProgram() : VKComputePipeline::Cast(mComputePipeline)->GetGPUProgram();
 		auto &descriptorSets = VKGPUProgram::Cast(gpuProgram)->GetDescriptorSets();
 		//
-		vkCmdBindDescriptorSets(tmp->GetBindingCmdBuffer(), pipelineBindPoint, pipelineLayout, 0, descriptorSets.size(), descriptorSets.data(), 0, nullptr);
+		vkCmdBindDescriptorSets(cmdBuffer->GetBindingCmdBuffer(), pipelineBindPoint, pipelineLayout, 0, descriptorSets.size(), descriptorSets.data(), 0, nullptr);
 	}
 
-	void VKCmdSetViewport::excute(CommandBuffer* cmdBuffer) {
-		auto viewportCount = mViewports.size();
-		std::vector<VkViewport> viewports(viewportCount);
-		for (int i = 0; i < viewportCount; ++i) {
-			viewports[i].x = mViewports[i].x;
-			viewports[i].y = mViewports[i].y;
-			viewports[i].width = mViewports[i].width;
-			viewports[i].height = mViewports[i].height;
-			viewports[i].minDepth = mViewports[i].minDepth;
-			viewports[i].maxDepth = mViewports[i].maxDepth;
-		}
-
-		vkCmdSetViewport(VKCommandBuffer::Cast(cmdBuffer)->GetBindingCmdBuffer(), mFirstViewport, viewportCount, viewports.data());
+	void VKCmdSetViewport::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdSetViewport(cmdBuffer->GetBindingCmdBuffer(), mFirstViewport, mViewportCount, GetViewports());
 	}
 
-	void VKCmdSetScissor::excute(CommandBuffer* cmdBuffer) {
-		auto scissorCount = mScissors.size();
-		std::vector<VkRect2D> scissors(scissorCount);
-		for (int i = 0; i < scissorCount; ++i) {
-			scissors[i].extent.width = mScissors[i].extent.width;
-			scissors[i].extent.height = mScissors[i].extent.height;
-			scissors[i].offset.x = mScissors[i].offset.x;
-			scissors[i].offset.y = mScissors[i].offset.y;
-		}
-		//
-		vkCmdSetScissor(VKCommandBuffer::Cast(cmdBuffer)->GetBindingCmdBuffer(), mFirstScissor, scissorCount, scissors.data());
+	void VKCmdSetScissor::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdSetScissor(cmdBuffer->GetBindingCmdBuffer(), mFirstScissor, mScissorCount, GetScissors());
 	}
 
-	void VKCmdSetLineWidth::excute(CommandBuffer* cmdBuffer) {
-		vkCmdSetLineWidth(VKCommandBuffer::Cast(cmdBuffer)->GetBindingCmdBuffer(), mLineWidth);
+	void VKCmdSetLineWidth::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdSetLineWidth(cmdBuffer->GetBindingCmdBuffer(), mLineWidth);
 	}
 
-	void VKCmdBindIndexBuffer::excute(CommandBuffer* cmdBuffer) {
-		vkCmdBindIndexBuffer(VKCommandBuffer::Cast(cmdBuffer)->GetBindingCmdBuffer(),
+	void VKCmdBindIndexBuffer::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdBindIndexBuffer(cmdBuffer->GetBindingCmdBuffer(),
 			VKBuffer::Cast(mBuffer)->GetVKBuffer(),
 			mOffset,
 			GetFormatSize(mFormat) == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
 	}
 
-	void VKCmdBindVertexBuffer::excute(CommandBuffer* cmdBuffer) {
+	void VKCmdBindVertexBuffer::excute(VKCommandBuffer* cmdBuffer) const {
 		VkBuffer buffers[1] = { VKBuffer::Cast(mBuffer)->GetVKBuffer() };
 		VkDeviceSize offsets[1] = { mOffset };
 		//
-		vkCmdBindVertexBuffers( VKCommandBuffer::Cast(cmdBuffer)->GetBindingCmdBuffer(),
+		vkCmdBindVertexBuffers(cmdBuffer->GetBindingCmdBuffer(),
 			mBindingIndex, 1, buffers, offsets );
 	}
 
-	void VKCmdDraw::excute(CommandBuffer* cmdBuffer) {
-		vkCmdDraw(VKCommandBuffer::Cast(cmdBuffer)->GetBindingCmdBuffer(),
+	VKCmdBindVertexBuffers::VKCmdBindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, Buffer** ppBuffers, const uint32_t* pOffsets) {
+		mFirstBinding = firstBinding;
+		mBindingCount = bindingCount;
+		auto buffers = GetBuffers();
+		auto offsets = GetOffsets();
+		auto sourceBuffers = GetSourceBuffers();
+		for (uint32_t i = 0; i < bindingCount; ++i) {
+			buffers[i] = VKBuffer::Cast(ppBuffers[i])->GetVKBuffer();
+			offsets[i] = pOffsets[i];
+			sourceBuffers[i] = ppBuffers[i];
+		}
+	}
+
+	void VKCmdBindVertexBuffers::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdBindVertexBuffers(cmdBuffer->GetBindingCmdBuffer(), mFirstBinding, mBindingCount, GetBuffers(), GetOffsets());
+	}
+
+	void VKCmdDraw::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdDraw(cmdBuffer->GetBindingCmdBuffer(),
 			mVirtexCount, mInstanceCount, mFirstVertex, mFirstInstance);
 	}
 
-	void VKCmdDrawIndexed::excute(CommandBuffer* cmdBuffer) {
-		vkCmdDrawIndexed(VKCommandBuffer::Cast(cmdBuffer)->GetBindingCmdBuffer(),
+	void VKCmdDrawIndexed::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdDrawIndexed(cmdBuffer->GetBindingCmdBuffer(),
 			mIndexCount, mInstanceCount, mFirstIndex, mVertexOffset, mFirstInstance);
 	}
+
+	void VKCmdFillBuffer::excute(VKCommandBuffer* cmdBuffer) const {
+		vkCmdFillBuffer(cmdBuffer->GetBindingCmdBuffer(), VKBuffer::Cast(mBuffer)->GetVKBuffer(), mOffset, mSize, mData);
+	}
+
+	void VKCommandBuffer::excuteCommands(VKCommandBuffer* targetCmdBuffer) {
+		bool wasReplaying = tReplaying;
+		tReplaying = true;
+		uint32_t indirectCursor = 0;
+		bool mergeDraws = mMergeDrawIndexed && mNumDrawIndexed > 1 && reserveIndirectDraws(targetCmdBuffer, mNumDrawIndexed);
+		//
+		mArena.ForEachChunk([&](const uint8_t* pdata, size_t used) {
+			auto pend = pdata + used;
+			while (pdata < pend) {
+				auto pcmd = (const VKCommand*)pdata;
+				if (mergeDraws && pcmd->type == VKCmdType::CMD_DRAW_INDEXED) {
+					auto pnext = excuteDrawIndexedRun(pdata, pend, targetCmdBuffer, indirectCursor);
+					if (pnext != nullptr) {
+						pdata = pnext;
+						continue;
+					}
+				}
+				//
+				switch (pcmd->type) {
+				case VKCmdType::CMD_BEGIN_CMD_BUFFER:
+					static_cast<const VKCmdBeginCmdBuffer*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_END_CMD_BUFFER:
+					static_cast<const VKCmdEndCmdBuffer*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_BEGIN_RENDER_PASS:
+					static_cast<const VKCmdBeginRenderPass*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_END_RENDER_PASS:
+					static_cast<const VKCmdEndRenderPass*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_BIND_PIPELINE:
+					static_cast<const VKCmdBindPipeline*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_SET_VIEWPORT:
+					static_cast<const VKCmdSetViewport*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_SET_SCISSOR:
+					static_cast<const VKCmdSetScissor*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_SET_LINE_WIDTH:
+					static_cast<const VKCmdSetLineWidth*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_BIND_INDEX_BUFFER:
+					static_cast<const VKCmdBindIndexBuffer*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_BIND_VERTEX_BUFFER:
+					static_cast<const VKCmdBindVertexBuffer*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_BIND_VERTEX_BUFFERS:
+					static_cast<const VKCmdBindVertexBuffers*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_DRAW:
+					static_cast<const VKCmdDraw*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_DRAW_INDEXED:
+					static_cast<const VKCmdDrawIndexed*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				case VKCmdType::CMD_FILL_BUFFER:
+					static_cast<const VKCmdFillBuffer*>(pcmd)->excute(targetCmdBuffer);
+					break;
+				default:
+					break;
+				}
+				//
+				pdata += pcmd->size;
+			}
+		});
+		//
+		if (indirectCursor > 0) {
+			VKMemoryManager::Instance()->FlushAllocation(mIndirectRange.memory, mIndirectRange.firstDraw * sizeof(VkDrawIndexedIndirectCommand),
+				indirectCursor * sizeof(VkDrawIndexedIndirectCommand));
+		}
+		tReplaying = wasReplaying;
+	}
+
+	bool VKCommandBuffer::IsReplaying() {
+		return tReplaying;
+	}
 }
\ No newline at end of file
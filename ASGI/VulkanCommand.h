@@ -2,396 +2,924 @@
 
 #include <unordered_map>
 #include <queue>
+#include <vector>
+#include <deque>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <new>
+#include <cassert>
+#include <cstring>
+#include <type_traits>
+#include <algorithm>
 #include "VulkanSDK\1.1.77.0\Include\vulkan\vulkan.h"
 #include "ASGI.hpp"
+#include "VulkanUpload.h"
 
 namespace ASGI {
+	class VKMemory;
+	//command pools are owned by the recording threads, a thread allocates from its own pools without locking.
+	//every thread has one pool set per frame in flight, a buffer acquired during frame N comes from the pools of frame N.
+	//the pools are created without VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, a buffer is never reset on its own,
+	//the whole pool set is reset with vkResetCommandPool when its frame comes around again and the frame fence has signaled.
+	//a freed buffer goes back to the pool set that allocated it through a lock free list, so any thread can free it,
+	//and it is handed out again after that reset. every submission is tracked with a fence, a pool set that runs out of
+	//buffers is reset early once nothing it handed out is waiting for submission or still executing, so a session that never
+	//ends a frame does not keep growing the pools. a pool set bound to a live immediate command buffer is not reset early,
+	//what was recorded into it must stay until the frame comes around. at most MAX_THREAD_POOLS threads can record at the same time.
+	//the indirect draws written at replay live in mapped buffers of the pool set the same way, they are sub-allocated linearly
+	//and rewound with the pools, a full page is kept and a bigger one is added, so no page is destroyed while a submission reads it
 	class VKCmdBufferManager {
+	public:
+		static const uint32_t MAX_THREAD_POOLS = 64;
+		static const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+		static const uint32_t ALLOCATE_BLOCK_SIZE = 8;
+		static const uint32_t INDIRECT_PAGE_DRAWS = 4096;
+		static const uint64_t QUEUED_SERIAL = UINT64_MAX;
+		//
+		struct IndirectPage {
+			VkBuffer buffer;
+			VKMemory* memory;
+			VkDrawIndexedIndirectCommand* data;
+			uint32_t capacity;
+		};
+		//draws firstDraw.. of buffer, data points at the first of them
+		struct IndirectRange {
+			VkBuffer buffer;
+			VKMemory* memory;
+			uint32_t firstDraw;
+			VkDrawIndexedIndirectCommand* data;
+		};
+		struct ThreadPool;
 		struct CmdBufferItm {
-			VkCommandPool cmdPool;
 			VkCommandBuffer cmdBuffer;
-			VkPipelineBindPoint bindPoint;
-			VkCommandBufferLevel level;
+			ThreadPool* ownerPool;
+			uint64_t resetCount;
+			//serial of the last submission that used the buffer, 0 until it is pinned for a submission,
+			//QUEUED_SERIAL while the submission is on its way to the queue
+			std::atomic<uint64_t> submitSerial;
+			//bound to an immediate command buffer, see HoldCmdBuffer
+			bool held;
+			uint8_t bindPointIndex;
+			uint8_t levelIndex;
+			CmdBufferItm* next;
+		};
+		//one pool per queue family, the free lists only hold buffers in initial state and are only touched by the owning thread.
+		//returnedItems is pushed by any thread and drained by the owning thread when the pools are reset
+		struct ThreadPool {
+			VkCommandPool cmdPools[2];
+			CmdBufferItm* freeItems[2][2];
+			std::atomic<CmdBufferItm*> returnedItems;
+			std::vector<CmdBufferItm*> blocks;
+			uint64_t frameIndex;
+			std::atomic<uint64_t> resetCount;
+			//buffers acquired and not submitted yet, and the last submission that used a buffer of the pools
+			std::atomic<int32_t> numUnsubmitted;
+			std::atomic<uint64_t> pendingSerial;
+			//held buffers not freed yet, they keep the pools from being reset early
+			std::atomic<int32_t> numHeld;
+			//pages of indirect draws, the page taken from and the draws taken from it since the last reset
+			std::vector<IndirectPage> indirectPages;
+			uint32_t indirectPage;
+			uint32_t indirectCursor;
+		};
+		//live buffers are held by command buffers, free ones wait in the pools for reuse
+		struct Statistics {
+			uint32_t numAllocated;
+			uint32_t numLive;
+			uint32_t numFree;
 		};
 	public:
-		VKCmdBufferManager(VkDevice logicDevice, uint32_t graphicsQueueFamilyIndex, uint32_t computeQueueFamilyIndex) {
-			mLogicDevice = logicDevice;
-			mGraphicsQueueFamilyIndex = graphicsQueueFamilyIndex;
-			mComputeQueueFamilyIndex = computeQueueFamilyIndex;
-			//
-			mUploadCmdBuffer = AcquirePrimaryCmdBuffer(VK_PIPELINE_BIND_POINT_GRAPHICS);
-		}
+		VKCmdBufferManager(VkDevice logicDevice, uint32_t graphicsQueueFamilyIndex, uint32_t computeQueueFamilyIndex);
+		~VKCmdBufferManager();
 
+		//the upload command buffer has its own pool, it is recorded by whichever thread uploads.
+		//the one submitted last may still be pending, NextUpLoadCmdBuffer switches to another one for the next upload
 		inline VkCommandBuffer GetUpLoadCmdBuffer() {
 			return mUploadCmdBuffer;
 		}
 
-		VkCommandBuffer AcquirePrimaryCmdBuffer(VkPipelineBindPoint bindPoint) {
-			std::lock_guard<std::mutex> lock(mMutex);
-			//
-			if (bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS && !mFreeGPrimaryCmdBuffers.empty()) {
-				auto pbuffer =  mFreeGPrimaryCmdBuffers.front().cmdBuffer;
-				mUsedPrimaryCmdBuffers[(long long)pbuffer] = mFreeGPrimaryCmdBuffers.front();
-				mFreeGPrimaryCmdBuffers.pop();
-				return pbuffer;
-			}
-			else if (bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE && !mFreeCPrimaryCmdBuffers.empty()) {
-				auto pbuffer = mFreeCPrimaryCmdBuffers.front().cmdBuffer;
-				mUsedPrimaryCmdBuffers[(long long)pbuffer] = mFreeCPrimaryCmdBuffers.front();
-				mFreeCPrimaryCmdBuffers.pop();
-				return pbuffer;
-			}
-			//
-			CmdBufferItm tmp;
-			tmp.bindPoint = bindPoint;
-			tmp.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-			//
-			VkCommandPoolCreateInfo cmdPoolCreateInfo = {};
-			cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-			cmdPoolCreateInfo.pNext = nullptr;
-			cmdPoolCreateInfo.queueFamilyIndex = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ? mGraphicsQueueFamilyIndex : mComputeQueueFamilyIndex;
-			cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-			if (vkCreateCommandPool(mLogicDevice, &cmdPoolCreateInfo, nullptr, &tmp.cmdPool) != VK_SUCCESS) {
-				return nullptr;
-			}
-			//
-			VkCommandBufferAllocateInfo cmdBufferAllocInfo = {};
-			cmdBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-			cmdBufferAllocInfo.commandPool = tmp.cmdPool;
-			cmdBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-			cmdBufferAllocInfo.pNext = nullptr;
-			cmdBufferAllocInfo.commandBufferCount = 1;
-			if (vkAllocateCommandBuffers(mLogicDevice, &cmdBufferAllocInfo, &tmp.cmdBuffer) != VK_SUCCESS) {
-				vkDestroyCommandPool(mLogicDevice, tmp.cmdPool, nullptr);
-				return nullptr;
-			}
-			//
-			mUsedPrimaryCmdBuffers[(long long)tmp.cmdBuffer] = tmp;
-			//
-			return tmp.cmdBuffer;
+		//the current upload command buffer is left to its submission, one given back with FreeUpLoadCmdBuffer or a new one
+		//takes its place. false if none could be allocated, the current one is kept
+		bool NextUpLoadCmdBuffer();
+		//the submission of an upload command buffer has finished, it is reset when it is begun again. any thread
+		void FreeUpLoadCmdBuffer(VkCommandBuffer cmdBuffer);
+
+		inline uint64_t GetFrameIndex() {
+			return mFrameIndex.load(std::memory_order_acquire);
 		}
 
-		VkCommandBuffer AcquireSecondCmdBuffer(VkPipelineBindPoint bindPoint) {
-			std::lock_guard<std::mutex> lock(mMutex);
-			//
-			if (bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS && !mFreeGSecondCmdBuffers.empty()) {
-				auto pbuffer = mFreeGSecondCmdBuffers.front().cmdBuffer;
-				mUsedSecondCmdBuffers[(long long)pbuffer] = mFreeGSecondCmdBuffers.front();
-				mFreeGSecondCmdBuffers.pop();
-				return pbuffer;
-			}
-			else if (bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE && !mFreeCSecondCmdBuffers.empty()) {
-				auto pbuffer = mFreeCSecondCmdBuffers.front().cmdBuffer;
-				mUsedSecondCmdBuffers[(long long)pbuffer] = mFreeCSecondCmdBuffers.front();
-				mFreeCSecondCmdBuffers.pop();
-				return pbuffer;
-			}
-			//
-			CmdBufferItm tmp;
-			tmp.bindPoint = bindPoint;
-			tmp.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-			//
-			VkCommandPoolCreateInfo cmdPoolCreateInfo = {};
-			cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-			cmdPoolCreateInfo.pNext = nullptr;
-			cmdPoolCreateInfo.queueFamilyIndex = bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS ? mGraphicsQueueFamilyIndex : mComputeQueueFamilyIndex;
-			cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-			if (vkCreateCommandPool(mLogicDevice, &cmdPoolCreateInfo, nullptr, &tmp.cmdPool) != VK_SUCCESS) {
-				return nullptr;
+		//the buffer is in initial state
+		inline CmdBufferItm* AcquirePrimaryCmdBuffer(VkPipelineBindPoint bindPoint) {
+			return acquireCmdBuffer(bindPoint, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+		}
+
+		inline CmdBufferItm* AcquireSecondCmdBuffer(VkPipelineBindPoint bindPoint) {
+			return acquireCmdBuffer(bindPoint, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		}
+
+		//the buffer may still be pending, it is not handed out again before its pool set is reset
+		inline void FreeCmdBuffer(CmdBufferItm* pitem) {
+			auto pool = pitem->ownerPool;
+			if (pitem->submitSerial.load(std::memory_order_acquire) == 0) {
+				pool->numUnsubmitted.fetch_sub(1, std::memory_order_release);
 			}
-			//
-			VkCommandBufferAllocateInfo cmdBufferAllocInfo = {};
-			cmdBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-			cmdBufferAllocInfo.commandPool = tmp.cmdPool;
-			cmdBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-			cmdBufferAllocInfo.pNext = nullptr;
-			cmdBufferAllocInfo.commandBufferCount = 1;
-			if (vkAllocateCommandBuffers(mLogicDevice, &cmdBufferAllocInfo, &tmp.cmdBuffer) != VK_SUCCESS) {
-				vkDestroyCommandPool(mLogicDevice, tmp.cmdPool, nullptr);
-				return nullptr;
+			if (pitem->held) {
+				pitem->held = false;
+				pool->numHeld.fetch_sub(1, std::memory_order_release);
 			}
-			//
-			mUsedPrimaryCmdBuffers[(long long)tmp.cmdBuffer] = tmp;
-			//
-			return tmp.cmdBuffer;
-		}
-
-		void FreeCmdBuffer(VkCommandBuffer cmdBuffer) {
-			{
-				auto itr = mUsedPrimaryCmdBuffers.find((long long)cmdBuffer);
-				if (itr != mUsedPrimaryCmdBuffers.end()) {
-					if (itr->second.bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS) {
-							mFreeGPrimaryCmdBuffers.push(itr->second);
-							mUsedPrimaryCmdBuffers.erase(itr);
-							return;
-					}
-					else if (itr->second.bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
-						mFreeCPrimaryCmdBuffers.push(itr->second);
-						mUsedPrimaryCmdBuffers.erase(itr);
-						return;
-					}
-				}
+			mNumLive.fetch_sub(1, std::memory_order_relaxed);
+			auto head = pool->returnedItems.load(std::memory_order_relaxed);
+			do {
+				pitem->next = head;
+			} while (!pool->returnedItems.compare_exchange_weak(head, pitem, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		//the buffer is recorded once and may be submitted any number of times until it is freed, like the binding buffer of an
+		//immediate command buffer. its pools are only reset when their frame comes around again, not early
+		inline void HoldCmdBuffer(CmdBufferItm* pitem) {
+			pitem->held = true;
+			pitem->ownerPool->numHeld.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		//false once the pools of the buffer have been reset, what was recorded into it is gone
+		inline bool IsValid(CmdBufferItm* pitem) {
+			return pitem->resetCount == pitem->ownerPool->resetCount.load(std::memory_order_acquire);
+		}
+
+		//true if the buffer was acquired by the calling thread during the current frame, so what was encoded into it is still there
+		inline bool IsCurrent(CmdBufferItm* pitem) {
+			return pitem->ownerPool == getThreadPool() && IsValid(pitem);
+		}
+
+		//signal a fence after the work submitted to queue so far, the returned serial is passed to MarkSubmitted
+		uint64_t TrackSubmission(VkQueue queue);
+
+		//numDraws indirect draws for the stream encoded into pitem, taken from the pools of pitem. they stay valid until those pools
+		//are reset, which waits for the submissions of pitem. call on the thread that acquired pitem
+		bool AllocateIndirectDraws(CmdBufferItm* pitem, uint32_t numDraws, IndirectRange& range);
+
+		//the buffer is encoded for a submission that is not handed to the queue yet, it keeps the pools from being reset
+		//even if it is freed meanwhile. every pin is followed by one MarkSubmitted, or by one MarkSubmitted with serial 0 if the submission failed.
+		//call it for the secondary buffers of a submitted primary buffer too
+		inline void PinCmdBuffer(CmdBufferItm* pitem) {
+			if (pitem->submitSerial.load(std::memory_order_relaxed) != 0) {
+				pitem->ownerPool->numUnsubmitted.fetch_add(1, std::memory_order_relaxed);
 			}
-			//
-			{
-				auto itr = mUsedSecondCmdBuffers.find((long long)cmdBuffer);
-				if (itr != mUsedSecondCmdBuffers.end()) {
-					if (itr->second.bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS) {
-						mFreeGSecondCmdBuffers.push(itr->second);
-						mUsedPrimaryCmdBuffers.erase(itr);
-						return;
-					}
-					else if (itr->second.bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
-						mFreeCSecondCmdBuffers.push(itr->second);
-						mUsedPrimaryCmdBuffers.erase(itr);
-						return;
-					}
+			pitem->submitSerial.store(QUEUED_SERIAL, std::memory_order_release);
+		}
+
+		//the pinned buffer is used by the submission of serial, the pools see the serial before the pin is dropped
+		inline void MarkSubmitted(CmdBufferItm* pitem, uint64_t serial) {
+			auto pool = pitem->ownerPool;
+			if (serial != 0) {
+				auto pendingSerial = pool->pendingSerial.load(std::memory_order_relaxed);
+				while (pendingSerial < serial && !pool->pendingSerial.compare_exchange_weak(pendingSerial, serial, std::memory_order_release, std::memory_order_relaxed)) {
 				}
+				pitem->submitSerial.store(serial, std::memory_order_release);
 			}
+			pool->numUnsubmitted.fetch_sub(1, std::memory_order_release);
+		}
+
+		inline Statistics GetStatistics() {
+			Statistics statistics;
+			statistics.numAllocated = mNumAllocated.load(std::memory_order_relaxed);
+			statistics.numLive = mNumLive.load(std::memory_order_relaxed);
+			statistics.numFree = statistics.numAllocated - statistics.numLive;
+			return statistics;
 		}
+
+		//end of the recording of the current frame, every buffer of the frame must be submitted to queue or to a queue that queue waits on.
+		//the pool sets of the next frame are reset once the fence of the frame that last used them has signaled
+		inline void EndFrame(VkQueue queue) {
+			SignalFrame(queue, mFrameIndex.load(std::memory_order_relaxed));
+			AdvanceFrame();
+		}
+
+		//the two halves of EndFrame for a queue owned by another thread. AdvanceFrame closes the recording of the current frame
+		//and returns its index, SignalFrame is then called with it on the thread that owns queue after the submits of the frame.
+		//AdvanceFrame waits until the frame before was signaled, so the recording runs at most one frame ahead of the queue
+		uint64_t AdvanceFrame();
+		void SignalFrame(VkQueue queue, uint64_t frameIndex);
+	private:
+		CmdBufferItm* acquireCmdBuffer(VkPipelineBindPoint bindPoint, VkCommandBufferLevel level);
+		bool allocateBlock(ThreadPool* pool, uint32_t bindPointIndex, uint32_t levelIndex);
+		void resetThreadPool(ThreadPool* pool, uint64_t frameIndex);
+		//poll the submission fences in order, return the serial of the last finished submission
+		uint64_t updateCompletedSerial();
+		//block until the submissions up to serial are finished
+		void waiteCompletedSerial(uint64_t serial);
+		ThreadPool* getThreadPool();
 	private:
 		VkDevice mLogicDevice;
 		uint32_t mGraphicsQueueFamilyIndex;
 		uint32_t mComputeQueueFamilyIndex;
 		//
+		VkCommandPool mUploadCmdPool;
 		VkCommandBuffer mUploadCmdBuffer;
-		std::queue<CmdBufferItm> mFreeGPrimaryCmdBuffers;
-		std::queue<CmdBufferItm> mFreeGSecondCmdBuffers;
-		std::queue<CmdBufferItm> mFreeCPrimaryCmdBuffers;
-		std::queue<CmdBufferItm> mFreeCSecondCmdBuffers;
-		std::unordered_map<long long, CmdBufferItm> mUsedPrimaryCmdBuffers;
-		std::unordered_map<long long, CmdBufferItm> mUsedSecondCmdBuffers;
-		std::mutex mMutex;
-		//std::unordered_map<long long, 
+		std::mutex mMtxUpload;
+		std::vector<VkCommandBuffer> mFreeUploadCmdBuffers;
+		//signaled when the work of the frame that last used the slot is finished
+		std::atomic<uint64_t> mFrameIndex;
+		VkFence mFrameFences[MAX_FRAMES_IN_FLIGHT];
+		std::mutex mMtxFrame;
+		std::condition_variable mFrameCond;
+		uint64_t mNumSignaledFrames;
+		//fences of the submissions in flight in submission order, and the fences ready for reuse
+		struct Submission {
+			VkFence fence;
+			uint64_t serial;
+		};
+		std::mutex mMtxSubmissions;
+		std::deque<Submission> mSubmissions;
+		std::vector<VkFence> mFreeFences;
+		uint64_t mSubmitSerial;
+		std::atomic<uint64_t> mCompletedSerial;
+		std::atomic<uint32_t> mNumAllocated;
+		std::atomic<uint32_t> mNumLive;
+		//indexed by the frame slot and the thread slot, a thread only writes its own slots
+		std::atomic<ThreadPool*> mThreadPools[MAX_FRAMES_IN_FLIGHT][MAX_THREAD_POOLS];
 	};
 
-	class VKCommandBuffer;
-	class VKCommand {
+	//linear allocator for recorded commands, memory is kept across frames and Reset() only rewinds the cursor
+	class VKCommandArena {
+		struct Chunk {
+			Chunk* next;
+			size_t capacity;
+			size_t used;
+			//
+			inline uint8_t* GetData() {
+				return (uint8_t*)(this + 1);
+			}
+		};
 	public:
-		virtual ~VKCommand() {}
-		VKCommand() {
-			pnext = nullptr;
-		}
+		static const size_t CHUNK_SIZE = 64 * 1024;
 		//
-		virtual void excute(CommandBuffer* cmdBuffer) {}
+		VKCommandArena() {
+			mFirst = nullptr;
+			mCurrent = nullptr;
+		}
+
+		~VKCommandArena();
+
+		inline void* Allocate(size_t size, size_t alignment) {
+			if (mCurrent != nullptr) {
+				auto base = (uintptr_t)mCurrent->GetData();
+				auto offset = ((base + mCurrent->used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+				if (offset + size <= mCurrent->capacity) {
+					mCurrent->used = offset + size;
+					return mCurrent->GetData() + offset;
+				}
+			}
+			//
+			nextChunk(size + alignment);
+			return Allocate(size, alignment);
+		}
+		//rewind to the first chunk, the other chunks are kept as spare chunks
+		inline void Reset() {
+			mCurrent = mFirst;
+			if (mCurrent != nullptr) {
+				mCurrent->used = 0;
+			}
+		}
+		inline bool IsEmpty() const {
+			return mCurrent == nullptr || (mCurrent == mFirst && mCurrent->used == 0);
+		}
+		//visit the used bytes of every chunk in allocation order
+		template<typename Func>
+		inline void ForEachChunk(Func func) const {
+			for (auto pchunk = mFirst; pchunk != nullptr; pchunk = pchunk->next) {
+				func(pchunk->GetData(), pchunk->used);
+				if (pchunk == mCurrent) {
+					break;
+				}
+			}
+		}
+		//take over the recorded chunks of other arena, hand back the same number of spare chunks
+		void Adopt(VKCommandArena& other);
+	private:
+		void nextChunk(size_t minSize);
+	private:
+		Chunk* mFirst;
+		Chunk* mCurrent;
+	};
+
+	enum class VKCmdType : uint8_t {
+		CMD_BEGIN_CMD_BUFFER,
+		CMD_END_CMD_BUFFER,
+		CMD_BEGIN_RENDER_PASS,
+		CMD_END_SUB_RENDER_PASS,
+		CMD_END_RENDER_PASS,
+		CMD_BEGIN_COMPUTE_PASS,
+		CMD_END_COMPUTE_PASS,
+		CMD_BIND_PIPELINE,
+		CMD_SET_VIEWPORT,
+		CMD_SET_SCISSOR,
+		CMD_SET_LINE_WIDTH,
+		CMD_BIND_INDEX_BUFFER,
+		CMD_BIND_VERTEX_BUFFER,
+		CMD_BIND_VERTEX_BUFFERS,
+		CMD_DRAW,
+		CMD_DRAW_INDEXED,
+		CMD_FILL_BUFFER,
+	};
+
+	class VKMemory;
+	class VKCommandBuffer;
+	class VKSubmission;
+	//packet header, every command is a POD payload following the header in the command stream.
+	//size covers the header, the payload and the trailing data, rounded up to PACKET_ALIGNMENT
+	struct VKCommand {
+		static const uint32_t PACKET_ALIGNMENT = 8;
+		//largest packet size fits, commands with more trailing data are split into several packets, see GetMaxCount
+		static const uint32_t MAX_PACKET_SIZE = 0xffff & ~(PACKET_ALIGNMENT - 1);
 		//
-		VKCommand* pnext = nullptr;
+		VKCmdType type;
+		uint8_t reserved;
+		uint16_t size;
 	};
 
+	//shadow of the state bound by the recorded commands, so redundant bind/set commands are dropped at record time.
+	//viewports, scissors and vertex bindings beyond the shadowed range are never filtered
+	struct VKBoundState {
+		static const uint32_t MAX_VERTEX_BINDINGS = 16;
+		static const uint32_t MAX_VIEWPORTS = 16;
+		//
+		GraphicsPipeline* pipeline;
+		ShaderProgram* gpuProgram;
+		Buffer* indexBuffer;
+		uint32_t indexOffset;
+		Format indexFormat;
+		Buffer* vertexBuffers[MAX_VERTEX_BINDINGS];
+		uint32_t vertexOffsets[MAX_VERTEX_BINDINGS];
+		uint32_t validViewportMask;
+		Viewport viewports[MAX_VIEWPORTS];
+		uint32_t validScissorMask;
+		Rect2D scissors[MAX_VIEWPORTS];
+		//
+		VKBoundState() {
+			Reset();
+		}
+
+		inline void Reset() {
+			pipeline = nullptr;
+			gpuProgram = nullptr;
+			indexBuffer = nullptr;
+			memset(vertexBuffers, 0, sizeof(vertexBuffers));
+			validViewportMask = 0;
+			validScissorMask = 0;
+		}
+	};
 
 	//
 	class VKCommandBuffer : public CommandBuffer {
 		friend class VulkanGI;
 	public:
-		static void ExcuteParallel(CommandBuffer* pCmdBuffer, CommandBuffer* pSecondCmdBuffer);
+		static const uint64_t STREAM_HASH_BASIS = 14695981039346656037ull;
+		static const uint64_t STREAM_HASH_PRIME = 1099511628211ull;
+		//
+		static void ExcuteParallel(CommandBuffer* pCmdBuffer, CommandBuffer* pSecondCmdBuffer, uintptr_t userData);
+		//must be called whenever a resource that recorded commands may reference is destroyed or rewritten,
+		//an encoded VkCommandBuffer is only reused within the same epoch
+		inline static void InvalidateEncodedCommands() {
+			sResourceEpoch++;
+		}
+	private:
+		static std::atomic<uint64_t> sResourceEpoch;
 	public:
 		inline static VKCommandBuffer* Cast(CommandBuffer* pcmd) {
 			return (VKCommandBuffer*)pcmd;
 		}
 	public:
-		int mUnExcuteSecondCmdBufferCount = 0;
-		//
-		VKCommandBuffer(GraphicsContext* pcontext) : CommandBuffer(pcontext) {
+		VKCommandBuffer(GraphicsContext* pcontext, VKCmdBufferManager* cmdBufferManager, bool immediateRecord = false) : CommandBuffer(pcontext) {
+			mCmdBufferManager = cmdBufferManager;
+			mImmediateRecord = immediateRecord;
+			mBindingItem = nullptr;
 			mBindingCmdBuffer = nullptr;
-			mUnExcuteSecondCmdBufferCount = 0;
+			mNumPendingSecondCmdBuffers = 1;
+			mPendingSubmission = nullptr;
 			mCmdBufferLevel = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			mStreamHash = STREAM_HASH_BASIS;
+			mEncodedHash = 0;
+			mEncodedEpoch = 0;
+			mEncodedCmdBuffer = nullptr;
+			mNumDrawIndexed = 0;
+			mMergeDrawIndexed = false;
+			mIndirectFirstInstance = false;
+			mIndirectRange = {};
+			mIndirectCapacity = 0;
+		}
+
+		~VKCommandBuffer();
+
+		//runs of VKCmdDrawIndexed are drawn with vkCmdDrawIndexedIndirect at replay, needs multiDrawIndirect.
+		//without drawIndirectFirstInstance the draws with firstInstance != 0 are never merged
+		inline void EnableDrawMerging(bool supportFirstInstance) {
+			mMergeDrawIndexed = true;
+			mIndirectFirstInstance = supportFirstInstance;
+		}
+
+		template<typename T, typename... Args>
+		inline T* PushCommand(Args&&... args) {
+			return PushCommandWithData<T>(0, std::forward<Args>(args)...);
+		}
+
+		//dataSize bytes are reserved right after the payload, see VKCmdSetViewport
+		template<typename T, typename... Args>
+		inline T* PushCommandWithData(uint32_t dataSize, Args&&... args) {
+			static_assert(std::is_trivially_copyable<T>::value, "VKCommand payload must be POD");
+			static_assert(alignof(T) <= VKCommand::PACKET_ALIGNMENT, "VKCommand payload is over aligned");
 			//
-			mHead = new VKCommand();
-			mLastCmd = mHead;
+			uint32_t size = (sizeof(T) + dataSize + VKCommand::PACKET_ALIGNMENT - 1) & ~(VKCommand::PACKET_ALIGNMENT - 1);
+			assert(size <= VKCommand::MAX_PACKET_SIZE);
+			//padding is zeroed so the packet bytes can be hashed
+			auto pdata = mArena.Allocate(size, VKCommand::PACKET_ALIGNMENT);
+			memset(pdata, 0, size);
+			auto pcmd = new(pdata) T(std::forward<Args>(args)...);
+			pcmd->type = T::TYPE;
+			pcmd->reserved = 0;
+			pcmd->size = size;
+			if (T::TYPE == VKCmdType::CMD_DRAW_INDEXED) {
+				++mNumDrawIndexed;
+			}
+			hashPacket((const uint64_t*)pdata, size / sizeof(uint64_t));
+			return pcmd;
+		}
+
+		//deferred command buffer appends the command to the stream, immediate command buffer translates it right away
+		template<typename T, typename... Args>
+		inline void RecordCommand(Args&&... args) {
+			++mStatistics.numEmittedCommands;
+			if (mImmediateRecord) {
+				T cmd(std::forward<Args>(args)...);
+				cmd.excute(this);
+				return;
+			}
+			//
+			PushCommand<T>(std::forward<Args>(args)...);
+		}
+
+		//the trailing data needs storage, so the packet is always built in the arena. it is never replayed
+		//for immediate command buffer, Clear() rewinds the arena at next BeginCmdBuffer
+		template<typename T, typename... Args>
+		inline void RecordCommandWithData(uint32_t dataSize, Args&&... args) {
+			++mStatistics.numEmittedCommands;
+			auto pcmd = PushCommandWithData<T>(dataSize, std::forward<Args>(args)...);
+			if (mImmediateRecord) {
+				pcmd->excute(this);
+			}
+		}
+
+		//the Update* functions return false if the state is already bound and the command can be dropped.
+		//bindDescriptorSets is false if the new pipeline uses the same GPU program as the bound one
+		inline bool UpdateBoundPipeline(GraphicsPipeline* pipeline, bool& bindDescriptorSets) {
+			bindDescriptorSets = true;
+			if (pipeline == nullptr) {
+				return true;
+			}
+			//
+			if (pipeline == mBoundState.pipeline) {
+				++mStatistics.numFilteredCommands;
+				return false;
+			}
+			//
+			auto gpuProgram = pipeline->GetGPUProgram();
+			if (gpuProgram == mBoundState.gpuProgram) {
+				bindDescriptorSets = false;
+				++mStatistics.numFilteredDescriptorSetBinds;
+			}
+			mBoundState.pipeline = pipeline;
+			mBoundState.gpuProgram = gpuProgram;
+			return true;
+		}
+
+		inline bool UpdateBoundIndexBuffer(Buffer* pBuffer, uint32_t offset, Format indexFormat) {
+			if (pBuffer == mBoundState.indexBuffer && offset == mBoundState.indexOffset && indexFormat == mBoundState.indexFormat) {
+				++mStatistics.numFilteredCommands;
+				return false;
+			}
+			//
+			mBoundState.indexBuffer = pBuffer;
+			mBoundState.indexOffset = offset;
+			mBoundState.indexFormat = indexFormat;
+			return true;
+		}
+
+		inline bool UpdateBoundVertexBuffer(uint32_t bindingIndex, Buffer* pBuffer, uint32_t offset) {
+			return UpdateBoundVertexBuffers(bindingIndex, 1, &pBuffer, &offset);
+		}
+
+		inline bool UpdateBoundVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, Buffer** ppBuffers, const uint32_t* pOffsets) {
+			bool changed = false;
+			for (uint32_t i = 0; i < bindingCount; ++i) {
+				uint32_t bindingIndex = firstBinding + i;
+				if (bindingIndex >= VKBoundState::MAX_VERTEX_BINDINGS) {
+					changed = true;
+					continue;
+				}
+				//
+				if (ppBuffers[i] != mBoundState.vertexBuffers[bindingIndex] || pOffsets[i] != mBoundState.vertexOffsets[bindingIndex]) {
+					mBoundState.vertexBuffers[bindingIndex] = ppBuffers[i];
+					mBoundState.vertexOffsets[bindingIndex] = pOffsets[i];
+					changed = true;
+				}
+			}
+			//
+			if (!changed) {
+				++mStatistics.numFilteredCommands;
+			}
+			return changed;
+		}
+
+		inline bool UpdateBoundViewports(uint32_t firstViewport, uint32_t viewportCount, const Viewport* pViewports) {
+			return updateBoundArray(firstViewport, viewportCount, pViewports, mBoundState.viewports, mBoundState.validViewportMask);
+		}
+
+		inline bool UpdateBoundScissors(uint32_t firstScissor, uint32_t scissorCount, const Rect2D* pScissors) {
+			return updateBoundArray(firstScissor, scissorCount, pScissors, mBoundState.scissors, mBoundState.validScissorMask);
+		}
+
+		inline const CommandBufferStatistics& GetStatistics() {
+			return mStatistics;
 		}
 
-		inline void PushCommand(VKCommand* pcmd) {
-			mLastCmd->pnext = pcmd;
-			mLastCmd = mLastCmd->pnext;
+		inline bool IsImmediateRecord() {
+			return mImmediateRecord;
 		}
 
 		inline VkCommandBuffer GetBindingCmdBuffer() {
 			return mBindingCmdBuffer;
 		}
 
+		inline VKCmdBufferManager::CmdBufferItm* GetBindingItem() {
+			return mBindingItem;
+		}
+
+		//take a buffer in initial state from the pools of the calling thread for the current frame, the previous binding buffer is given back.
+		//call on the thread that encodes into the binding buffer
+		inline bool AcquireThreadCmdBuffer(VkCommandBufferLevel level) {
+			if (mBindingItem != nullptr) {
+				mCmdBufferManager->FreeCmdBuffer(mBindingItem);
+			}
+			//
+			mBindingItem = level == VK_COMMAND_BUFFER_LEVEL_PRIMARY ?
+				mCmdBufferManager->AcquirePrimaryCmdBuffer(VK_PIPELINE_BIND_POINT_GRAPHICS) : mCmdBufferManager->AcquireSecondCmdBuffer(VK_PIPELINE_BIND_POINT_GRAPHICS);
+			mBindingCmdBuffer = mBindingItem != nullptr ? mBindingItem->cmdBuffer : nullptr;
+			if (mImmediateRecord && mBindingItem != nullptr) {
+				mCmdBufferManager->HoldCmdBuffer(mBindingItem);
+			}
+			return mBindingItem != nullptr;
+		}
+
 		inline uint32_t GetNumSecondCmdBuffer() {
 			return mSecondCmdBuffers.size();
 		}
 
+		inline bool IsEmpty() {
+			return mArena.IsEmpty();
+		}
+
+		//the recorded chunks are spliced to the end of the target stream, nothing is copied.
+		//immediate target is already encoding, so the stream is translated into it at once
 		inline void MergeTo(VKCommandBuffer* targetCmdBuffer) {
-			targetCmdBuffer->mLastCmd->pnext = mHead->pnext;
-			targetCmdBuffer->mLastCmd = mLastCmd;
+			if (IsEmpty()) {
+				return;
+			}
+			//
+			//the state bound by the merged commands is unknown to both buffers
+			mBoundState.Reset();
+			targetCmdBuffer->mBoundState.Reset();
+			//
+			if (targetCmdBuffer->mImmediateRecord) {
+				excuteCommands(targetCmdBuffer);
+				mArena.Reset();
+				return;
+			}
 			//
-			mHead->pnext = nullptr;
-			mLastCmd = mHead;
+			targetCmdBuffer->mArena.Adopt(mArena);
+			targetCmdBuffer->hashPacket(&mStreamHash, 1);
+			targetCmdBuffer->mNumDrawIndexed += mNumDrawIndexed;
+			mStreamHash = STREAM_HASH_BASIS;
+			mNumDrawIndexed = 0;
+		}
+
+		//called when second command buffers are excuted inside this buffer
+		//a second command buffer is pushed to the task queue, it has to be translated before this buffer is submitted
+		inline void AddPendingSecondCmdBuffer() {
+			mNumPendingSecondCmdBuffers.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		//called by the worker that translated a second command buffer, and once by SubmitCommands after it set mPendingSubmission.
+		//the last one tells the submission this buffer is ready, defined in VulkanResource.cpp
+		void SecondCmdBufferFinished();
+
+		inline void InvalidateBoundState() {
+			mBoundState.Reset();
+		}
+
+		//the upload on the transfer queue of a resource the recorded commands use, the submission waits on it
+		inline void AddUpload(VKUpload* upload) {
+			if (upload->IsClaimed() || std::find(mUploads.begin(), mUploads.end(), upload) != mUploads.end()) {
+				return;
+			}
+			mUploads.push_back(upload);
+		}
+
+		inline const std::vector<upload_ptr>& GetUploads() {
+			return mUploads;
 		}
 
 		inline void Clear() {
 			mSecondCmdBuffers.clear();
+			mUploads.clear();
 			//
-			auto pcmd = mHead->pnext;
-			mHead->pnext = nullptr;
-			mLastCmd = mHead;
-			//
-			while (pcmd != nullptr) {
-				auto tmp = pcmd;
-				pcmd = tmp->pnext;
-				delete tmp;
-			}
+			mArena.Reset();
+			mBoundState.Reset();
+			mStatistics = CommandBufferStatistics();
+			mStreamHash = STREAM_HASH_BASIS;
+			mNumDrawIndexed = 0;
 		}
 
+		//nothing to do for immediate command buffer, everything is already in the binding buffer.
+		//the encoding is also skipped if the binding buffer still holds the same stream from the same resource epoch,
+		//a binding buffer only survives until the pools of its frame are reset
 		VkResult Excute();
+		//the calling thread translates a command stream into its VkCommandBuffer, replay is expected to be allocation free
+		//in steady state and the allocation hooks of the tests only count while this is true
+		static bool IsReplaying();
 	private:
-		VKCommand* mHead;
-		VKCommand* mLastCmd;
-		std::mutex mMtxSecondCmdBuffer;
-		std::condition_variable mCond;
+		//replay the command stream into the binding command buffer of targetCmdBuffer
+		void excuteCommands(VKCommandBuffer* targetCmdBuffer);
+		//indirect draws for this replay from the pools of the target's binding buffer
+		bool reserveIndirectDraws(VKCommandBuffer* targetCmdBuffer, uint32_t numDraws);
+		//draw the run of VKCmdDrawIndexed starting at pdata with one indirect draw,
+		//return the packet after the run, or nullptr if the run is too short to be merged
+		const uint8_t* excuteDrawIndexedRun(const uint8_t* pdata, const uint8_t* pend, VKCommandBuffer* targetCmdBuffer, uint32_t& indirectCursor);
+
+		inline void hashPacket(const uint64_t* pwords, uint32_t numWords) {
+			for (uint32_t i = 0; i < numWords; ++i) {
+				mStreamHash = (mStreamHash ^ pwords[i]) * STREAM_HASH_PRIME;
+				mStreamHash ^= mStreamHash >> 32;
+			}
+		}
+
+		template<typename T>
+		inline bool updateBoundArray(uint32_t first, uint32_t count, const T* pvalues, T* pbound, uint32_t& validMask) {
+			if (first + count > VKBoundState::MAX_VIEWPORTS) {
+				validMask = 0;
+				return true;
+			}
+			//
+			uint32_t mask = ((1u << count) - 1) << first;
+			if ((validMask & mask) == mask && memcmp(pbound + first, pvalues, sizeof(T) * count) == 0) {
+				++mStatistics.numFilteredCommands;
+				return false;
+			}
+			//
+			memcpy(pbound + first, pvalues, sizeof(T) * count);
+			validMask |= mask;
+			return true;
+		}
+	private:
+		bool mImmediateRecord;
+		VKBoundState mBoundState;
+		CommandBufferStatistics mStatistics;
+		VKCommandArena mArena;
+		//rolling hash of the recorded stream, and what was last encoded into the binding buffer
+		uint64_t mStreamHash;
+		uint64_t mEncodedHash;
+		uint64_t mEncodedEpoch;
+		VkCommandBuffer mEncodedCmdBuffer;
+		//draw merging, the indirect draws of the current replay, see VKCmdBufferManager::AllocateIndirectDraws
+		uint32_t mNumDrawIndexed;
+		bool mMergeDrawIndexed;
+		bool mIndirectFirstInstance;
+		VKCmdBufferManager::IndirectRange mIndirectRange;
+		uint32_t mIndirectCapacity;
+		//second command buffers not translated yet, plus one held until the buffer is submitted
+		std::atomic<int32_t> mNumPendingSecondCmdBuffers;
+		VKSubmission* mPendingSubmission;
+		//only touched by the thread that records and submits the buffer, BeginCmdBuffer waits until it is handed to the queue
+		submission_ptr mLastSubmission;
+		VKCmdBufferManager* mCmdBufferManager;
+		VKCmdBufferManager::CmdBufferItm* mBindingItem;
 		VkCommandBuffer mBindingCmdBuffer;
 		VkCommandBufferLevel mCmdBufferLevel;
 		std::vector<CommandBuffer*> mSecondCmdBuffers;
+		std::vector<upload_ptr> mUploads;
 	};
 
 	//
-	class VKCmdBeginCmdBuffer : public VKCommand {
-		void excute(CommandBuffer* cmdBuffer) override {
-			auto tmp = VKCommandBuffer::Cast(cmdBuffer);
-			//
-			VkCommandBufferBeginInfo cmd_buffer_begin_info = {};
-			cmd_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			cmd_buffer_begin_info.pNext = nullptr;
-			vkBeginCommandBuffer(tmp->GetBindingCmdBuffer(), &cmd_buffer_begin_info);
-		}
+	struct VKCmdBeginCmdBuffer : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_BEGIN_CMD_BUFFER;
+		//
+		void excute(VKCommandBuffer* cmdBuffer) const;
 	};
 
-	class VKCmdEndCmdBuffer : public VKCommand {
-		void excute(CommandBuffer* cmdBuffer) override {
-			auto tmp = VKCommandBuffer::Cast(cmdBuffer);
-			//
-			vkEndCommandBuffer(tmp->GetBindingCmdBuffer());
-		}
+	struct VKCmdEndCmdBuffer : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_END_CMD_BUFFER;
+		//
+		void excute(VKCommandBuffer* cmdBuffer) const;
 	};
 
-	class VKCmdBeginRenderPass : public VKCommand {
-	public:
+	struct VKCmdBeginRenderPass : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_BEGIN_RENDER_PASS;
+		//
 		VKCmdBeginRenderPass(RenderPass* renderPass, FrameBuffer* frameBuffer) {
 			mRenderPass = renderPass;
 			mFrameBuffer = frameBuffer;
 		}
 
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		RenderPass* mRenderPass;
 		FrameBuffer* mFrameBuffer;
 	};
 
-	class VKCmdEndSubRenderPass : public VKCommand {
-	public:
-
+	struct VKCmdEndSubRenderPass : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_END_SUB_RENDER_PASS;
+		//
+		inline void excute(VKCommandBuffer* cmdBuffer) const {}
 	};
 
-	class VKCmdEndRenderPass : public VKCommand {
-	public:
-		void excute(CommandBuffer* cmdBuffer) override {
-			auto tmp = VKCommandBuffer::Cast(cmdBuffer);
-			//
-			vkCmdEndRenderPass(tmp->GetBindingCmdBuffer());
-		}
+	struct VKCmdEndRenderPass : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_END_RENDER_PASS;
+		//
+		void excute(VKCommandBuffer* cmdBuffer) const;
 	};
 
-	class VKCmdBeginComputePass : public VKCommand {
-	public:
-
+	struct VKCmdBeginComputePass : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_BEGIN_COMPUTE_PASS;
+		//
+		inline void excute(VKCommandBuffer* cmdBuffer) const {}
 	};
 
-	class VKCmdEndComputePass : public VKCommand {
-	public:
-
+	struct VKCmdEndComputePass : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_END_COMPUTE_PASS;
+		//
+		inline void excute(VKCommandBuffer* cmdBuffer) const {}
 	};
 
-	class VKCmdBindPipeline : public VKCommand {
-	public:
-		VKCmdBindPipeline(GraphicsPipeline* pipeline) {
+	struct VKCmdBindPipeline : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_BIND_PIPELINE;
+		//
+		VKCmdBindPipeline(GraphicsPipeline* pipeline, bool bindDescriptorSets) {
 			mGraphicsPipeline = pipeline;
 			mComputePipeline = nullptr;
+			mBindDescriptorSets = bindDescriptorSets;
 		}
 
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		GraphicsPipeline* mGraphicsPipeline;
 		ComputePipeline* mComputePipeline;
+		//descriptor sets stay bound when the pipeline is switched within the same GPU program
+		bool mBindDescriptorSets;
 	};
 
-	class VKCmdSetViewport : public VKCommand {
-	public:
+	//the viewports are stored inline right after the payload
+	struct VKCmdSetViewport : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_SET_VIEWPORT;
+		//
 		VKCmdSetViewport(uint32_t   firstViewport, uint32_t  viewportCount, Viewport*  viewports) {
 			mFirstViewport = firstViewport;
-			mViewports.resize(viewportCount);
-			for (int i = 0; i < viewportCount; ++i) {
-				mViewports[i] = viewports[i];
+			mViewportCount = viewportCount;
+			auto vkViewports = GetViewports();
+			for (uint32_t i = 0; i < viewportCount; ++i) {
+				vkViewports[i].x = viewports[i].x;
+				vkViewports[i].y = viewports[i].y;
+				vkViewports[i].width = viewports[i].width;
+				vkViewports[i].height = viewports[i].height;
+				vkViewports[i].minDepth = viewports[i].minDepth;
+				vkViewports[i].maxDepth = viewports[i].maxDepth;
 			}
 		}
 
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		//viewports one packet can hold
+		inline static uint32_t GetMaxCount() {
+			return (VKCommand::MAX_PACKET_SIZE - sizeof(VKCmdSetViewport)) / sizeof(VkViewport);
+		}
+
+		inline VkViewport* GetViewports() const {
+			return (VkViewport*)(this + 1);
+		}
+
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		uint32_t mFirstViewport;
-		std::vector<Viewport> mViewports;
+		uint32_t mViewportCount;
 	};
 
-	class VKCmdSetScissor : public VKCommand {
-	public:
+	//the scissors are stored inline right after the payload
+	struct VKCmdSetScissor : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_SET_SCISSOR;
+		//
 		VKCmdSetScissor(uint32_t firstScissor, uint32_t scissorCount, Rect2D* scissors) {
 			mFirstScissor = firstScissor;
-			mScissors.resize(scissorCount);
-			for (int i = 0; i < scissorCount; ++i) {
-				mScissors[i] = scissors[i];
+			mScissorCount = scissorCount;
+			auto vkScissors = GetScissors();
+			for (uint32_t i = 0; i < scissorCount; ++i) {
+				vkScissors[i].extent.width = scissors[i].extent.width;
+				vkScissors[i].extent.height = scissors[i].extent.height;
+				vkScissors[i].offset.x = scissors[i].offset.x;
+				vkScissors[i].offset.y = scissors[i].offset.y;
 			}
 		}
+
+		inline static uint32_t GetMaxCount() {
+			return (VKCommand::MAX_PACKET_SIZE - sizeof(VKCmdSetScissor)) / sizeof(VkRect2D);
+		}
+
+		inline VkRect2D* GetScissors() const {
+			return (VkRect2D*)(this + 1);
+		}
+		//
+		void excute(VKCommandBuffer* cmdBuffer) const;
 		//
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
 		uint32_t mFirstScissor;
-		std::vector<Rect2D> mScissors;
+		uint32_t mScissorCount;
 	};
 
-	class VKCmdSetLineWidth : public VKCommand {
-	public:
+	struct VKCmdSetLineWidth : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_SET_LINE_WIDTH;
+		//
 		VKCmdSetLineWidth(float lineWidth) {
 			mLineWidth = lineWidth;
 		}
 		//
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		float mLineWidth;
 	};
 
-	class VKCmdBindIndexBuffer : public VKCommand {
-	public:
+	struct VKCmdBindIndexBuffer : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_BIND_INDEX_BUFFER;
+		//
 		VKCmdBindIndexBuffer(Buffer* pbuffer, uint32_t offset, Format indexFormat) {
 			mBuffer = pbuffer;
 			mOffset = offset;
 			mFormat = indexFormat;
 		}
 		//
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		Buffer* mBuffer;
 		uint32_t mOffset;
 		Format mFormat;
 	};
 
-	class VKCmdBindVertexBuffer : public VKCommand {
-	public:
+	struct VKCmdBindVertexBuffer : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_BIND_VERTEX_BUFFER;
+		//
 		VKCmdBindVertexBuffer(uint32_t bindingIndex, Buffer* pbuffer, uint32_t offset) {
 			mBindingIndex = bindingIndex;
 			mBuffer = pbuffer;
 			mOffset = offset;
 		}
 		//
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		uint32_t mBindingIndex;
 		Buffer* mBuffer;
 		uint32_t mOffset;
 	};
 
-	class VKCmdDraw : public VKCommand {
-	public:
+	//the VkBuffer handles and the offsets are stored inline right after the payload, all bindings go to vulkan in one call.
+	//the source Buffer objects follow the offsets, they are only read by the stream capture
+	struct alignas(8) VKCmdBindVertexBuffers : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_BIND_VERTEX_BUFFERS;
+		//
+		inline static uint32_t GetDataSize(uint32_t bindingCount) {
+			return (sizeof(VkBuffer) + sizeof(VkDeviceSize) + sizeof(Buffer*)) * bindingCount;
+		}
+
+		inline static uint32_t GetMaxCount() {
+			return (VKCommand::MAX_PACKET_SIZE - sizeof(VKCmdBindVertexBuffers)) / GetDataSize(1);
+		}
+
+		VKCmdBindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, Buffer** ppBuffers, const uint32_t* pOffsets);
+
+		inline VkBuffer* GetBuffers() const {
+			return (VkBuffer*)(this + 1);
+		}
+
+		inline VkDeviceSize* GetOffsets() const {
+			return (VkDeviceSize*)(GetBuffers() + mBindingCount);
+		}
+
+		inline Buffer** GetSourceBuffers() const {
+			return (Buffer**)(GetOffsets() + mBindingCount);
+		}
+		//
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
+		uint32_t mFirstBinding;
+		uint32_t mBindingCount;
+	};
+
+	struct VKCmdDraw : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_DRAW;
+		//
 		VKCmdDraw(uint32_t virtexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) {
 			mVirtexCount = virtexCount;
 			mInstanceCount = instanceCount;
@@ -399,16 +927,17 @@ namespace ASGI {
 			mFirstInstance = firstInstance;
 		}
 		//
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		uint32_t mVirtexCount;
 		uint32_t mInstanceCount;
 		uint32_t mFirstVertex;
 		uint32_t mFirstInstance;
 	};
 
-	class VKCmdDrawIndexed : public VKCommand {
-	public:
+	struct VKCmdDrawIndexed : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_DRAW_INDEXED;
+		//
 		VKCmdDrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, uint32_t vertexOffset, uint32_t firstInstance) {
 			mIndexCount = indexCount;
 			mInstanceCount = instanceCount;
@@ -417,12 +946,31 @@ namespace ASGI {
 			mFirstInstance = firstInstance;
 		}
 		//
-		void excute(CommandBuffer* cmdBuffer) override;
-	private:
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
 		uint32_t mIndexCount;
 		uint32_t mInstanceCount;
 		uint32_t mFirstIndex;
 		uint32_t mVertexOffset;
 		uint32_t mFirstInstance;
 	};
+
+	//no barrier is recorded, earlier accesses to the range must be ordered before it by the caller
+	struct VKCmdFillBuffer : public VKCommand {
+		static const VKCmdType TYPE = VKCmdType::CMD_FILL_BUFFER;
+		//
+		VKCmdFillBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, uint32_t data) {
+			mBuffer = pbuffer;
+			mOffset = offset;
+			mSize = size;
+			mData = data;
+		}
+		//
+		void excute(VKCommandBuffer* cmdBuffer) const;
+		//
+		Buffer* mBuffer;
+		uint32_t mOffset;
+		uint32_t mSize;
+		uint32_t mData;
+	};
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "VulkanDevice.h"
 #include "VulkanResource.h"
 #include "GraphicsContextManager.h"
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
 namespace ASGI {
 	bool VKLogicDevice::Init(VkPhysicalDevice physicalDevice) {
@@ -16,6 +19,7 @@ namespace ASGI {
 		//
 		int graphics_queue_family_index = -1;
 		int compute_queue_family_index = -1;
+		int transfer_queue_family_index = -1;
 		for (int i = 0; i < mQueueFamilys.size(); ++i) {
 			auto &queueFamily = mQueueFamilys[i];
 			if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0) {
@@ -30,6 +34,13 @@ namespace ASGI {
 				}
 				compute_queue_family_index = i;
 			}
+			else if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) != 0) {
+				//the copy engine of the device, the uploads run on it beside the rendering
+				if (transfer_queue_family_index > -1) {
+					continue;
+				}
+				transfer_queue_family_index = i;
+			}
 		}
 		//
 		if (graphics_queue_family_index == -1) {
@@ -47,8 +58,10 @@ namespace ASGI {
 			priorities0.data()
 		};
 		queueCreateInfos.push_back(graphics_queue_create_info);
+		//the priorities are read by vkCreateDevice
+		std::vector<float> priorities1;
 		if (compute_queue_family_index > -1) {
-			std::vector<float> priorities1(mQueueFamilys[compute_queue_family_index].queueCount, 1.0);
+			priorities1.resize(mQueueFamilys[compute_queue_family_index].queueCount, 1.0);
 			VkDeviceQueueCreateInfo compute_queue_create_info = {
 				VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
 				nullptr,
@@ -59,6 +72,18 @@ namespace ASGI {
 			};
 			queueCreateInfos.push_back(compute_queue_create_info);
 		}
+		float transfer_priority = 1.0;
+		if (transfer_queue_family_index > -1) {
+			VkDeviceQueueCreateInfo transfer_queue_create_info = {
+				VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+				nullptr,
+				0,
+				transfer_queue_family_index,
+				1,
+				&transfer_priority
+			};
+			queueCreateInfos.push_back(transfer_queue_create_info);
+		}
 		//
 		std::vector<char*> enabledDeviceLayers;
 		enabledDeviceLayers.push_back("VK_LAYER_LUNARG_standard_validation");
@@ -68,6 +93,12 @@ namespace ASGI {
 		memset(&desired_features, 0, sizeof(VkPhysicalDeviceFeatures));
 		desired_features.tessellationShader = VK_TRUE;
 		desired_features.geometryShader = VK_TRUE;
+		//used by the draw merging of VKCommandBuffer when supported
+		VkPhysicalDeviceFeatures supported_features;
+		vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supported_features);
+		desired_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+		desired_features.drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance;
+		mEnabledFeatures = desired_features;
 		VkDeviceCreateInfo device_create_info = {
 			VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
 			nullptr,
@@ -85,6 +116,9 @@ namespace ASGI {
 		if ((result != VK_SUCCESS) || (mLogicDevice == VK_NULL_HANDLE)) {
 			return false;
 		}
+		//the fences and semaphores of the submissions
+		mSyncPool = new VKSyncPool(mLogicDevice);
+		mGraphicsScheduler = new VKQueueScheduler(mLogicDevice);
 		//
 		for (int i = 0; i < mQueueFamilys[graphics_queue_family_index].queueCount; ++i) {
 			VkQueue queue;
@@ -96,34 +130,22 @@ namespace ASGI {
 			tmp->queueFlags = mQueueFamilys[graphics_queue_family_index].queueFlags;
 			tmp->mType = QueueType::QUEUE_TYPE_GRAPHICS;
 			//
-			VkFenceCreateInfo fenceCreateInfo = {};
-			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-			fenceCreateInfo.pNext = nullptr;
-			fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-			if (vkCreateFence(mLogicDevice, &fenceCreateInfo, nullptr, &tmp->signalingFence) != VK_SUCCESS) {
-				continue;
-			}
-			//
-			VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-			semaphoreCreateInfo.pNext = nullptr;
-			semaphoreCreateInfo.flags = 0;
-			if (vkCreateSemaphore(mLogicDevice, &semaphoreCreateInfo, nullptr, &tmp->signalingSemaphore) != VK_SUCCESS) {
-				continue;
-			}
-			//
-			mGraphicsQueues[(long long)queue] = tmp;
+			mGraphicsScheduler->AddQueue(tmp);
 		}
 		//
-		if (mGraphicsQueues.size() == 0) {
-			return false;
+		mGraphicsQueueFamilyIndex = graphics_queue_family_index;
+		mComputeQueueFamilyIndex = graphics_queue_family_index;
+		if (transfer_queue_family_index > -1) {
+			vkGetDeviceQueue(mLogicDevice, transfer_queue_family_index, 0, &mTransferQueue);
+			mTransferQueueFamilyIndex = transfer_queue_family_index;
 		}
 		//
-		if (compute_queue_family_index == -1) {
-			mComputeQueues = mGraphicsQueues;
+		if (compute_queue_family_index == -1 || mQueueFamilys[compute_queue_family_index].queueCount == 0) {
+			mComputeScheduler = mGraphicsScheduler;
 			return true;
 		}
 		//
+		mComputeScheduler = new VKQueueScheduler(mLogicDevice);
 		for (int i = 0; i < mQueueFamilys[compute_queue_family_index].queueCount; ++i) {
 			VkQueue queue;
 			vkGetDeviceQueue(mLogicDevice, compute_queue_family_index, i, &queue);
@@ -132,96 +154,181 @@ namespace ASGI {
 			tmp->familyIndex = compute_queue_family_index;
 			tmp->mQueue = queue;
 			tmp->queueFlags = mQueueFamilys[compute_queue_family_index].queueFlags;
+			tmp->mType = QueueType::QUEUE_TYPE_COMPUTE;
 			//
-			VkFenceCreateInfo fenceCreateInfo = {};
-			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-			fenceCreateInfo.pNext = nullptr;
-			fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-			if (vkCreateFence(mLogicDevice, &fenceCreateInfo, nullptr, &tmp->signalingFence) != VK_SUCCESS) {
-				continue;
-			}
-			//
-			VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-			semaphoreCreateInfo.pNext = nullptr;
-			semaphoreCreateInfo.flags = 0;
-			if (vkCreateSemaphore(mLogicDevice, &semaphoreCreateInfo, nullptr, &tmp->signalingSemaphore) != VK_SUCCESS) {
-				continue;
-			}
-			//
-			mComputeQueues[(long long)queue] = tmp;
-		}
-		//
-		if (mComputeQueues.size() == 0) {
-			mComputeQueues = mGraphicsQueues;
+			mComputeScheduler->AddQueue(tmp);
 		}
 		//
-		mGraphicsQueueFamilyIndex = graphics_queue_family_index;
 		mComputeQueueFamilyIndex = compute_queue_family_index;
 		//
 		return true;
 	}
 
-	VkResult VKLogicDevice::ExcuteCmdOnIdleGraphicsQueue(VkCommandBuffer* cmdBuffer, bool waiteFinished) {
-		auto tmp = GetIdleGraphicsQueue();
-		if (tmp == nullptr) {
-			return VK_NOT_READY;
-		}
-		//
-		VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = cmdBuffer;
-		submitInfo.waitSemaphoreCount = 0;
-		submitInfo.pWaitSemaphores = nullptr;
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = &tmp->signalingSemaphore;
-		auto res = vkQueueSubmit(tmp->mQueue, 1, &submitInfo, tmp->signalingFence);
-		if (res != VK_SUCCESS) {
-			return res;
+	VKQueueScheduler::VKQueueScheduler(VkDevice logicDevice) {
+		mLogicDevice = logicDevice;
+	}
+
+	void VKQueueScheduler::AddQueue(VKExcuteQueue* queue) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		queue->mScheduler = this;
+		queue->mIdle = true;
+		queue->mInReadyList = true;
+		mQueues.push_back(queue);
+		mReadyQueues.push_back(queue);
+		if (mCurrentQueue == nullptr) {
+			mCurrentQueue = queue;
 		}
-		//
-		if (waiteFinished) {
-			res = vkQueueWaitIdle(tmp->mQueue);
+	}
+
+	VKExcuteQueue* VKQueueScheduler::Acquire(uint64_t timeout) {
+		typedef std::chrono::steady_clock Clock;
+		auto start = Clock::now();
+		bool blocked = false;
+		std::vector<submission_ptr> busySubmissions;
+		std::vector<VkFence> fences;
+		std::vector<VKSubmission*> waitedSubmissions;
+		while (true) {
+			{
+				std::lock_guard<std::mutex> lock(mMtx);
+				auto queue = popReady();
+				if (queue == nullptr && refresh()) {
+					queue = popReady();
+				}
+				if (queue != nullptr) {
+					mCurrentQueue = queue;
+					queue->mNumAcquires.fetch_add(1, std::memory_order_relaxed);
+					if (blocked) {
+						queue->mNumBlockedAcquires.fetch_add(1, std::memory_order_relaxed);
+						queue->mBlockedTime.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(), std::memory_order_relaxed);
+					}
+					return queue;
+				}
+				busySubmissions.clear();
+				for (auto queue : mQueues) {
+					busySubmissions.push_back(queue->mLastSubmission);
+				}
+			}
+			//
+			blocked = true;
+			uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+			if (elapsed >= timeout) {
+				return nullptr;
+			}
+			//the first fence signaled wakes the wait, a submission still on its way to the queue is polled again after a while.
+			//the fences are kept from being retired while they are waited on
+			fences.clear();
+			waitedSubmissions.clear();
+			for (auto &submission : busySubmissions) {
+				auto fence = submission != nullptr ? VKSubmission::Cast(submission)->AddFenceWaiter() : VK_NULL_HANDLE;
+				if (fence != VK_NULL_HANDLE) {
+					fences.push_back(fence);
+					waitedSubmissions.push_back(VKSubmission::Cast(submission));
+				}
+			}
+			if (fences.empty()) {
+				std::this_thread::yield();
+				continue;
+			}
+			auto waiteTime = timeout - elapsed;
+			if (fences.size() < busySubmissions.size()) {
+				waiteTime = (std::min)(waiteTime, (uint64_t)1000000);
+			}
+			vkWaitForFences(mLogicDevice, (uint32_t)fences.size(), fences.data(), VK_FALSE, waiteTime);
+			for (auto psubmission : waitedSubmissions) {
+				psubmission->RemoveFenceWaiter();
+			}
 		}
-		//
-		return res;
 	}
 
-	VkResult VKLogicDevice::ExcuteCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished) {
-		std::vector<VkSemaphore> waiteSemaphores(numWaiteQueue + numSwapchain);
-		std::vector<VkPipelineStageFlags> waiteStages(numWaiteQueue + numSwapchain);
-		std::vector<VkCommandBuffer> vkCmdBuffers(numBuffers);
-		//
-		for (int i = 0; i < numWaiteQueue; ++i) {
-			waiteSemaphores[i] = VKExcuteQueue::Cast(waiteQueues[i])->signalingSemaphore;
-			waiteStages[i] = VkPipelineStageFlagBits::VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	void VKQueueScheduler::SetLastSubmission(VKExcuteQueue* queue, Submission* submission) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		queue->mLastSubmission = submission;
+		queue->mIdle = false;
+		queue->mNumSubmissions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	submission_ptr VKQueueScheduler::GetLastSubmission(VKExcuteQueue* queue) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		return queue->mLastSubmission;
+	}
+
+	VKExcuteQueue* VKQueueScheduler::GetCurrent() {
+		std::lock_guard<std::mutex> lock(mMtx);
+		return mCurrentQueue;
+	}
+
+	QueueStatistics VKQueueScheduler::GetStatistics(VKExcuteQueue* queue) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		refresh();
+		QueueStatistics statistics;
+		statistics.numAcquires = queue->mNumAcquires.load(std::memory_order_relaxed);
+		statistics.numSubmissions = queue->mNumSubmissions.load(std::memory_order_relaxed);
+		statistics.numBlockedAcquires = queue->mNumBlockedAcquires.load(std::memory_order_relaxed);
+		if (statistics.numBlockedAcquires > 0) {
+			statistics.averageBlockedTime = queue->mBlockedTime.load(std::memory_order_relaxed) / 1000000.0 / statistics.numBlockedAcquires;
 		}
-		for (int i = 0; i < numSwapchain; ++i) {
-			waiteSemaphores[numWaiteQueue + i] = VKSwapchain::Cast(waiteSwapchains[i])->GetPresentSemaphore();
-			waiteStages[numWaiteQueue + i] = VkPipelineStageFlagBits::VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		statistics.idle = queue->mIdle;
+		return statistics;
+	}
+
+	VKExcuteQueue* VKQueueScheduler::popReady() {
+		while (!mReadyQueues.empty()) {
+			auto queue = mReadyQueues.front();
+			mReadyQueues.pop_front();
+			if (!queue->mIdle) {
+				queue->mInReadyList = false;
+				continue;
+			}
+			mReadyQueues.push_back(queue);
+			return queue;
 		}
-		for (int i = 0; i < numBuffers; ++i) {
-			vkCmdBuffers[i] = VKCommandBuffer::Cast(cmdBuffers[i])->GetBindingCmdBuffer();
+		return nullptr;
+	}
+
+	bool VKQueueScheduler::refresh() {
+		bool found = false;
+		for (auto queue : mQueues) {
+			if (queue->mIdle || (queue->mLastSubmission != nullptr && !VKSubmission::Cast(queue->mLastSubmission)->IsFinished())) {
+				continue;
+			}
+			queue->mIdle = true;
+			if (!queue->mInReadyList) {
+				queue->mInReadyList = true;
+				mReadyQueues.push_back(queue);
+			}
+			found = true;
 		}
-		//
+		return found;
+	}
+
+	VkResult VKLogicDevice::ExcuteCommands(ExcuteQueue* excuteQueue, uint32_t numBatches, const VkSubmitInfo* batches, VkFence fence, bool waiteFinished) {
 		auto tmp = VKExcuteQueue::Cast(excuteQueue);
-		VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr};
-		submitInfo.commandBufferCount = numBuffers;
-		submitInfo.pCommandBuffers = vkCmdBuffers.data();
-		submitInfo.waitSemaphoreCount = waiteSemaphores.size();
-		submitInfo.pWaitSemaphores = submitInfo.waitSemaphoreCount > 0 ? waiteSemaphores.data() : nullptr;
-		submitInfo.pWaitDstStageMask = submitInfo.waitSemaphoreCount > 0 ? waiteStages.data() : nullptr;
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = &tmp->signalingSemaphore;
-		auto res = vkQueueSubmit(tmp->mQueue, 1, &submitInfo, tmp->signalingFence);
-		if (res != VK_SUCCESS) {
-			return res;
+		VkResult res;
+		{
+			std::lock_guard<std::mutex> lock(tmp->mSubmitMtx);
+			res = vkQueueSubmit(tmp->mQueue, numBatches, batches, fence);
+			if (res != VK_SUCCESS) {
+				return res;
+			}
+			if (waiteFinished && fence == VK_NULL_HANDLE) {
+				return vkQueueWaitIdle(tmp->mQueue);
+			}
 		}
 		//
 		if (waiteFinished) {
-			res = vkQueueWaitIdle(tmp->mQueue);
+			res = vkWaitForFences(mLogicDevice, 1, &fence, VK_TRUE, UINT64_MAX);
 		}
 		//
 		return res;
 	}
+
+	VkResult VKLogicDevice::SignalSemaphore(ExcuteQueue* excuteQueue, VkSemaphore semaphore) {
+		//the signal of a batch waits for every command submitted to the queue before it
+		VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr };
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+		auto tmp = VKExcuteQueue::Cast(excuteQueue);
+		std::lock_guard<std::mutex> lock(tmp->mSubmitMtx);
+		return vkQueueSubmit(tmp->mQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
 }
\ No newline at end of file
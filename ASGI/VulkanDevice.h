@@ -1,18 +1,35 @@
 #pragma once
 #include <unordered_map>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "VulkanSDK\1.1.77.0\Include\vulkan\vulkan.h"
 #include "Resource.h"
+#include "VulkanCommand.h"
+#include "VulkanSync.h"
 
 namespace ASGI {
+	class VKQueueScheduler;
 	class VKExcuteQueue : public ExcuteQueue {
 		friend class VulkanGI;
 		friend class VKLogicDevice;
+		friend class VKQueueScheduler;
 	public:
 		static inline VKExcuteQueue* Cast(ExcuteQueue* excuteQueue) {
 			return (VKExcuteQueue*)excuteQueue;
 		}
 	public:
-		VKExcuteQueue(GraphicsContext* pcontext) : ExcuteQueue(pcontext) {}
+		VKExcuteQueue(GraphicsContext* pcontext) : ExcuteQueue(pcontext) {
+			mScheduler = nullptr;
+			mIdle = true;
+			mInReadyList = false;
+			mNumAcquires = 0;
+			mNumSubmissions = 0;
+			mNumBlockedAcquires = 0;
+			mBlockedTime = 0;
+		}
 		//
 		inline QueueType GetType() override {
 			return mType;
@@ -21,13 +38,183 @@ namespace ASGI {
 		inline  VkQueue GetVKQueue() {
 			return mQueue;
 		}
+
+		//the queue is externally synchronized, every vkQueueSubmit and vkQueuePresentKHR to it is made under this lock
+		//on whichever thread makes it
+		inline std::mutex& GetSubmitMutex() {
+			return mSubmitMtx;
+		}
 	private:
 		VkQueue mQueue;
+		std::mutex mSubmitMtx;
 		QueueType mType;
 		uint8_t familyIndex;
 		VkQueueFlags queueFlags;
-		VkSemaphore signalingSemaphore;
-		VkFence signalingFence;
+		//the submission made last to this queue, present and the next submission wait until it is handed to the queue
+		submission_ptr mLastSubmission;
+		//the scheduler of the queue type, the flags are changed under its lock. a queue that got busy stays in the ready list until it is popped
+		VKQueueScheduler* mScheduler;
+		bool mIdle;
+		bool mInReadyList;
+		std::atomic<uint64_t> mNumAcquires;
+		std::atomic<uint64_t> mNumSubmissions;
+		std::atomic<uint64_t> mNumBlockedAcquires;
+		//nanoseconds
+		std::atomic<uint64_t> mBlockedTime;
+	};
+
+	class VulkanGI;
+	//the submission is pending while its command buffers still have second command buffers being translated.
+	//mNumDependencies counts those command buffers plus one for SubmitCommands itself, the one that drops it to 0
+	//encodes the command buffers on its own thread, then submits them or queues them for the submit thread.
+	//a submitted submission owns the fence of its batch, the handle can be waited on until the GPU has finished it,
+	//and other submissions can be chained after it
+	class VKSubmission : public Submission {
+		friend class VulkanGI;
+	public:
+		static inline VKSubmission* Cast(Submission* submission) {
+			return (VKSubmission*)submission;
+		}
+
+		enum class State {
+			PENDING,
+			//encoded and queued to the submit thread, the command buffers can be recorded again
+			QUEUED,
+			SUBMITTED,
+			FAILED,
+		};
+	public:
+		VKSubmission(GraphicsContext* pcontext, VulkanGI* pGI) : Submission(pcontext) {
+			mGI = pGI;
+			mNumDependencies = 1;
+			mState = State::PENDING;
+			mExcuteQueue = nullptr;
+			mWaiteFinished = false;
+			mFence = VK_NULL_HANDLE;
+			mNumFenceWaiters = 0;
+			mRetired = false;
+		}
+
+		//defined in VulkanGI.cpp
+		void DependencyFinished();
+		//the sync objects not retired yet go back to the pool
+		~VKSubmission();
+		//the batch is on the queue and the GPU has finished it, a failed submission is finished too.
+		//the first call that sees it finished retires the fence and the semaphores the batch waited on to the pool,
+		//unless a thread still waits on the fence, the last of them retires them then
+		bool IsFinished();
+		//block until IsFinished, false if the submission failed or timeout ran out
+		bool WaiteFinished(uint64_t timeout = UINT64_MAX);
+
+		//block until the command buffers are encoded and the submission is on its way to the queue
+		inline void WaiteQueued() {
+			std::unique_lock<std::mutex> lk(mMtx);
+			mCond.wait(lk, [&] {return mState != State::PENDING; });
+		}
+
+		//block until the submission is handed to the queue, false if it failed
+		inline bool Waite() {
+			std::unique_lock<std::mutex> lk(mMtx);
+			mCond.wait(lk, [&] {return mState == State::SUBMITTED || mState == State::FAILED; });
+			return mState == State::SUBMITTED;
+		}
+
+		//the fence of the batch once it is handed to the queue, VK_NULL_HANDLE before that, for a failed submission and once
+		//the fence is retired. a fence returned here is not retired until RemoveFenceWaiter is called
+		inline VkFence AddFenceWaiter() {
+			std::lock_guard<std::mutex> lock(mMtx);
+			if (mState != State::SUBMITTED || mRetired) {
+				return VK_NULL_HANDLE;
+			}
+			++mNumFenceWaiters;
+			return mFence;
+		}
+
+		inline void RemoveFenceWaiter() {
+			std::lock_guard<std::mutex> lock(mMtx);
+			--mNumFenceWaiters;
+		}
+	private:
+		//the state only moves forward, the submit thread may finish the submission before QUEUED is set
+		inline void setState(State state) {
+			{
+				std::lock_guard<std::mutex> lock(mMtx);
+				if (state > mState) {
+					mState = state;
+				}
+			}
+			mCond.notify_all();
+		}
+		//called with mMtx held, the fence has signaled or the submission failed
+		void retire();
+	private:
+		VulkanGI* mGI;
+		std::atomic<int32_t> mNumDependencies;
+		std::mutex mMtx;
+		std::condition_variable mCond;
+		State mState;
+		//
+		VKExcuteQueue* mExcuteQueue;
+		std::vector<CommandBuffer*> mCmdBuffers;
+		//held until the submission is handed to the queue, a semaphore is signaled for each of them that runs on another queue
+		std::vector<submission_ptr> mWaiteSubmissions;
+		//the stage each of mWaiteSubmissions is waited at
+		std::vector<VkPipelineStageFlags> mWaiteStages;
+		//taken from the swapchains when the submission is made, the frame of a swapchain may move on before it reaches the queue
+		std::vector<VkSemaphore> mSwapchainSemaphores;
+		std::vector<VkSemaphore> mSignalSemaphores;
+		//every batch becomes one VkSubmitInfo, it takes the next entries of mCmdBuffers, mWaiteSubmissions,
+		//mSwapchainSemaphores, mSignalSemaphores and mUploads. waiteBatchMask has bit i set for every batch i it waits on
+		struct Batch {
+			uint32_t numCmdBuffers;
+			uint32_t numWaiteSubmissions;
+			uint32_t numSwapchainSemaphores;
+			uint32_t numSignalSemaphores;
+			uint32_t numUploads;
+			uint32_t waiteBatchMask;
+		};
+		std::vector<Batch> mBatches;
+		bool mWaiteFinished;
+		//captured when the command buffers are encoded, they may be recorded again before the submission reaches the queue
+		std::vector<VkCommandBuffer> mVkCmdBuffers;
+		std::vector<VKCmdBufferManager::CmdBufferItm*> mPinnedItems;
+		//the uploads of the transfer queue the command buffers use, collected once they are encoded
+		std::vector<upload_ptr> mUploads;
+		//signaled by the batch, and the pooled semaphores the batch waits on
+		VkFence mFence;
+		std::vector<VkSemaphore> mWaitedSemaphores;
+		//guarded by mMtx, the threads blocked on mFence outside of the lock
+		uint32_t mNumFenceWaiters;
+		bool mRetired;
+	};
+
+	//hands out the queues of one type. the queues whose last submission is known to be finished are kept in a ready list in the order
+	//they were found idle, Acquire takes the front one and moves it to the back so the submissions rotate over the idle queues.
+	//the fences of the busy queues are only polled once the ready list runs empty, Acquire then blocks on them until one is signaled
+	class VKQueueScheduler {
+	public:
+		VKQueueScheduler(VkDevice logicDevice);
+		void AddQueue(VKExcuteQueue* queue);
+		//nullptr if every queue is still busy after timeout in nanoseconds
+		VKExcuteQueue* Acquire(uint64_t timeout = UINT64_MAX);
+		//the queue leaves the ready list until the submission is finished
+		void SetLastSubmission(VKExcuteQueue* queue, Submission* submission);
+		//a reference to the submission made last to queue, taken under the lock SetLastSubmission writes it under
+		submission_ptr GetLastSubmission(VKExcuteQueue* queue);
+		//the queue Acquire handed out last, the first queue added before that
+		VKExcuteQueue* GetCurrent();
+		QueueStatistics GetStatistics(VKExcuteQueue* queue);
+	private:
+		//called with mMtx held. the next idle queue in the ready list, the busy ones in front of it are dropped
+		VKExcuteQueue* popReady();
+		//called with mMtx held. put the busy queues whose last submission is finished back into the ready list, false if there was none
+		bool refresh();
+	private:
+		VkDevice mLogicDevice;
+		std::mutex mMtx;
+		std::vector<VKExcuteQueue*> mQueues;
+		std::deque<VKExcuteQueue*> mReadyQueues;
+		VKExcuteQueue* mCurrentQueue = nullptr;
 	};
 	//
 	class VKLogicDevice {
@@ -46,48 +233,65 @@ namespace ASGI {
 			return mComputeQueueFamilyIndex;
 		}
 
-		inline VKExcuteQueue* GetIdleGraphicsQueue() {
-			for (auto &itr : mGraphicsQueues) {
-				if (vkGetFenceStatus(mLogicDevice, itr.second->signalingFence) == VK_SUCCESS) {
-					if (vkResetFences(mLogicDevice, 1, &itr.second->signalingFence) == VK_SUCCESS) {
-						return itr.second;
-					}
-				}
-			}
-			//
-			return nullptr; 
+		//a queue of a family that only copies, VK_NULL_HANDLE if the device has none
+		inline VkQueue GetTransferQueue() {
+			return mTransferQueue;
 		}
 
-		inline VKExcuteQueue* GetIdleComputeQueue() {
-			for (auto &itr : mComputeQueues) {
-				if (vkGetFenceStatus(mLogicDevice, itr.second->signalingFence) == VK_SUCCESS) {
-					if (vkResetFences(mLogicDevice, 1, &itr.second->signalingFence) == VK_SUCCESS) {
-						return itr.second;
-					}
-				}
-			}
-			//
-			return nullptr;
+		inline uint32_t GetTransferQueueFamilyIndex() {
+			return mTransferQueueFamilyIndex;
+		}
+
+		inline const VkPhysicalDeviceFeatures& GetEnabledFeatures() {
+			return mEnabledFeatures;
+		}
+
+		inline VKSyncPool* GetSyncPool() {
+			return mSyncPool;
+		}
+
+		//a queue is idle once the last submission made to it is finished, it can still take more submissions while it is busy.
+		//blocks until a queue of the type is idle, nullptr once timeout in nanoseconds ran out
+		inline VKExcuteQueue* GetIdleGraphicsQueue(uint64_t timeout = UINT64_MAX) {
+			return mGraphicsScheduler->Acquire(timeout);
+		}
+
+		//the graphics queue handed out last, busy or not. it doesn't block
+		inline VKExcuteQueue* GetCurrentGraphicsQueue() {
+			return mGraphicsScheduler->GetCurrent();
 		}
 
+		//the graphics queues when the device has no compute family
+		inline VKExcuteQueue* GetIdleComputeQueue(uint64_t timeout = UINT64_MAX) {
+			return mComputeScheduler->Acquire(timeout);
+		}
+
+		//the submissions are finished in queue order, the last one of each queue is waited on
 		inline void WaiteQueueFinished(uint32_t numWaiteQueue, ExcuteQueue** excuteQueues) {
-			std::vector<VkFence> fences(numWaiteQueue);
-			for (int i = 0; i < numWaiteQueue; ++i) {
-				fences[i] = mGraphicsQueues[(long long)VKExcuteQueue::Cast(excuteQueues[i])->mQueue]->signalingFence;
+			for (uint32_t i = 0; i < numWaiteQueue; ++i) {
+				auto tmp = VKExcuteQueue::Cast(excuteQueues[i]);
+				auto lastSubmission = tmp->mScheduler->GetLastSubmission(tmp);
+				if (lastSubmission != nullptr) {
+					VKSubmission::Cast(lastSubmission)->WaiteFinished();
+				}
 			}
-			//
-			vkWaitForFences(mLogicDevice, fences.size(), fences.data(), true, UINT64_MAX);
 		}
 
-		VkResult ExcuteCmdOnIdleGraphicsQueue(VkCommandBuffer* cmdBuffer, bool waiteFinished = true);
-		VkResult ExcuteCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false);
+		//every batch in one vkQueueSubmit, fence is signaled once all of them are finished
+		VkResult ExcuteCommands(ExcuteQueue* excuteQueue, uint32_t numBatches, const VkSubmitInfo* batches, VkFence fence, bool waiteFinished = false);
+		//a batch without command buffers, semaphore is signaled once the work submitted to the queue so far is finished
+		VkResult SignalSemaphore(ExcuteQueue* excuteQueue, VkSemaphore semaphore);
 	private:
 		VkPhysicalDevice mPhysicalDevice;
 		VkDevice mLogicDevice;
 		std::vector<VkQueueFamilyProperties> mQueueFamilys;
-		std::unordered_map<long long, VKExcuteQueue*> mGraphicsQueues;
-		std::unordered_map<long long, VKExcuteQueue*> mComputeQueues;
+		VKQueueScheduler* mGraphicsScheduler = nullptr;
+		VKQueueScheduler* mComputeScheduler = nullptr;
 		uint32_t mGraphicsQueueFamilyIndex;
 		uint32_t mComputeQueueFamilyIndex;
+		VkQueue mTransferQueue = VK_NULL_HANDLE;
+		uint32_t mTransferQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		VkPhysicalDeviceFeatures mEnabledFeatures;
+		VKSyncPool* mSyncPool;
 	};
 }
@@ -8,6 +8,7 @@
 #endif
 
 #include <iostream>
+#include <algorithm>
 
 #include "GraphicsContextManager.h"
 
@@ -160,6 +161,16 @@ namespace ASGI {
 		}
 		//
 		mCmdBufferManger = new VKCmdBufferManager(mLogicDevice.GetDevice(), mLogicDevice.GetGraphicsQueueFamilyIndex(), mLogicDevice.GetComputeQueueFamilyIndex());
+		//every upload writes its data into the ring, the chunks are created on the first upload
+		mStagingRing = new VKStagingRing(STAGING_RING_SIZE, MAX_STAGING_RING_SIZE);
+		//the uploads stay on the graphics queue without a transfer family
+		if (mLogicDevice.GetTransferQueue() != VK_NULL_HANDLE) {
+			mUploadEngine = new VKUploadEngine(mLogicDevice.GetDevice(), mLogicDevice.GetTransferQueue(), mLogicDevice.GetTransferQueueFamilyIndex(), mLogicDevice.GetGraphicsQueueFamilyIndex(), mLogicDevice.GetSyncPool(), mStagingRing);
+			if (!mUploadEngine->Init()) {
+				delete mUploadEngine;
+				mUploadEngine = nullptr;
+			}
+		}
 		return VKMemoryManager::Instance()->Init(mVkPhysicalDevice, mLogicDevice.GetDevice());
 	}
 
@@ -305,14 +316,46 @@ namespace ASGI {
 		return pres;
 	}
 
-	GraphicsPipeline* VulkanGI::CreateGraphicsPipeline(const GraphicsPipelineCreateInfo& create_info) {
+	//the Vulkan state of a GraphicsPipelineCreateInfo. pipelineCreateInfo points into the state, it is translated in place and never moved
+	struct VulkanGI::GraphicsPipelineState {
+		std::vector<VkVertexInputBindingDescription> vertex_input_binding_desc;
+		std::vector<VkVertexInputAttributeDescription> vertex_input_attribute_desc;
+		VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info;
+		VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info;
+		VkPipelineViewportStateCreateInfo viewport_state_create_info;
+		VkPipelineMultisampleStateCreateInfo multisample_state_create_info;
+		std::vector<VkPipelineColorBlendAttachmentState> color_blend_attachment_states;
+		VkPipelineColorBlendStateCreateInfo color_blend_state_create_info;
+		VkPipelineRasterizationStateCreateInfo pipeline_rasterization_state_create_info;
+		VkPipelineDepthStencilStateCreateInfo pipelineDepthStencilStateCreateInfo;
+		VkPipelineDynamicStateCreateInfo dynamic_state_creat_info;
+		std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+		VKGPUProgram* gpuProgram;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkGraphicsPipelineCreateInfo pipelineCreateInfo;
+		//
+		static const VkDynamicState sDynamicStates[9];
+		//
+		bool Translate(VkDevice device, const GraphicsPipelineCreateInfo& create_info);
+	};
+
+	const VkDynamicState VulkanGI::GraphicsPipelineState::sDynamicStates[9] = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR,
+		VK_DYNAMIC_STATE_LINE_WIDTH,
+		VK_DYNAMIC_STATE_DEPTH_BIAS,
+		VK_DYNAMIC_STATE_BLEND_CONSTANTS,
+		VK_DYNAMIC_STATE_DEPTH_BOUNDS,
+		VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK,
+		VK_DYNAMIC_STATE_STENCIL_WRITE_MASK,
+		VK_DYNAMIC_STATE_STENCIL_REFERENCE
+	};
+
+	bool VulkanGI::GraphicsPipelineState::Translate(VkDevice device, const GraphicsPipelineCreateInfo& create_info) {
 		if (create_info.shaderProgram == nullptr) {
-			return nullptr;
+			return false;
 		}
 		//
-		std::vector<VkVertexInputBindingDescription> vertex_input_binding_desc;
-		std::vector<VkVertexInputAttributeDescription> vertex_input_attribute_desc;
-
 		std::unordered_map<uint8_t, std::vector<VertexFormat> > vbos;
 		for (auto &vertexInput : create_info.vertexDeclaration.vertexInputs) {
 			vbos[vertexInput.bindingNumber].push_back(vertexInput.format);
@@ -337,7 +380,7 @@ namespace ASGI {
 			vertex_input_binding_desc.push_back(tmp);
 		}
 
-		VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {
+		vertex_input_state_create_info = {
 			VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
 			nullptr,
 			0,
@@ -347,7 +390,7 @@ namespace ASGI {
 			vertex_input_attribute_desc.data()
 		};
 		//
-		VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {
+		input_assembly_state_create_info = {
 			VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
 			nullptr,
 			0,
@@ -355,7 +398,7 @@ namespace ASGI {
 			create_info.inputAssemblyState.primitiveRestartEnable
 		};
 		//
-		VkPipelineViewportStateCreateInfo viewport_state_create_info = {
+		viewport_state_create_info = {
 			VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
 			nullptr,
 			0,
@@ -365,7 +408,7 @@ namespace ASGI {
 			nullptr //&dummyScissor
 		};
 		//
-		VkPipelineMultisampleStateCreateInfo multisample_state_create_info = {
+		multisample_state_create_info = {
 			VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,     // VkStructureType                                sType
 			nullptr,                                                          // const void                                    *pNext
 			0,                                                                  // VkPipelineMultisampleStateCreateFlags          flags
@@ -377,7 +420,6 @@ namespace ASGI {
 			VK_FALSE                                                      // VkBool32                                       alphaToOneEnable
 		};
 
-		std::vector<VkPipelineColorBlendAttachmentState> color_blend_attachment_states;
 		for (auto &itr : create_info.colorBlendState.Attachments) {
 			VkPipelineColorBlendAttachmentState tmp = {};
 			tmp.blendEnable = itr.blendEnable;
@@ -391,7 +433,7 @@ namespace ASGI {
 			color_blend_attachment_states.push_back(tmp);
 		}
 
-		VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = {
+		color_blend_state_create_info = {
 			VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,     // VkStructureType                                sType
 			nullptr,                                                                                                          // const void                                    *pNext
 			0,                                                                                                                   // VkPipelineColorBlendStateCreateFlags           flags
@@ -402,7 +444,7 @@ namespace ASGI {
 		};
 		memcpy(color_blend_state_create_info.blendConstants, create_info.colorBlendState.blendConstants, sizeof(float)*4);
 		//
-		VkPipelineRasterizationStateCreateInfo pipeline_rasterization_state_create_info = {};
+		pipeline_rasterization_state_create_info = {};
 		pipeline_rasterization_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 		pipeline_rasterization_state_create_info.polygonMode = (VkPolygonMode)create_info.rasterizationState.polygonMode;
 		pipeline_rasterization_state_create_info.cullMode = create_info.rasterizationState.cullMode;
@@ -412,7 +454,7 @@ namespace ASGI {
 		pipeline_rasterization_state_create_info.depthBiasEnable = create_info.rasterizationState.depthBiasEnable;
 		pipeline_rasterization_state_create_info.lineWidth = 1.0f;
 		//
-		VkPipelineDepthStencilStateCreateInfo pipelineDepthStencilStateCreateInfo = {};
+		pipelineDepthStencilStateCreateInfo = {};
 		pipelineDepthStencilStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 		pipelineDepthStencilStateCreateInfo.depthTestEnable = create_info.depthStencilState.depthTestEnable;
 		pipelineDepthStencilStateCreateInfo.depthWriteEnable = create_info.depthStencilState.depthWriteEnable;
@@ -436,27 +478,15 @@ namespace ASGI {
 		pipelineDepthStencilStateCreateInfo.front.writeMask = create_info.depthStencilState.front.writeMask;
 		pipelineDepthStencilStateCreateInfo.front.reference = create_info.depthStencilState.front.reference;
 		//
-		std::vector<VkDynamicState> dynamic_states = {
-			VK_DYNAMIC_STATE_VIEWPORT,
-			VK_DYNAMIC_STATE_SCISSOR,
-			VK_DYNAMIC_STATE_LINE_WIDTH,
-			VK_DYNAMIC_STATE_DEPTH_BIAS,
-			VK_DYNAMIC_STATE_BLEND_CONSTANTS,
-			VK_DYNAMIC_STATE_DEPTH_BOUNDS,
-			VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK,
-			VK_DYNAMIC_STATE_STENCIL_WRITE_MASK,
-			VK_DYNAMIC_STATE_STENCIL_REFERENCE
-		};
-		VkPipelineDynamicStateCreateInfo dynamic_state_creat_info = {
+		dynamic_state_creat_info = {
 			VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
 			nullptr,
 			0,
-			static_cast<uint32_t>(dynamic_states.size()),
-			dynamic_states.data()
+			static_cast<uint32_t>(sizeof(sDynamicStates) / sizeof(sDynamicStates[0])),
+			sDynamicStates
 		};
 		//
-		std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
-		auto gpuProgram = VKGPUProgram::Cast(create_info.shaderProgram);
+		gpuProgram = VKGPUProgram::Cast(create_info.shaderProgram);
 		if (gpuProgram->mVertexShader != nullptr) {
 			auto shaderModule = VKShaderModule::Cast(gpuProgram->mVertexShader);
 			//
@@ -508,18 +538,18 @@ namespace ASGI {
 			shaderStages.push_back(shaderStage);
 		}
 		//
-		VkPipelineLayout pipelineLayout;
 		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
 		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		pipelineLayoutCreateInfo.setLayoutCount = gpuProgram->mDescriptorSetLayouts.size();
 		pipelineLayoutCreateInfo.pSetLayouts = gpuProgram->mDescriptorSetLayouts.data();
 		pipelineLayoutCreateInfo.pushConstantRangeCount = gpuProgram->mPushConstantRanges.size();
 		pipelineLayoutCreateInfo.pPushConstantRanges = gpuProgram->mPushConstantRanges.data();
-		if (vkCreatePipelineLayout(mLogicDevice.GetDevice(), &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-			return nullptr;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+			pipelineLayout = VK_NULL_HANDLE;
+			return false;
 		}
 		//
-		VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
+		pipelineCreateInfo = {};
 		pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 		pipelineCreateInfo.flags = 0;
 		pipelineCreateInfo.layout = pipelineLayout;
@@ -538,18 +568,128 @@ namespace ASGI {
 		pipelineCreateInfo.pDynamicState = &dynamic_state_creat_info;
 		pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
 		pipelineCreateInfo.pStages = shaderStages.data();
-		//
-		VkPipeline graphicsPipeline;
-		if (vkCreateGraphicsPipelines(mLogicDevice.GetDevice(), nullptr, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-			return nullptr;
+		return true;
+	}
+
+	//CreateGraphicsPipelines split into chunks, the calling thread and the tasks pushed to the task queue claim the chunks until none is left
+	struct VulkanGI::PipelineBatch {
+		VulkanGI* pGI;
+		const GraphicsPipelineCreateInfo* createInfos;
+		VkPipeline* vkPipelines;
+		VkPipelineLayout* pipelineLayouts;
+		uint32_t numPipelines;
+		uint32_t numChunks;
+		std::atomic<uint32_t> nextChunk;
+		//tasks that have not returned yet, the batch lives on the stack of the calling thread
+		std::atomic<uint32_t> numRunningTasks;
+		std::mutex mtx;
+		std::condition_variable cond;
+		//
+		inline void Run() {
+			uint32_t chunk;
+			while ((chunk = nextChunk.fetch_add(1, std::memory_order_relaxed)) < numChunks) {
+				auto first = chunk * PIPELINE_CHUNK_SIZE;
+				auto count = numPipelines - first < PIPELINE_CHUNK_SIZE ? numPipelines - first : PIPELINE_CHUNK_SIZE;
+				pGI->compileGraphicsPipelines(count, createInfos + first, vkPipelines + first, pipelineLayouts + first);
+			}
 		}
-		//
-		auto pres = new VKGraphicsPipeline(GraphicsContextManager::Instance()->GetCurrentContext());
-		pres->mVkPipeLine = graphicsPipeline;
-		pres->mVkPipelineLayout = pipelineLayout;
-		pres->mGPUProgram = gpuProgram;
-		//
-		return pres;
+	};
+
+	void VulkanGI::compileGraphicsPipelinesTask(CommandBuffer* cmdBuffer, CommandBuffer* secondCmdBuffer, uintptr_t userData) {
+		auto pbatch = (PipelineBatch*)userData;
+		pbatch->Run();
+		if (pbatch->numRunningTasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			{
+				std::lock_guard<std::mutex> lock(pbatch->mtx);
+			}
+			pbatch->cond.notify_one();
+		}
+	}
+
+	void VulkanGI::compileGraphicsPipelines(uint32_t numPipelines, const GraphicsPipelineCreateInfo* createInfos, VkPipeline* vkPipelines, VkPipelineLayout* pipelineLayouts) {
+		auto device = mLogicDevice.GetDevice();
+		std::vector<GraphicsPipelineState> states(numPipelines);
+		std::vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos;
+		std::vector<uint32_t> indexes;
+		pipelineCreateInfos.reserve(numPipelines);
+		indexes.reserve(numPipelines);
+		for (uint32_t i = 0; i < numPipelines; ++i) {
+			if (states[i].Translate(device, createInfos[i])) {
+				pipelineCreateInfos.push_back(states[i].pipelineCreateInfo);
+				indexes.push_back(i);
+			}
+			else if (states[i].pipelineLayout != VK_NULL_HANDLE) {
+				vkDestroyPipelineLayout(device, states[i].pipelineLayout, nullptr);
+			}
+		}
+		if (pipelineCreateInfos.empty()) {
+			return;
+		}
+		//one driver call for the chunk
+		std::vector<VkPipeline> pipelines(pipelineCreateInfos.size(), VK_NULL_HANDLE);
+		auto res = vkCreateGraphicsPipelines(device, nullptr, (uint32_t)pipelineCreateInfos.size(), pipelineCreateInfos.data(), nullptr, pipelines.data());
+		for (size_t i = 0; i < indexes.size(); ++i) {
+			auto index = indexes[i];
+			//the pipelines a failed call did create are not reported one by one, the whole chunk fails
+			if (res != VK_SUCCESS) {
+				if (pipelines[i] != VK_NULL_HANDLE) {
+					vkDestroyPipeline(device, pipelines[i], nullptr);
+				}
+				vkDestroyPipelineLayout(device, states[index].pipelineLayout, nullptr);
+				continue;
+			}
+			vkPipelines[index] = pipelines[i];
+			pipelineLayouts[index] = states[index].pipelineLayout;
+		}
+	}
+
+	bool VulkanGI::CreateGraphicsPipelines(uint32_t numPipelines, const GraphicsPipelineCreateInfo* createInfos, GraphicsPipeline** pipelines) {
+		std::vector<VkPipeline> vkPipelines(numPipelines, VK_NULL_HANDLE);
+		std::vector<VkPipelineLayout> pipelineLayouts(numPipelines, VK_NULL_HANDLE);
+		auto numChunks = (numPipelines + PIPELINE_CHUNK_SIZE - 1) / PIPELINE_CHUNK_SIZE;
+		if (mCmdBufferTaskQueue == nullptr || numChunks <= 1) {
+			compileGraphicsPipelines(numPipelines, createInfos, vkPipelines.data(), pipelineLayouts.data());
+		}
+		else {
+			PipelineBatch batch;
+			batch.pGI = this;
+			batch.createInfos = createInfos;
+			batch.vkPipelines = vkPipelines.data();
+			batch.pipelineLayouts = pipelineLayouts.data();
+			batch.numPipelines = numPipelines;
+			batch.numChunks = numChunks;
+			batch.nextChunk = 0;
+			batch.numRunningTasks = numChunks - 1;
+			for (uint32_t i = 0; i + 1 < numChunks; ++i) {
+				mCmdBufferTaskQueue->PushTask(CmdBufferTask(nullptr, nullptr, compileGraphicsPipelinesTask, (uintptr_t)&batch));
+			}
+			//the calling thread compiles chunks until none is left unclaimed, it only waits for the chunks the tasks already took.
+			//the tasks still have to be run by the queue to return, that is why this must not be called from one of its tasks
+			batch.Run();
+			std::unique_lock<std::mutex> lk(batch.mtx);
+			batch.cond.wait(lk, [&] {return batch.numRunningTasks.load(std::memory_order_acquire) == 0; });
+		}
+		//the resources are made on this thread, it owns the current context
+		bool res = true;
+		for (uint32_t i = 0; i < numPipelines; ++i) {
+			if (vkPipelines[i] == VK_NULL_HANDLE) {
+				pipelines[i] = nullptr;
+				res = false;
+				continue;
+			}
+			auto pres = new VKGraphicsPipeline(GraphicsContextManager::Instance()->GetCurrentContext());
+			pres->mVkPipeLine = vkPipelines[i];
+			pres->mVkPipelineLayout = pipelineLayouts[i];
+			pres->mGPUProgram = VKGPUProgram::Cast(createInfos[i].shaderProgram);
+			pipelines[i] = pres;
+		}
+		return res;
+	}
+
+	GraphicsPipeline* VulkanGI::CreateGraphicsPipeline(const GraphicsPipelineCreateInfo& create_info) {
+		GraphicsPipeline* pipeline = nullptr;
+		CreateGraphicsPipelines(1, &create_info, &pipeline);
+		return pipeline;
 	}
 
 	Swapchain* VulkanGI::CreateSwapchain(const SwapchainCreateInfo& create_info) {
@@ -640,6 +780,10 @@ namespace ASGI {
 		// The VK_PRESENT_MODE_FIFO_KHR mode must always be present as per spec
 		// This mode waits for the vertical blank ("v-sync")
 		mSwapchain->mVkPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+		//the sync objects of every slot are created with the swapchain, only the first numFramesInFlight are used
+		if (create_info.numFramesInFlight > 0) {
+			mSwapchain->mNumFramesInFlight = create_info.numFramesInFlight < VKSwapchain::MAX_FRAMES_IN_FLIGHT ? create_info.numFramesInFlight : VKSwapchain::MAX_FRAMES_IN_FLIGHT;
+		}
 
 		// If v-sync is not requested, try to find a mailbox mode
 		// It's the lowest latency non-tearing present mode available
@@ -749,6 +893,11 @@ namespace ASGI {
 		std::vector<VkImageView> imageViews(numAttachment);
 		for (int i = 0; i < numAttachment; ++i) {
 			imageViews[i] = VKImageView::Cast(attachments[i])->mImageView;
+			//an attachment keeps what it was rendered to, it is never uploaded on the transfer queue
+			auto srcImage = VKImageView::Cast(attachments[i])->mSrcImage->asImage2D();
+			if (srcImage != nullptr) {
+				VKImage2D::Cast(srcImage)->mInUse.store(true, std::memory_order_relaxed);
+			}
 		}
 		//
 		VkFramebufferCreateInfo frameBufferCreateInfo = {};
@@ -803,6 +952,7 @@ namespace ASGI {
 		if (VKMemoryManager::Instance()->CreateBuffer(bufferInfo, &pres->mVkBuffer, memoryUsage, pres->mMemory) != VK_SUCCESS) {
 			return false;
 		}
+		pres->mVkUsageFlags = usageFlags;
 		//
 		return true;
 	}
@@ -835,63 +985,192 @@ namespace ASGI {
 			return true;
 		}
 		//
-		VkBufferCreateInfo vbInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-		vbInfo.size = size;
-		vbInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		vbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-		VkBuffer stagingBuffer = VK_NULL_HANDLE;
-		VKMemory* pmemory = nullptr;
-		if (VKMemoryManager::Instance()->CreateBuffer(vbInfo, &stagingBuffer, VKMemory::MemoryUsage::VK_MEMORY_USAGE_CPU_ONLY, pmemory) != VK_SUCCESS) {
+		VKStaging staging;
+		if (!allocateStaging(size, VKStagingRing::BUFFER_ALIGNMENT, staging)) {
 			return false;
 		}
+		memcpy(staging.pdata, pdata, size);
 		//
-		void* pbuffer = nullptr;
-		VKMemoryManager::Instance()->MapMemory(pmemory, &pbuffer);
-		memcpy(pbuffer, pdata, size);
-		VKMemoryManager::Instance()->UnMapMemory(pmemory);
+		VkBufferCopy vbCopyRegion = {};
+		vbCopyRegion.srcOffset = staging.offset;
+		vbCopyRegion.dstOffset = offset;
+		vbCopyRegion.size = size;
+		//a buffer the graphics family has not used yet is copied on the transfer queue, the engine takes the staging range
+		if (mUploadEngine != nullptr && !buffer->mInUse.load(std::memory_order_relaxed)) {
+			auto upload = mUploadEngine->CopyBuffer(buffer->mPendingUpload, staging, buffer->mVkBuffer, vbCopyRegion, getBufferDstStage(buffer->mUsageFlags));
+			if (upload != nullptr) {
+				buffer->mPendingUpload = upload;
+				return true;
+			}
+		}
 		//
 		if (!BeginSingleTimeCommands()) {
-			VKMemoryManager::Instance()->DestoryBuffer(stagingBuffer, pmemory);
+			mStagingRing->Release(staging);
 			return false;
 		}
 		//
-		VkBufferCopy vbCopyRegion = {};
-		vbCopyRegion.srcOffset = 0;
-		vbCopyRegion.dstOffset = offset;
-		vbCopyRegion.size = size;
-		vkCmdCopyBuffer(mCmdBufferManger->GetUpLoadCmdBuffer(), stagingBuffer, buffer->mVkBuffer, 1, &vbCopyRegion);
+		acquireUpload(buffer->mPendingUpload);
+		buffer->mInUse.store(true, std::memory_order_relaxed);
+		vkCmdCopyBuffer(mCmdBufferManger->GetUpLoadCmdBuffer(), staging.buffer, buffer->mVkBuffer, 1, &vbCopyRegion);
 		//
-		auto res = EndSingleTimeCommands();
-		VKMemoryManager::Instance()->DestoryBuffer(stagingBuffer, pmemory);
+		auto psubmission = EndSingleTimeCommands(1, &staging);
+		if (psubmission == nullptr) {
+			return false;
+		}
+		buffer->mPendingCopy = psubmission;
 		//
-		return res;
+		return true;
+	}
+
+	bool VulkanGI::allocateStaging(uint64_t size, uint64_t alignment, VKStaging& staging) {
+		//the ranges of the finished transfer batches are released first, the ring wraps around instead of growing
+		if (mUploadEngine != nullptr) {
+			mUploadEngine->Recycle();
+		}
+		recycleSingleTimeCommands();
+		return mStagingRing->Allocate(size, alignment, staging);
 	}
 
 	bool VulkanGI::BeginSingleTimeCommands() {
+		recycleSingleTimeCommands();
+		//
 		VkCommandBufferBeginInfo cmdBufBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
 		cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		if (vkBeginCommandBuffer(mCmdBufferManger->GetUpLoadCmdBuffer(), &cmdBufBeginInfo) == VK_SUCCESS) {
-			return true;
+		if (vkBeginCommandBuffer(mCmdBufferManger->GetUpLoadCmdBuffer(), &cmdBufBeginInfo) != VK_SUCCESS) {
+			return false;
 		}
+		//the queue is not idle, the copies wait for the work submitted to it before
+		VkMemoryBarrier memoryBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		memoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(mCmdBufferManger->GetUpLoadCmdBuffer(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			1, &memoryBarrier, 0, nullptr, 0, nullptr);
 		//
-		return false;
+		return true;
 	}
 
-	bool VulkanGI::EndSingleTimeCommands() {
-		vkEndCommandBuffer(mCmdBufferManger->GetUpLoadCmdBuffer());
-		//
+	VKSubmission* VulkanGI::EndSingleTimeCommands(uint32_t numStagings, VKStaging* pstagings) {
 		auto cmdBuffer = mCmdBufferManger->GetUpLoadCmdBuffer();
-		if (mLogicDevice.ExcuteCmdOnIdleGraphicsQueue(&cmdBuffer, true) != VK_SUCCESS) {
-			return false;
+		//the copies are made visible to the work submitted to the queue after them, nothing waits for them on the host
+		VkMemoryBarrier memoryBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+			1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS) {
+			for (uint32_t i = 0; i < numStagings; ++i) {
+				mStagingRing->Release(pstagings[i]);
+			}
+			return nullptr;
 		}
 		//
-		return true;
+		//a submission of one batch on the current graphics queue, it goes to the queue like the ones of SubmitBatches.
+		//the queue runs it behind the frames in flight, the host goes on recording into another upload command buffer
+		auto tmp = mLogicDevice.GetCurrentGraphicsQueue();
+		auto lastSubmission = tmp->mScheduler->GetLastSubmission(tmp);
+		if (lastSubmission != nullptr) {
+			VKSubmission::Cast(lastSubmission)->WaiteQueued();
+		}
+		submission_ptr submission = new VKSubmission(tmp->GetContext(), this);
+		auto psubmission = VKSubmission::Cast(submission);
+		psubmission->mExcuteQueue = tmp;
+		VKSubmission::Batch batch = {};
+		batch.numCmdBuffers = 1;
+		psubmission->mBatches.push_back(batch);
+		psubmission->mVkCmdBuffers.push_back(cmdBuffer);
+		psubmission->ref();
+		tmp->mScheduler->SetLastSubmission(tmp, submission);
+		if (mSubmitThread != nullptr) {
+			VKSubmitThread::Packet packet;
+			packet.type = VKSubmitThread::PACKET_SUBMIT;
+			packet.submission = psubmission;
+			packet.excuteQueue = tmp;
+			packet.numSwapchains = 0;
+			packet.frameIndex = 0;
+			mSubmitThread->Push(packet);
+			psubmission->setState(VKSubmission::State::QUEUED);
+		}
+		else {
+			submitQueued(psubmission);
+		}
+		//
+		SingleTimeCommands itm;
+		itm.cmdBuffer = cmdBuffer;
+		itm.submission = submission;
+		itm.stagings.assign(pstagings, pstagings + numStagings);
+		//without another command buffer for the next upload this one is waited for
+		if (!mCmdBufferManger->NextUpLoadCmdBuffer()) {
+			auto res = psubmission->WaiteFinished();
+			for (auto &staging : itm.stagings) {
+				mStagingRing->Release(staging);
+			}
+			return res ? psubmission : nullptr;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mSingleTimeMtx);
+			mSingleTimeInFlight.push_back(std::move(itm));
+		}
+		//a submission made on this thread has failed already, the one of the submit thread fails later
+		if (mSubmitThread == nullptr && !psubmission->Waite()) {
+			return nullptr;
+		}
+		return psubmission;
+	}
+
+	void VulkanGI::recycleSingleTimeCommands() {
+		std::lock_guard<std::mutex> lock(mSingleTimeMtx);
+		for (size_t i = 0; i < mSingleTimeInFlight.size();) {
+			auto &itm = mSingleTimeInFlight[i];
+			if (!VKSubmission::Cast(itm.submission)->IsFinished()) {
+				++i;
+				continue;
+			}
+			for (auto &staging : itm.stagings) {
+				mStagingRing->Release(staging);
+			}
+			mCmdBufferManger->FreeUpLoadCmdBuffer(itm.cmdBuffer);
+			itm = std::move(mSingleTimeInFlight.back());
+			mSingleTimeInFlight.pop_back();
+		}
+	}
+
+	void VulkanGI::acquireUpload(VKUpload* upload) {
+		//a submission may have taken it over already
+		if (upload == nullptr || !upload->Claim()) {
+			return;
+		}
+		//the single time commands are submitted without waits, the semaphore of the upload is left alone
+		if (mUploadEngine->WaiteFinished(upload)) {
+			upload->RecordAcquire(mCmdBufferManger->GetUpLoadCmdBuffer());
+		}
+	}
+
+	VkPipelineStageFlags VulkanGI::getBufferDstStage(BufferUsageFlags usageFlags) {
+		//a buffer the shaders read may be read by any of them
+		if (usageFlags & (BufferUsageFlagBits::BUFFER_USAGE_UNIFORM_BIT | BufferUsageFlagBits::BUFFER_USAGE_STORAGE_BIT |
+			BufferUsageFlagBits::BUFFER_USAGE_UNIFORM_TEXEL_BIT | BufferUsageFlagBits::BUFFER_USAGE_STORAGE_TEXEL_BIT)) {
+			return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		}
+		VkPipelineStageFlags stageFlags = 0;
+		if (usageFlags & (BufferUsageFlagBits::BUFFER_USAGE_INDEX_BIT | BufferUsageFlagBits::BUFFER_USAGE_VERTEX_BIT)) stageFlags |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		if (usageFlags & BufferUsageFlagBits::BUFFER_USAGE_INDIRECT_BIT) stageFlags |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+		return stageFlags != 0 ? stageFlags : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	}
+
+	VkPipelineStageFlags VulkanGI::getWaiteStage(VKExcuteQueue* excuteQueue, PipelineStageFlags stageFlags) {
+		VkPipelineStageFlags waiteStage = stageFlags;
+		//a compute or transfer queue has no graphics stages, a wait mask with them is invalid there
+		if ((excuteQueue->queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0) {
+			waiteStage &= VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+				VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		}
+		return waiteStage != 0 ? waiteStage : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
 	}
 
 	Buffer* VulkanGI::CreateBuffer(uint64_t size, BufferUsageFlags usageFlags) {
 		auto pres = new  VKBuffer(GraphicsContextManager::Instance()->GetCurrentContext(), usageFlags, size);
-		VkBufferUsageFlags bufferUsageFlags = 0;
+		//while capture is enabled every buffer can be copied from, CaptureCmdBuffer reads the device local buffers back
+		VkBufferUsageFlags bufferUsageFlags = mCaptureEnabled ? VK_BUFFER_USAGE_TRANSFER_SRC_BIT : 0;
 		if (usageFlags & BufferUsageFlagBits::BUFFER_USAGE_TRANSFER_SRC_BIT) bufferUsageFlags |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 		if (usageFlags & BufferUsageFlagBits::BUFFER_USAGE_TRANSFER_DST_BIT) bufferUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 		if(usageFlags & BufferUsageFlagBits::BUFFER_USAGE_INDEX_BIT) bufferUsageFlags |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
@@ -931,60 +1210,87 @@ namespace ASGI {
 	}
 
 	bool VulkanGI::EndUpdateBuffer(BufferUpdateContext* pUpdateContext) {
-		std::vector<std::array<void*, 5> >copys(((VKBufferUpdateContext*)pUpdateContext)->updates.size());
-		//
-		int index = 0;
-		for (auto &itm : ((VKBufferUpdateContext*)pUpdateContext)->updates) {
-			VkBufferCreateInfo vbInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-			vbInfo.size = itm.size;
-			vbInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			vbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-			VkBuffer stagingBuffer = VK_NULL_HANDLE;
-			VKMemory* pmemory = nullptr;
-			if (VKMemoryManager::Instance()->CreateBuffer(vbInfo, &stagingBuffer, VKMemory::MemoryUsage::VK_MEMORY_USAGE_CPU_ONLY, pmemory) != VK_SUCCESS) {
+		auto &updates = ((VKBufferUpdateContext*)pUpdateContext)->updates;
+		std::vector<std::pair<VKBufferUpdateContext::UpdateItem*, VKStaging> > copys;
+		copys.reserve(updates.size());
+		for (auto &itm : updates) {
+			VKStaging staging;
+			if (!allocateStaging(itm.size, VKStagingRing::BUFFER_ALIGNMENT, staging)) {
 				continue;
 			}
+			memcpy(staging.pdata, itm.pdata, itm.size);
+			//same as updateBuffer, the copies of the buffers not used yet go to the transfer queue
+			if (mUploadEngine != nullptr && !itm.dstBuffer->mInUse.load(std::memory_order_relaxed)) {
+				VkBufferCopy vbCopyRegion = {};
+				vbCopyRegion.srcOffset = staging.offset;
+				vbCopyRegion.dstOffset = itm.offset;
+				vbCopyRegion.size = itm.size;
+				auto upload = mUploadEngine->CopyBuffer(itm.dstBuffer->mPendingUpload, staging, itm.dstBuffer->mVkBuffer, vbCopyRegion, getBufferDstStage(itm.dstBuffer->mUsageFlags));
+				if (upload != nullptr) {
+					itm.dstBuffer->mPendingUpload = upload;
+					continue;
+				}
+			}
 			//
-			void* pbuffer = nullptr;
-			VKMemoryManager::Instance()->MapMemory(pmemory, &pbuffer);
-			memcpy(pbuffer, itm.pdata, itm.size);
-			VKMemoryManager::Instance()->UnMapMemory(pmemory);
-			//
-			copys[index][0] = itm.dstBuffer;
-			copys[index][1] = stagingBuffer;
-			copys[index][2] = pmemory;
-			copys[index][3] = (void*)itm.offset;
-			copys[index][4] = (void*)itm.size;
-			++index;
+			copys.push_back(std::make_pair(&itm, staging));
+		}
+		if (copys.empty()) {
+			return true;
 		}
 		//
 		if (!BeginSingleTimeCommands()) {
+			for (auto & itm : copys) {
+				mStagingRing->Release(itm.second);
+			}
 			return false;
 		}
 		//
+		std::vector<VKStaging> stagings;
+		stagings.reserve(copys.size());
+		for (auto & itm : copys) {
+			auto dstBuffer = itm.first->dstBuffer;
+			acquireUpload(dstBuffer->mPendingUpload);
+			dstBuffer->mInUse.store(true, std::memory_order_relaxed);
+			stagings.push_back(itm.second);
+		}
 		for (auto & itm : copys) {
 			VkBufferCopy vbCopyRegion = {};
-			vbCopyRegion.srcOffset = 0;
-			vbCopyRegion.dstOffset = (uint32_t)itm[3];
-			vbCopyRegion.size =(uint32_t)itm[4];
-			vkCmdCopyBuffer(mCmdBufferManger->GetUpLoadCmdBuffer(), (VkBuffer)itm[1], ((VKBuffer*)(itm[0]))->mVkBuffer, 1, &vbCopyRegion);
+			vbCopyRegion.srcOffset = itm.second.offset;
+			vbCopyRegion.dstOffset = itm.first->offset;
+			vbCopyRegion.size = itm.first->size;
+			vkCmdCopyBuffer(mCmdBufferManger->GetUpLoadCmdBuffer(), itm.second.buffer, itm.first->dstBuffer->mVkBuffer, 1, &vbCopyRegion);
 		}
 		//
-		auto res = EndSingleTimeCommands();
-		//
+		auto psubmission = EndSingleTimeCommands((uint32_t)stagings.size(), stagings.data());
+		if (psubmission == nullptr) {
+			return false;
+		}
 		for (auto & itm : copys) {
-			VKMemory* pmemory = (VKMemory*)std::move(itm[2]);
-			VKMemoryManager::Instance()->DestoryBuffer((VkBuffer)itm[1], pmemory);
+			itm.first->dstBuffer->mPendingCopy = psubmission;
 		}
 		//
-		return res;
+		return true;
 	}
 
 	void VulkanGI::UpdateBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, void* pdata, BufferUpdateContext* pUpdateContext) {
 		updateBuffer((VKBuffer*)pbuffer, offset, size, pdata, pUpdateContext);
 	}
 
+	bool VulkanGI::WaitBufferUpdated(Buffer* pbuffer) {
+		//the batches of the transfer queue finish in order, and so do the single time commands on the graphics queue
+		auto buffer = VKBuffer::Cast(pbuffer);
+		auto upload = buffer->mPendingUpload;
+		auto copy = buffer->mPendingCopy;
+		bool res = true;
+		if (mUploadEngine != nullptr && upload != nullptr) {
+			res = mUploadEngine->WaiteFinished(upload.get());
+		}
+		if (copy != nullptr) {
+			res = VKSubmission::Cast(copy)->WaiteFinished() && res;
+		}
+		return res;
+	}
+
 	void* VulkanGI::MapBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, MapMode mapMode) {
 		return nullptr;
 	}
@@ -1012,6 +1318,12 @@ namespace ASGI {
 		writeDescriptorSet.descriptorCount = 1;
 		//
 		vkUpdateDescriptorSets(mLogicDevice.GetDevice(), 1, &writeDescriptorSet, 0, NULL);
+		VKCommandBuffer::InvalidateEncodedCommands();
+		//the command buffers that bind the program take the buffer over from the transfer queue
+		uniformBuffer->mInUse.store(true, std::memory_order_relaxed);
+		if (uniformBuffer->mPendingUpload != nullptr) {
+			gpuProgram->AddUpload(uniformBuffer->mPendingUpload);
+		}
 	}
 
 	VkImageAspectFlags getImageAspectFlags(Format format, ImageUsageFlags usageFlags) {
@@ -1125,27 +1437,13 @@ namespace ASGI {
 		if (pUpdateContext != nullptr) {
 
 		}
-		//
-		VkBufferCreateInfo vbInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-		vbInfo.size = sizeX*sizeY*GetFormatSize(pimg->GetFormat());
-		vbInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		vbInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-		VkBuffer stagingBuffer = VK_NULL_HANDLE;
-		VKMemory* pmemory = nullptr;
-		if (VKMemoryManager::Instance()->CreateBuffer(vbInfo, &stagingBuffer, VKMemory::MemoryUsage::VK_MEMORY_USAGE_CPU_ONLY, pmemory) != VK_SUCCESS) {
-			return false;
-		}
-		//
-		void* pbuffer = nullptr;
-		VKMemoryManager::Instance()->MapMemory(pmemory, &pbuffer);
-		memcpy(pbuffer, pdata, vbInfo.size);
-		VKMemoryManager::Instance()->UnMapMemory(pmemory);
-		//
-		if (!BeginSingleTimeCommands()) {
-			VKMemoryManager::Instance()->DestoryBuffer(stagingBuffer, pmemory);
+		//the offset of an image copy is a multiple of the texel size and of 4
+		auto formatSize = GetFormatSize(pimg->GetFormat());
+		VKStaging staging;
+		if (!allocateStaging(sizeX*sizeY*formatSize, formatSize * 4, staging)) {
 			return false;
 		}
+		memcpy(staging.pdata, pdata, sizeX*sizeY*formatSize);
 		//
 		VkBufferImageCopy bufferCopyRegion = {};
 		bufferCopyRegion.imageSubresource.aspectMask = ((VKImageView*)(pimg->GetOrigView()))->mViewInfo.subresourceRange.aspectMask;
@@ -1155,7 +1453,7 @@ namespace ASGI {
 		bufferCopyRegion.imageExtent.width = sizeX;
 		bufferCopyRegion.imageExtent.height = sizeY;
 		bufferCopyRegion.imageExtent.depth = 1;
-		bufferCopyRegion.bufferOffset = 0;
+		bufferCopyRegion.bufferOffset = staging.offset;
 		//
 		VkImageSubresourceRange subresourceRange = {};
 		// Image only contains color data
@@ -1166,6 +1464,27 @@ namespace ASGI {
 		subresourceRange.levelCount = 1;
 		// The 2D texture only has one layer
 		subresourceRange.layerCount = 1;
+		//an image the graphics family has not used yet is copied on the transfer queue and released in the layout it is read in
+		auto vkImage = (VKImage2D*)pimg;
+		if (mUploadEngine != nullptr && !vkImage->mInUse.load(std::memory_order_relaxed)) {
+			auto layoutBarrier = (subresourceRange.aspectMask & VkImageAspectFlagBits::VK_IMAGE_ASPECT_COLOR_BIT) != 0 ? VKImageLayoutBarrier::PixelShaderRead : VKImageLayoutBarrier::PixelDepthStencilRead;
+			VkAccessFlags finalAccess;
+			VkImageLayout finalLayout;
+			auto dstStage = GetImageBarrierFlags(layoutBarrier, finalAccess, finalLayout);
+			auto upload = mUploadEngine->CopyBufferToImage(vkImage->mPendingUpload, staging, vkImage->mVkImage, bufferCopyRegion, finalLayout, finalAccess, dstStage);
+			if (upload != nullptr) {
+				vkImage->mPendingUpload = upload;
+				vkImage->mLayoutBarrier[level] = layoutBarrier;
+				return true;
+			}
+		}
+		//
+		if (!BeginSingleTimeCommands()) {
+			mStagingRing->Release(staging);
+			return false;
+		}
+		acquireUpload(vkImage->mPendingUpload);
+		vkImage->mInUse.store(true, std::memory_order_relaxed);
 
 		// Transition the texture image layout to transfer target, so we can safely copy our buffer data to it.
 		VkImageMemoryBarrier imageMemoryBarrier{};
@@ -1191,7 +1510,7 @@ namespace ASGI {
 		//
 		vkCmdCopyBufferToImage(
 			mCmdBufferManger->GetUpLoadCmdBuffer(),
-			stagingBuffer,
+			staging.buffer,
 			((VKImage2D*)pimg)->mVkImage,
 			imageMemoryBarrier.newLayout,
 			1,
@@ -1216,13 +1535,7 @@ namespace ASGI {
 			0, nullptr,
 			1, &imageMemoryBarrier);
 		//
-		if (!EndSingleTimeCommands()) {
-			VKMemoryManager::Instance()->DestoryBuffer(stagingBuffer, pmemory);
-			return false;
-		}
-		//
-		VKMemoryManager::Instance()->DestoryBuffer(stagingBuffer, pmemory);
-		return true;
+		return EndSingleTimeCommands(1, &staging) != nullptr;
 	}
 
 	Sampler* VulkanGI::CreateSampler(float minLod, float maxLod, float  mipLodBias,
@@ -1285,85 +1598,673 @@ namespace ASGI {
 		writeDescriptorSet.descriptorCount = 1;
 		//
 		vkUpdateDescriptorSets(mLogicDevice.GetDevice(), 1, &writeDescriptorSet, 0, NULL);
+		VKCommandBuffer::InvalidateEncodedCommands();
+		//same as BindUniformBuffer
+		auto srcImage = imageView->mSrcImage->asImage2D();
+		if (srcImage != nullptr) {
+			auto vkImage = VKImage2D::Cast(srcImage);
+			vkImage->mInUse.store(true, std::memory_order_relaxed);
+			if (vkImage->mPendingUpload != nullptr) {
+				gpuProgram->AddUpload(vkImage->mPendingUpload);
+			}
+		}
 	}
 
-	ExcuteQueue* VulkanGI::AcquireExcuteQueue(QueueType queueType) {
+	ExcuteQueue* VulkanGI::AcquireExcuteQueue(QueueType queueType, uint64_t timeout) {
 		if (queueType == QueueType::QUEUE_TYPE_GRAPHICS) {
-			return mLogicDevice.GetIdleGraphicsQueue();
+			return mLogicDevice.GetIdleGraphicsQueue(timeout);
 		}
 		else if (queueType == QueueType::QUEUE_TYPE_COMPUTE) {
-			return mLogicDevice.GetIdleComputeQueue();
+			return mLogicDevice.GetIdleComputeQueue(timeout);
 		}
 		//
 		return nullptr;
 	}
 
+	QueueStatistics VulkanGI::GetQueueStatistics(ExcuteQueue* excuteQueue) {
+		auto tmp = VKExcuteQueue::Cast(excuteQueue);
+		return tmp->mScheduler->GetStatistics(tmp);
+	}
+
 	void VulkanGI::WaitQueueExcuteFinished(uint32_t numWaiteQueue, ExcuteQueue** excuteQueues) {
+		for (uint32_t i = 0; i < numWaiteQueue; ++i) {
+			auto tmp = VKExcuteQueue::Cast(excuteQueues[i]);
+			auto lastSubmission = tmp->mScheduler->GetLastSubmission(tmp);
+			if (lastSubmission != nullptr) {
+				VKSubmission::Cast(lastSubmission)->Waite();
+			}
+		}
 		mLogicDevice.WaiteQueueFinished(numWaiteQueue, excuteQueues);
 	}
 
-	bool VulkanGI::SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished) {
-		if (mCmdBufferTaskQueue != nullptr) {
-			for (uint32_t i = 0; i < numBuffers; ++i) {
-				auto tmp = VKCommandBuffer::Cast(cmdBuffers[i]);
-				std::unique_lock<std::mutex> lk(tmp->mMtxSecondCmdBuffer);
-				tmp->mCond.wait(lk, [&] {return tmp->mUnExcuteSecondCmdBufferCount == 0; });
+	Submission* VulkanGI::SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished) {
+		//waiting on a queue is waiting on the last submission made to it, the references keep them until they are chained
+		std::vector<submission_ptr> lastSubmissions;
+		std::vector<Submission*> waiteSubmissions;
+		for (uint32_t i = 0; i < numWaiteQueue; ++i) {
+			auto tmp = VKExcuteQueue::Cast(waiteQueues[i]);
+			auto lastSubmission = tmp->mScheduler->GetLastSubmission(tmp);
+			if (lastSubmission != nullptr) {
+				lastSubmissions.push_back(lastSubmission);
+				waiteSubmissions.push_back(lastSubmission.get());
+			}
+		}
+		return SubmitCommandsAfter(excuteQueue, numBuffers, cmdBuffers, (uint32_t)waiteSubmissions.size(), waiteSubmissions.data(), numSwapchain, waiteSwapchains, waiteFinished);
+	}
+
+	Submission* VulkanGI::SubmitCommandsAfter(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteSubmission, Submission** waiteSubmissions, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished) {
+		SubmitBatch batch;
+		batch.numCmdBuffers = numBuffers;
+		batch.cmdBuffers = cmdBuffers;
+		batch.waiteBatchMask = 0;
+		batch.numWaiteSubmission = numWaiteSubmission;
+		batch.waiteSubmissions = waiteSubmissions;
+		batch.waiteStages = nullptr;
+		batch.numSwapchain = numSwapchain;
+		batch.waiteSwapchains = waiteSwapchains;
+		return SubmitBatches(excuteQueue, 1, &batch, waiteFinished);
+	}
+
+	Submission* VulkanGI::SubmitBatches(ExcuteQueue* excuteQueue, uint32_t numBatches, const SubmitBatch* batches, bool waiteFinished) {
+		if (numBatches == 0 || numBatches > MAX_SUBMIT_BATCHES) {
+			return nullptr;
+		}
+		auto tmp = VKExcuteQueue::Cast(excuteQueue);
+		//submissions to the same queue are handed to it in order, and a semaphore is only signaled for a submission already handed to its queue.
+		//the submit thread keeps the order the submissions are queued in
+		auto lastSubmission = tmp->mScheduler->GetLastSubmission(tmp);
+		if (lastSubmission != nullptr) {
+			VKSubmission::Cast(lastSubmission)->WaiteQueued();
+		}
+		for (uint32_t i = 0; i < numBatches; ++i) {
+			for (uint32_t k = 0; k < batches[i].numWaiteSubmission; ++k) {
+				VKSubmission::Cast(batches[i].waiteSubmissions[k])->WaiteQueued();
 			}
 		}
 		//
+		submission_ptr submission = new VKSubmission(tmp->GetContext(), this);
+		auto psubmission = VKSubmission::Cast(submission);
+		psubmission->mExcuteQueue = tmp;
+		//the semaphores of the current frames are taken now, the frames may be ended before the submission reaches the queue.
+		//the first batch that renders to a swapchain waits on the acquire of its frame, the last one signals the render finished
+		//semaphore of the frame for the present if no submission of the frame did before
+		std::vector<uint32_t> lastBatches;
+		std::vector<VKSwapchain*> renderedSwapchains;
+		for (uint32_t i = 0; i < numBatches; ++i) {
+			auto &batch = batches[i];
+			VKSubmission::Batch vkBatch;
+			vkBatch.numCmdBuffers = batch.numCmdBuffers;
+			vkBatch.numWaiteSubmissions = batch.numWaiteSubmission;
+			vkBatch.numSwapchainSemaphores = 0;
+			vkBatch.numSignalSemaphores = 0;
+			vkBatch.numUploads = 0;
+			vkBatch.waiteBatchMask = batch.waiteBatchMask & ((1u << i) - 1);
+			psubmission->mCmdBuffers.insert(psubmission->mCmdBuffers.end(), batch.cmdBuffers, batch.cmdBuffers + batch.numCmdBuffers);
+			psubmission->mWaiteSubmissions.insert(psubmission->mWaiteSubmissions.end(), batch.waiteSubmissions, batch.waiteSubmissions + batch.numWaiteSubmission);
+			for (uint32_t k = 0; k < batch.numWaiteSubmission; ++k) {
+				psubmission->mWaiteStages.push_back(getWaiteStage(tmp, batch.waiteStages != nullptr ? batch.waiteStages[k] : 0));
+			}
+			for (uint32_t k = 0; k < batch.numSwapchain; ++k) {
+				auto pswapchain = VKSwapchain::Cast(batch.waiteSwapchains[k]);
+				auto &frame = pswapchain->GetCurrentFrame();
+				if (!frame.acquireWaited) {
+					psubmission->mSwapchainSemaphores.push_back(frame.acquireSemaphore);
+					++vkBatch.numSwapchainSemaphores;
+					frame.acquireWaited = true;
+				}
+				if (!pswapchain->IsInFrame() || frame.rendered) {
+					continue;
+				}
+				auto itr = std::find(renderedSwapchains.begin(), renderedSwapchains.end(), pswapchain);
+				if (itr == renderedSwapchains.end()) {
+					renderedSwapchains.push_back(pswapchain);
+					lastBatches.push_back(i);
+				}
+				else {
+					lastBatches[itr - renderedSwapchains.begin()] = i;
+				}
+			}
+			psubmission->mBatches.push_back(vkBatch);
+		}
+		for (uint32_t i = 0; i < numBatches; ++i) {
+			for (size_t k = 0; k < renderedSwapchains.size(); ++k) {
+				if (lastBatches[k] == i) {
+					auto &frame = renderedSwapchains[k]->GetCurrentFrame();
+					psubmission->mSignalSemaphores.push_back(frame.renderFinishedSemaphore);
+					++psubmission->mBatches[i].numSignalSemaphores;
+					frame.rendered = true;
+				}
+			}
+		}
+		auto numBuffers = (uint32_t)psubmission->mCmdBuffers.size();
+		auto cmdBuffers = psubmission->mCmdBuffers.data();
+		psubmission->mWaiteFinished = waiteFinished;
+		psubmission->mNumDependencies = numBuffers + 1;
+		//held by the continuation until the submission is handed to the queue
+		psubmission->ref();
+		tmp->mScheduler->SetLastSubmission(tmp, submission);
+		//a buffer without second command buffers in flight is ready at once
 		for (uint32_t i = 0; i < numBuffers; ++i) {
-			if (VKCommandBuffer::Cast(cmdBuffers[i])->Excute() != VK_SUCCESS) {
-				return false;
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffers[i]);
+			//a buffer submitted again without being recorded waits for its previous submission
+			if (pcmdBuffer->mLastSubmission != nullptr) {
+				VKSubmission::Cast(pcmdBuffer->mLastSubmission)->WaiteQueued();
 			}
+			pcmdBuffer->mLastSubmission = submission;
+			pcmdBuffer->mPendingSubmission = psubmission;
+			pcmdBuffer->SecondCmdBufferFinished();
 		}
+		psubmission->DependencyFinished();
 		//
-		if (mLogicDevice.ExcuteCommands(excuteQueue, numBuffers, cmdBuffers, numWaiteQueue, waiteQueues, numSwapchain, waiteSwapchains, waiteFinished) != VK_SUCCESS) {
+		if (waiteFinished && !psubmission->Waite()) {
+			return nullptr;
+		}
+		return submission.release();
+	}
+
+	bool VulkanGI::WaitSubmission(Submission* submission) {
+		return VKSubmission::Cast(submission)->Waite();
+	}
+
+	bool VulkanGI::IsSubmissionFinished(Submission* submission) {
+		return VKSubmission::Cast(submission)->IsFinished();
+	}
+
+	bool VulkanGI::WaitSubmissionFinished(Submission* submission, uint64_t timeout) {
+		return VKSubmission::Cast(submission)->WaiteFinished(timeout);
+	}
+
+	void VKSubmission::DependencyFinished() {
+		if (mNumDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			mGI->submitPending(this);
+		}
+	}
+
+	VKSubmission::~VKSubmission() {
+		if (!mRetired) {
+			retire();
+		}
+	}
+
+	void VKSubmission::retire() {
+		if (mFence != VK_NULL_HANDLE || !mWaitedSemaphores.empty()) {
+			mGI->mLogicDevice.GetSyncPool()->Retire(mFence, (uint32_t)mWaitedSemaphores.size(), mWaitedSemaphores.data());
+		}
+		mFence = VK_NULL_HANDLE;
+		mWaitedSemaphores.clear();
+		mRetired = true;
+	}
+
+	bool VKSubmission::IsFinished() {
+		std::lock_guard<std::mutex> lock(mMtx);
+		if (mRetired) {
+			return true;
+		}
+		if (mState != State::SUBMITTED && mState != State::FAILED) {
 			return false;
 		}
-		//
+		if (mState == State::SUBMITTED && !mGI->mLogicDevice.GetSyncPool()->IsSignaled(mFence)) {
+			return false;
+		}
+		if (mNumFenceWaiters == 0) {
+			retire();
+		}
 		return true;
 	}
 
+	bool VKSubmission::WaiteFinished(uint64_t timeout) {
+		if (!Waite()) {
+			return false;
+		}
+		auto fence = AddFenceWaiter();
+		if (fence == VK_NULL_HANDLE) {
+			return true;
+		}
+		auto res = vkWaitForFences(mGI->mLogicDevice.GetDevice(), 1, &fence, VK_TRUE, timeout) == VK_SUCCESS;
+		RemoveFenceWaiter();
+		if (res) {
+			IsFinished();
+		}
+		return res;
+	}
+
+	void VulkanGI::submitPending(VKSubmission* psubmission) {
+		auto numBuffers = (uint32_t)psubmission->mCmdBuffers.size();
+		auto cmdBuffers = psubmission->mCmdBuffers.data();
+		bool res = true;
+		for (uint32_t i = 0; i < numBuffers && res; ++i) {
+			res = VKCommandBuffer::Cast(cmdBuffers[i])->Excute() == VK_SUCCESS;
+		}
+		//the encoded buffers are taken now, the command buffers may be recorded again before the submission reaches the queue.
+		//the pins keep their pools from being reset until then
+		if (res) {
+			for (uint32_t i = 0; i < numBuffers; ++i) {
+				auto tmp = VKCommandBuffer::Cast(cmdBuffers[i]);
+				psubmission->mVkCmdBuffers.push_back(tmp->GetBindingCmdBuffer());
+				psubmission->mPinnedItems.push_back(tmp->GetBindingItem());
+				for (auto secondCmdBuffer : tmp->mSecondCmdBuffers) {
+					auto pitem = VKCommandBuffer::Cast(secondCmdBuffer)->GetBindingItem();
+					if (pitem != nullptr) {
+						psubmission->mPinnedItems.push_back(pitem);
+					}
+				}
+			}
+			for (auto pitem : psubmission->mPinnedItems) {
+				mCmdBufferManger->PinCmdBuffer(pitem);
+			}
+			//the second command buffers are translated, what they use is known now
+			uint32_t cmdBufferIndex = 0;
+			for (auto &batch : psubmission->mBatches) {
+				auto numUploads = psubmission->mUploads.size();
+				for (uint32_t i = 0; i < batch.numCmdBuffers; ++i) {
+					auto tmp = VKCommandBuffer::Cast(cmdBuffers[cmdBufferIndex++]);
+					psubmission->mUploads.insert(psubmission->mUploads.end(), tmp->GetUploads().begin(), tmp->GetUploads().end());
+					for (auto secondCmdBuffer : tmp->mSecondCmdBuffers) {
+						auto &uploads = VKCommandBuffer::Cast(secondCmdBuffer)->GetUploads();
+						psubmission->mUploads.insert(psubmission->mUploads.end(), uploads.begin(), uploads.end());
+					}
+				}
+				batch.numUploads = (uint32_t)(psubmission->mUploads.size() - numUploads);
+			}
+		}
+		//the buffers hold the reference for their next submission again
+		for (uint32_t i = 0; i < numBuffers; ++i) {
+			VKCommandBuffer::Cast(cmdBuffers[i])->mNumPendingSecondCmdBuffers.store(1, std::memory_order_relaxed);
+		}
+		psubmission->mCmdBuffers.clear();
+		//
+		if (!res) {
+			psubmission->setState(VKSubmission::State::FAILED);
+			psubmission->unref();
+		}
+		else if (mSubmitThread != nullptr) {
+			//the submit thread takes over the reference of the continuation and may finish before QUEUED is set
+			VKSubmitThread::Packet packet;
+			packet.type = VKSubmitThread::PACKET_SUBMIT;
+			packet.submission = psubmission;
+			packet.excuteQueue = psubmission->mExcuteQueue;
+			packet.numSwapchains = 0;
+			packet.frameIndex = 0;
+			psubmission->ref();
+			mSubmitThread->Push(packet);
+			psubmission->setState(VKSubmission::State::QUEUED);
+			psubmission->unref();
+		}
+		else {
+			submitQueued(psubmission);
+		}
+	}
+
+	void VulkanGI::submitQueued(VKSubmission* psubmission) {
+		auto syncPool = mLogicDevice.GetSyncPool();
+		auto numBatches = (uint32_t)psubmission->mBatches.size();
+		std::vector<std::vector<VkSemaphore>> waiteSemaphores(numBatches);
+		std::vector<std::vector<VkPipelineStageFlags>> waiteStages(numBatches);
+		std::vector<std::vector<VkSemaphore>> signalSemaphores(numBatches);
+		std::vector<VKCmdBufferManager::CmdBufferItm*> acquireItems(numBatches, nullptr);
+		bool graphicsFamily = psubmission->mExcuteQueue->familyIndex == mLogicDevice.GetGraphicsQueueFamilyIndex();
+		uint32_t waiteSubmissionIndex = 0;
+		uint32_t swapchainSemaphoreIndex = 0;
+		uint32_t signalSemaphoreIndex = 0;
+		uint32_t uploadIndex = 0;
+		for (uint32_t i = 0; i < numBatches; ++i) {
+			auto &batch = psubmission->mBatches[i];
+			//a submission on the same queue is ahead of this one anyway, one that is finished needs no wait.
+			//for the others a semaphore is signaled on their queue now under its lock, they are handed to their queues already
+			for (uint32_t k = 0; k < batch.numWaiteSubmissions; ++k) {
+				auto waiteStage = psubmission->mWaiteStages[waiteSubmissionIndex];
+				auto pwaite = VKSubmission::Cast(psubmission->mWaiteSubmissions[waiteSubmissionIndex++]);
+				if (pwaite->mExcuteQueue->mQueue == psubmission->mExcuteQueue->mQueue || pwaite->IsFinished()) {
+					continue;
+				}
+				auto semaphore = syncPool->AcquireSemaphore();
+				if (semaphore == VK_NULL_HANDLE || mLogicDevice.SignalSemaphore(pwaite->mExcuteQueue, semaphore) != VK_SUCCESS) {
+					//the other queue is waited for from here
+					if (semaphore != VK_NULL_HANDLE) {
+						syncPool->Retire(VK_NULL_HANDLE, 1, &semaphore);
+					}
+					pwaite->WaiteFinished();
+					continue;
+				}
+				psubmission->mWaitedSemaphores.push_back(semaphore);
+				waiteSemaphores[i].push_back(semaphore);
+				waiteStages[i].push_back(waiteStage);
+			}
+			for (uint32_t k = 0; k < batch.numSwapchainSemaphores; ++k) {
+				waiteSemaphores[i].push_back(psubmission->mSwapchainSemaphores[swapchainSemaphoreIndex++]);
+				waiteStages[i].push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+			}
+			for (uint32_t k = 0; k < batch.numSignalSemaphores; ++k) {
+				signalSemaphores[i].push_back(psubmission->mSignalSemaphores[signalSemaphoreIndex++]);
+			}
+			//the graphics family takes over the resources uploaded on the transfer queue in a command buffer run before the batch,
+			//the batch waits on each upload at the stage the resource is first used. a batch of another family only waits on the queue
+			//until the copy is finished
+			for (uint32_t k = 0; k < batch.numUploads; ++k) {
+				auto upload = psubmission->mUploads[uploadIndex++].get();
+				if (upload->IsClaimed()) {
+					continue;
+				}
+				if (!graphicsFamily) {
+					VkSemaphore semaphore = VK_NULL_HANDLE;
+					if (mUploadEngine->SignalSemaphore(upload, semaphore) && semaphore != VK_NULL_HANDLE) {
+						psubmission->mWaitedSemaphores.push_back(semaphore);
+						waiteSemaphores[i].push_back(semaphore);
+						waiteStages[i].push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+					}
+					continue;
+				}
+				if (acquireItems[i] == nullptr) {
+					auto pitem = mCmdBufferManger->AcquirePrimaryCmdBuffer(VK_PIPELINE_BIND_POINT_GRAPHICS);
+					VkCommandBufferBeginInfo cmdBufBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+					cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+					if (pitem == nullptr || vkBeginCommandBuffer(pitem->cmdBuffer, &cmdBufBeginInfo) != VK_SUCCESS) {
+						if (pitem != nullptr) {
+							mCmdBufferManger->FreeCmdBuffer(pitem);
+						}
+						continue;
+					}
+					acquireItems[i] = pitem;
+				}
+				VkSemaphore semaphore = VK_NULL_HANDLE;
+				if (!upload->Claim() || !mUploadEngine->TakeSemaphore(upload, semaphore)) {
+					continue;
+				}
+				upload->RecordAcquire(acquireItems[i]->cmdBuffer);
+				if (semaphore != VK_NULL_HANDLE) {
+					psubmission->mWaitedSemaphores.push_back(semaphore);
+					waiteSemaphores[i].push_back(semaphore);
+					waiteStages[i].push_back(upload->GetDstStage());
+				}
+			}
+			//the batches of one submit may overlap on the queue, a dependency between them is a semaphore
+			//signaled by the earlier batch for each batch waiting on it
+			for (uint32_t k = 0; k < i; ++k) {
+				if ((batch.waiteBatchMask & (1u << k)) == 0) {
+					continue;
+				}
+				auto semaphore = syncPool->AcquireSemaphore();
+				if (semaphore == VK_NULL_HANDLE) {
+					continue;
+				}
+				psubmission->mWaitedSemaphores.push_back(semaphore);
+				signalSemaphores[k].push_back(semaphore);
+				waiteSemaphores[i].push_back(semaphore);
+				waiteStages[i].push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			}
+		}
+		psubmission->mWaiteSubmissions.clear();
+		psubmission->mWaiteStages.clear();
+		psubmission->mUploads.clear();
+		//the acquire command buffers go with the buffers of the submission
+		std::vector<std::vector<VkCommandBuffer>> batchCmdBuffers(numBatches);
+		uint32_t cmdBufferIndex = 0;
+		for (uint32_t i = 0; i < numBatches; ++i) {
+			if (acquireItems[i] != nullptr) {
+				vkEndCommandBuffer(acquireItems[i]->cmdBuffer);
+				mCmdBufferManger->PinCmdBuffer(acquireItems[i]);
+				psubmission->mPinnedItems.push_back(acquireItems[i]);
+				batchCmdBuffers[i].push_back(acquireItems[i]->cmdBuffer);
+			}
+			auto numCmdBuffers = psubmission->mBatches[i].numCmdBuffers;
+			batchCmdBuffers[i].insert(batchCmdBuffers[i].end(), psubmission->mVkCmdBuffers.begin() + cmdBufferIndex, psubmission->mVkCmdBuffers.begin() + cmdBufferIndex + numCmdBuffers);
+			cmdBufferIndex += numCmdBuffers;
+		}
+		//
+		std::vector<VkSubmitInfo> submitInfos(numBatches);
+		for (uint32_t i = 0; i < numBatches; ++i) {
+			auto &submitInfo = submitInfos[i];
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.pNext = nullptr;
+			submitInfo.commandBufferCount = (uint32_t)batchCmdBuffers[i].size();
+			submitInfo.pCommandBuffers = batchCmdBuffers[i].empty() ? nullptr : batchCmdBuffers[i].data();
+			submitInfo.waitSemaphoreCount = (uint32_t)waiteSemaphores[i].size();
+			submitInfo.pWaitSemaphores = waiteSemaphores[i].empty() ? nullptr : waiteSemaphores[i].data();
+			submitInfo.pWaitDstStageMask = waiteStages[i].empty() ? nullptr : waiteStages[i].data();
+			submitInfo.signalSemaphoreCount = (uint32_t)signalSemaphores[i].size();
+			submitInfo.pSignalSemaphores = signalSemaphores[i].empty() ? nullptr : signalSemaphores[i].data();
+		}
+		//
+		auto fence = syncPool->AcquireFence();
+		auto res = fence != VK_NULL_HANDLE && mLogicDevice.ExcuteCommands(psubmission->mExcuteQueue, numBatches, submitInfos.data(), fence, psubmission->mWaiteFinished) == VK_SUCCESS;
+		if (res) {
+			psubmission->mFence = fence;
+		}
+		else {
+			syncPool->ReleaseFence(fence);
+		}
+		//the buffers are recycled once the fence of this submission has signaled
+		uint64_t serial = 0;
+		if (res) {
+			std::lock_guard<std::mutex> lock(psubmission->mExcuteQueue->mSubmitMtx);
+			serial = mCmdBufferManger->TrackSubmission(psubmission->mExcuteQueue->GetVKQueue());
+		}
+		for (auto pitem : psubmission->mPinnedItems) {
+			mCmdBufferManger->MarkSubmitted(pitem, serial);
+		}
+		//nothing else holds the acquire command buffers, their pools are reset once the serial is finished
+		for (auto pitem : acquireItems) {
+			if (pitem != nullptr) {
+				mCmdBufferManger->FreeCmdBuffer(pitem);
+			}
+		}
+		psubmission->mVkCmdBuffers.clear();
+		psubmission->mPinnedItems.clear();
+		psubmission->setState(res ? VKSubmission::State::SUBMITTED : VKSubmission::State::FAILED);
+		trackSubmission(psubmission);
+		psubmission->unref();
+	}
+
+	void VulkanGI::trackSubmission(VKSubmission* psubmission) {
+		std::lock_guard<std::mutex> lock(mSubmissionsMtx);
+		auto itr = std::remove_if(mSubmissionsInFlight.begin(), mSubmissionsInFlight.end(), [](const submission_ptr& submission) {
+			return VKSubmission::Cast(submission)->IsFinished();
+		});
+		mSubmissionsInFlight.erase(itr, mSubmissionsInFlight.end());
+		if (!psubmission->IsFinished()) {
+			mSubmissionsInFlight.push_back(psubmission);
+		}
+	}
+
 	void VulkanGI::Present(ExcuteQueue* excuteQueue, uint32_t numSwapchain, Swapchain** swapchains, bool waiteFinished) {
-		std::vector<VkSwapchainKHR> vkSwapchains(numSwapchain);
+		//same as EndFrame
+		if (mUploadEngine != nullptr) {
+			mUploadEngine->Flush();
+		}
+		//the present waits on the semaphore signaled by the last submission, that must be queued before it
+		auto tmp = VKExcuteQueue::Cast(excuteQueue);
+		auto lastSubmission = tmp->mScheduler->GetLastSubmission(tmp);
+		if (lastSubmission != nullptr) {
+			VKSubmission::Cast(lastSubmission)->WaiteQueued();
+		}
+		//
+		std::vector<VKSwapchain*> vkSwapchains(numSwapchain);
 		std::vector<uint32_t> imgIndexes(numSwapchain);
 		for (uint32_t i = 0; i < numSwapchain; ++i) {
-			auto tmp = VKSwapchain::Cast(swapchains[i]);
-			vkSwapchains[i] = tmp->mVkSwapchain;
-			imgIndexes[i] = tmp->mCurrentAttachmentIndex;
+			vkSwapchains[i] = VKSwapchain::Cast(swapchains[i]);
+			imgIndexes[i] = vkSwapchains[i]->mCurrentAttachmentIndex;
+		}
+		//present closes the frame, the command pools of the next frame are reset when their previous frame is finished
+		if (mSubmitThread != nullptr && numSwapchain > 0) {
+			//a packet holds MAX_PRESENT_SWAPCHAINS swapchains, the last one of the present closes the frame
+			auto frameIndex = mCmdBufferManger->AdvanceFrame();
+			for (uint32_t first = 0; first < numSwapchain; first += VKSubmitThread::MAX_PRESENT_SWAPCHAINS) {
+				VKSubmitThread::Packet packet;
+				packet.type = VKSubmitThread::PACKET_PRESENT;
+				packet.submission = nullptr;
+				packet.excuteQueue = tmp;
+				packet.numSwapchains = numSwapchain - first < VKSubmitThread::MAX_PRESENT_SWAPCHAINS ? numSwapchain - first : VKSubmitThread::MAX_PRESENT_SWAPCHAINS;
+				for (uint32_t i = 0; i < packet.numSwapchains; ++i) {
+					packet.swapchains[i] = vkSwapchains[first + i];
+					packet.imgIndexes[i] = imgIndexes[first + i];
+					packet.waiteSemaphores[i] = VK_NULL_HANDLE;
+				}
+				packet.fence = VK_NULL_HANDLE;
+				packet.frameIndex = first + packet.numSwapchains == numSwapchain ? frameIndex : VKSubmitThread::NO_FRAME;
+				mSubmitThread->Push(packet);
+			}
+			if (waiteFinished) {
+				mSubmitThread->Flush();
+			}
+			return;
+		}
+		if (numSwapchain > 0) {
+			presentQueued(tmp, numSwapchain, vkSwapchains.data(), imgIndexes.data(), nullptr, VK_NULL_HANDLE);
+		}
+		signalFrame(tmp);
+		if (waiteFinished && mSubmitThread != nullptr) {
+			mSubmitThread->Flush();
+		}
+	}
+
+	void VulkanGI::signalFrame(VKExcuteQueue* excuteQueue) {
+		if (mSubmitThread != nullptr) {
+			VKSubmitThread::Packet packet;
+			packet.type = VKSubmitThread::PACKET_SIGNAL_FRAME;
+			packet.submission = nullptr;
+			packet.excuteQueue = excuteQueue;
+			packet.numSwapchains = 0;
+			packet.fence = VK_NULL_HANDLE;
+			packet.frameIndex = mCmdBufferManger->AdvanceFrame();
+			mSubmitThread->Push(packet);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(excuteQueue->mSubmitMtx);
+		mCmdBufferManger->EndFrame(excuteQueue->mQueue);
+	}
+
+	uint32_t VulkanGI::BeginFrame(Swapchain* swapchain) {
+		return VKSwapchain::Cast(swapchain)->BeginFrame();
+	}
+
+	void VulkanGI::EndFrame(ExcuteQueue* excuteQueue, Swapchain* swapchain) {
+		//the uploads recorded during the frame start copying at the latest when it ends
+		if (mUploadEngine != nullptr) {
+			mUploadEngine->Flush();
+		}
+		auto tmp = VKExcuteQueue::Cast(excuteQueue);
+		auto lastSubmission = tmp->mScheduler->GetLastSubmission(tmp);
+		if (lastSubmission != nullptr) {
+			VKSubmission::Cast(lastSubmission)->WaiteQueued();
+		}
+		//
+		auto pswapchain = VKSwapchain::Cast(swapchain);
+		auto &frame = pswapchain->GetCurrentFrame();
+		uint32_t imgIndex = pswapchain->mCurrentAttachmentIndex;
+		VkSemaphore renderFinished = frame.rendered ? frame.renderFinishedSemaphore : VK_NULL_HANDLE;
+		//the fence of the frame is signaled by an empty submit after the present, BeginFrame of the slot waits on it
+		//instead of the CPU waiting for the queue after every present
+		if (mSubmitThread != nullptr) {
+			VKSubmitThread::Packet packet;
+			packet.type = VKSubmitThread::PACKET_PRESENT;
+			packet.submission = nullptr;
+			packet.excuteQueue = tmp;
+			packet.numSwapchains = 1;
+			packet.swapchains[0] = pswapchain;
+			packet.imgIndexes[0] = imgIndex;
+			packet.waiteSemaphores[0] = renderFinished;
+			packet.fence = frame.fence;
+			packet.frameIndex = mCmdBufferManger->AdvanceFrame();
+			mSubmitThread->Push(packet);
+		}
+		else {
+			presentQueued(tmp, 1, &pswapchain, &imgIndex, &renderFinished, frame.fence);
+			std::lock_guard<std::mutex> lock(tmp->mSubmitMtx);
+			mCmdBufferManger->EndFrame(tmp->mQueue);
+		}
+		pswapchain->EndFrame();
+	}
+
+	void VulkanGI::presentQueued(VKExcuteQueue* excuteQueue, uint32_t numSwapchain, VKSwapchain** swapchains, const uint32_t* imgIndexes, const VkSemaphore* waiteSemaphores, VkFence fence) {
+		std::vector<VkSwapchainKHR> vkSwapchains(numSwapchain);
+		std::vector<VkSemaphore> vkWaiteSemaphores;
+		std::vector<std::unique_lock<std::mutex>> locks;
+		locks.reserve(numSwapchain);
+		for (uint32_t i = 0; i < numSwapchain; ++i) {
+			vkSwapchains[i] = swapchains[i]->mVkSwapchain;
+			if (waiteSemaphores != nullptr && waiteSemaphores[i] != VK_NULL_HANDLE) {
+				vkWaiteSemaphores.push_back(waiteSemaphores[i]);
+			}
+			locks.push_back(std::unique_lock<std::mutex>(swapchains[i]->mMtxPresent));
+		}
+		//without the render finished semaphores of the frames the present waits for the work submitted to the queue so far
+		auto syncPool = mLogicDevice.GetSyncPool();
+		VkSemaphore queueSemaphore = VK_NULL_HANDLE;
+		if (vkWaiteSemaphores.empty()) {
+			queueSemaphore = syncPool->AcquireSemaphore();
+			if (queueSemaphore != VK_NULL_HANDLE && mLogicDevice.SignalSemaphore(excuteQueue, queueSemaphore) == VK_SUCCESS) {
+				vkWaiteSemaphores.push_back(queueSemaphore);
+			}
 		}
 		VkPresentInfoKHR presentInfo = {};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 		presentInfo.pNext = NULL;
 		presentInfo.swapchainCount = numSwapchain;
 		presentInfo.pSwapchains = vkSwapchains.data();
-		presentInfo.pImageIndices = imgIndexes.data();
+		presentInfo.pImageIndices = imgIndexes;
 
-		auto tmp = VKExcuteQueue::Cast(excuteQueue);
-		presentInfo.pWaitSemaphores = &tmp->signalingSemaphore;
-		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = vkWaiteSemaphores.empty() ? nullptr : vkWaiteSemaphores.data();
+		presentInfo.waitSemaphoreCount = (uint32_t)vkWaiteSemaphores.size();
 		//
-		if (vkQueuePresentKHR(tmp->mQueue, &presentInfo) != VK_SUCCESS) {
+		std::lock_guard<std::mutex> lock(excuteQueue->mSubmitMtx);
+		if (vkQueuePresentKHR(excuteQueue->mQueue, &presentInfo) != VK_SUCCESS) {
 			std::cout << "faild" << std::endl;
 		}
+		//the semaphore is reused once a batch queued after the present has finished
+		if (queueSemaphore != VK_NULL_HANDLE) {
+			auto retireFence = syncPool->AcquireFence();
+			VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr };
+			if (retireFence == VK_NULL_HANDLE || vkQueueSubmit(excuteQueue->mQueue, 1, &submitInfo, retireFence) != VK_SUCCESS) {
+				syncPool->ReleaseFence(retireFence);
+				retireFence = VK_NULL_HANDLE;
+			}
+			syncPool->Retire(retireFence, 1, &queueSemaphore);
+		}
+		//
+		if (fence != VK_NULL_HANDLE) {
+			VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr };
+			vkQueueSubmit(excuteQueue->mQueue, 1, &submitInfo, fence);
+		}
 	}
 
-	CommandBuffer* VulkanGI::CreateCmdBuffer() {
-		return new VKCommandBuffer(GraphicsContextManager::Instance()->GetCurrentContext());
+	void VulkanGI::EnableSubmitThread(bool enable) {
+		if (enable && mSubmitThread == nullptr) {
+			mSubmitThread = new VKSubmitThread(this);
+		}
+		else if (!enable && mSubmitThread != nullptr) {
+			delete mSubmitThread;
+			mSubmitThread = nullptr;
+		}
+	}
+
+	SubmitThreadStatistics VulkanGI::GetSubmitThreadStatistics() {
+		if (mSubmitThread == nullptr) {
+			return SubmitThreadStatistics();
+		}
+		return mSubmitThread->GetStatistics();
+	}
+
+	CommandBuffer* VulkanGI::CreateCmdBuffer(const CommandBufferCreateInfo& create_info) {
+		auto pcmdBuffer = new VKCommandBuffer(GraphicsContextManager::Instance()->GetCurrentContext(), mCmdBufferManger, create_info.immediateRecord);
+		//
+		auto &features = mLogicDevice.GetEnabledFeatures();
+		if (create_info.mergeDrawIndexed && !create_info.immediateRecord && features.multiDrawIndirect) {
+			pcmdBuffer->EnableDrawMerging(features.drawIndirectFirstInstance == VK_TRUE);
+		}
+		//
+		return pcmdBuffer;
 	}
 
 	bool VulkanGI::BeginRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, FrameBuffer* frameBuffer) {
 		auto primaryBuffer = VKCommandBuffer::Cast(cmdBuffer);
-		if (primaryBuffer->mBindingCmdBuffer == nullptr) {
-			primaryBuffer->mBindingCmdBuffer = mCmdBufferManger->AcquirePrimaryCmdBuffer(VK_PIPELINE_BIND_POINT_GRAPHICS);
-			if (primaryBuffer->mBindingCmdBuffer == nullptr) {
-				return false;
-			}
+		//deferred command buffer gets its binding buffer in Excute, on the thread that encodes it
+		if (primaryBuffer->IsImmediateRecord() && primaryBuffer->mBindingCmdBuffer == nullptr) {
+			return false;
 		}
 		//
 		primaryBuffer->mSecondCmdBuffers.clear();
 		//
-		primaryBuffer->PushCommand(new VKCmdBeginRenderPass(renderPass, frameBuffer));
+		primaryBuffer->RecordCommand<VKCmdBeginRenderPass>(renderPass, frameBuffer);
 		return true;
 	}
 
@@ -1372,26 +2273,19 @@ namespace ASGI {
 		//
 		for (uint32_t i = 0; i < numSecondCmdBuffer; ++i) {
 			auto secondBuffer = VKCommandBuffer::Cast(secondCmdBuffers[i]);
-			if (mCmdBufferTaskQueue != nullptr && secondBuffer->mBindingCmdBuffer == nullptr) {
-					secondBuffer->mBindingCmdBuffer = mCmdBufferManger->AcquireSecondCmdBuffer(VK_PIPELINE_BIND_POINT_GRAPHICS);
-			}
-			//
 			if (mCmdBufferTaskQueue != nullptr) {
 				primaryBuffer->mSecondCmdBuffers.push_back(secondCmdBuffers[i]);
 				//
-				{
-					std::lock_guard<std::mutex> lock(primaryBuffer->mMtxSecondCmdBuffer);
-					primaryBuffer->mUnExcuteSecondCmdBufferCount++;
-				}
-				//
+				primaryBuffer->AddPendingSecondCmdBuffer();
 				mCmdBufferTaskQueue->PushTask(CmdBufferTask(cmdBuffer, secondCmdBuffers[i], VKCommandBuffer::ExcuteParallel));
+				primaryBuffer->InvalidateBoundState();
 			}
 			else {
 				secondBuffer->MergeTo(primaryBuffer);
 			}
 		}
 		//
-		primaryBuffer->PushCommand(new VKCmdEndSubRenderPass());
+		primaryBuffer->RecordCommand<VKCmdEndSubRenderPass>();
 	}
 
 	void VulkanGI::EndRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers) {
@@ -1399,44 +2293,34 @@ namespace ASGI {
 		//
 		for (uint32_t i = 0; i < numSecondCmdBuffer; ++i) {
 			auto secondBuffer = VKCommandBuffer::Cast(secondCmdBuffers[i]);
-			if (mCmdBufferTaskQueue != nullptr && secondBuffer->mBindingCmdBuffer == nullptr) {
-				secondBuffer->mBindingCmdBuffer = mCmdBufferManger->AcquireSecondCmdBuffer(VK_PIPELINE_BIND_POINT_GRAPHICS);
-			}
-			//
 			if (mCmdBufferTaskQueue != nullptr) {
 				primaryBuffer->mSecondCmdBuffers.push_back(secondCmdBuffers[i]);
 				//
-				{
-					std::lock_guard<std::mutex> lock(primaryBuffer->mMtxSecondCmdBuffer);
-					primaryBuffer->mUnExcuteSecondCmdBufferCount++;
-				}
-				//
+				primaryBuffer->AddPendingSecondCmdBuffer();
 				mCmdBufferTaskQueue->PushTask(CmdBufferTask(cmdBuffer, secondCmdBuffers[i], VKCommandBuffer::ExcuteParallel));
+				primaryBuffer->InvalidateBoundState();
 			}
 			else {
 				secondBuffer->MergeTo(primaryBuffer);
 			}
 		}
 		//
-		primaryBuffer->PushCommand(new VKCmdEndRenderPass());
+		primaryBuffer->RecordCommand<VKCmdEndRenderPass>();
 	}
 
 	bool VulkanGI::BeginComputePass(CommandBuffer* cmdBuffer, ComputePass* computePass) {
-		VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdBeginComputePass());
+		VKCommandBuffer::Cast(cmdBuffer)->RecordCommand<VKCmdBeginComputePass>();
 		return true;
 	}
 
 	void VulkanGI::EndComputePass(CommandBuffer* cmdBuffer, ComputePass* computePass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers) {
 		auto primaryBuffer = VKCommandBuffer::Cast(cmdBuffer);
-		primaryBuffer->PushCommand(new VKCmdEndSubRenderPass());
+		primaryBuffer->RecordCommand<VKCmdEndSubRenderPass>();
 		//
 		for (uint32_t i = 0; i < numSecondCmdBuffer; ++i) {
-			{
-				std::lock_guard<std::mutex> lock(primaryBuffer->mMtxSecondCmdBuffer);
-				primaryBuffer->mUnExcuteSecondCmdBufferCount++;
-			}
-			//
+			primaryBuffer->AddPendingSecondCmdBuffer();
 			mCmdBufferTaskQueue->PushTask(CmdBufferTask(cmdBuffer, secondCmdBuffers[i], VKCommandBuffer::ExcuteParallel));
+			primaryBuffer->InvalidateBoundState();
 		}
 	}
 }
\ No newline at end of file
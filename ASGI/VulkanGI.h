@@ -4,9 +4,13 @@
 #include "VulkanResource.h"
 #include "VulkanDevice.h"
 #include "VulkanCommand.h"
+#include "VulkanSubmitThread.h"
+#include "VulkanUpload.h"
 
 namespace ASGI {
 	class VulkanGI : public DynamicGI {
+		friend class VKSubmission;
+		friend class VKSubmitThread;
 	public:
 		bool Init(const char* device_name, ICmdBufferTaskQueue* cmdBufferTaskQueue = nullptr) override;
 
@@ -14,6 +18,7 @@ namespace ASGI {
 		ShaderProgram* CreateShaderProgram(ShaderModule* pVertexShader, ShaderModule* pGeomteryShader, ShaderModule* pTessControlShader, ShaderModule* pTessEvaluationShader, ShaderModule* pFragmentShader) override;
 		RenderPass* CreateRenderPass(const RenderPassCreateInfo& create_info) override;
 		GraphicsPipeline* CreateGraphicsPipeline(const GraphicsPipelineCreateInfo& create_info) override;
+		bool CreateGraphicsPipelines(uint32_t numPipelines, const GraphicsPipelineCreateInfo* createInfos, GraphicsPipeline** pipelines) override;
 		Swapchain* CreateSwapchain(const SwapchainCreateInfo& create_info) override;
 		FrameBuffer* CreateFrameBuffer(RenderPass* targetRenderPass, uint8_t numAttachment, ImageView** attachments, ClearValue* clearValues, uint32_t width, uint32_t height) override;
 
@@ -24,6 +29,7 @@ namespace ASGI {
 		BufferUpdateContext* BeginUpdateBuffer() override;
 		bool EndUpdateBuffer(BufferUpdateContext* pUpdateContext) override;
 		void UpdateBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, void* pdata, BufferUpdateContext* pUpdateContext = nullptr) override;
+		bool WaitBufferUpdated(Buffer* pbuffer) override;
 		void* MapBuffer(Buffer* pbuffer, uint32_t offset, uint32_t size, MapMode mapMode = MapMode::MAP_MODE_WRITE) override;
 		void UnMapBuffer(Buffer* pbuffer) override;
 		void BindUniformBuffer(ShaderProgram* pProgram, uint8_t setIndex, uint32_t bindingIndex, Buffer* pbuffer, uint32_t offset, uint32_t size) override;
@@ -47,18 +53,41 @@ namespace ASGI {
 
 		void BindTexture(ShaderProgram* pProgram, uint8_t setIndex, uint32_t bindingIndex, ImageView* pImgView, Sampler* pSampler) override;
 
-		ExcuteQueue* AcquireExcuteQueue(QueueType queueType) override;
+		ExcuteQueue* AcquireExcuteQueue(QueueType queueType, uint64_t timeout = UINT64_MAX) override;
+		QueueStatistics GetQueueStatistics(ExcuteQueue* excuteQueue) override;
 		void WaitQueueExcuteFinished(uint32_t numWaiteQueue, ExcuteQueue** excuteQueues) override;
-		bool SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false) override;
+		Submission* SubmitCommands(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteQueue, ExcuteQueue** waiteQueues, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false) override;
+		Submission* SubmitCommandsAfter(ExcuteQueue* excuteQueue, uint32_t numBuffers, CommandBuffer** cmdBuffers, uint32_t numWaiteSubmission, Submission** waiteSubmissions, uint32_t numSwapchain, Swapchain** waiteSwapchains, bool waiteFinished = false) override;
+		Submission* SubmitBatches(ExcuteQueue* excuteQueue, uint32_t numBatches, const SubmitBatch* batches, bool waiteFinished = false) override;
+		bool WaitSubmission(Submission* submission) override;
+		bool IsSubmissionFinished(Submission* submission) override;
+		bool WaitSubmissionFinished(Submission* submission, uint64_t timeout = UINT64_MAX) override;
 		void Present(ExcuteQueue* excuteQueue, uint32_t numSwapchain, Swapchain** swapchains, bool waiteFinished = false) override;
+		uint32_t BeginFrame(Swapchain* swapchain) override;
+		void EndFrame(ExcuteQueue* excuteQueue, Swapchain* swapchain) override;
+		void EnableSubmitThread(bool enable) override;
+		SubmitThreadStatistics GetSubmitThreadStatistics() override;
 
-		CommandBuffer* CreateCmdBuffer() override;
+		CommandBuffer* CreateCmdBuffer(const CommandBufferCreateInfo& create_info) override;
 		void BeginCmdBuffer(CommandBuffer* cmdBuffer) override {
-			VKCommandBuffer::Cast(cmdBuffer)->Clear();
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdBeginCmdBuffer());
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			//the stream of the last submission may still be translated on a worker
+			if (pcmdBuffer->mLastSubmission != nullptr) {
+				VKSubmission::Cast(pcmdBuffer->mLastSubmission)->WaiteQueued();
+				pcmdBuffer->mLastSubmission = nullptr;
+			}
+			pcmdBuffer->Clear();
+			//immediate command buffer needs the binding buffer before the first command, it is encoded on this thread
+			if (pcmdBuffer->IsImmediateRecord()) {
+				pcmdBuffer->AcquireThreadCmdBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+			}
+			pcmdBuffer->RecordCommand<VKCmdBeginCmdBuffer>();
 		}
 		void EndCmdBuffer(CommandBuffer* cmdBuffer) override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdEndCmdBuffer());
+			VKCommandBuffer::Cast(cmdBuffer)->RecordCommand<VKCmdEndCmdBuffer>();
+		}
+		CommandBufferStatistics GetCmdBufferStatistics(CommandBuffer* cmdBuffer) override {
+			return VKCommandBuffer::Cast(cmdBuffer)->GetStatistics();
 		}
 		bool BeginRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, FrameBuffer* frameBuffer) override;
 		void EndSubRenderPass(CommandBuffer* cmdBuffer, RenderPass* renderPass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers) override;
@@ -67,36 +96,93 @@ namespace ASGI {
 		void EndComputePass(CommandBuffer* cmdBuffer, ComputePass* computePass, uint32_t numSecondCmdBuffer, CommandBuffer** secondCmdBuffers) override;
 		//
 		inline void VulkanGI::CmdBindPipeline(CommandBuffer*  cmdBuffer, GraphicsPipeline* pipeline) override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdBindPipeline(pipeline));
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			bool bindDescriptorSets = true;
+			if (pcmdBuffer->UpdateBoundPipeline(pipeline, bindDescriptorSets)) {
+				pcmdBuffer->RecordCommand<VKCmdBindPipeline>(pipeline, bindDescriptorSets);
+				if (pipeline != nullptr) {
+					for (auto &upload : VKGPUProgram::Cast(pipeline->GetGPUProgram())->GetUploads()) {
+						pcmdBuffer->AddUpload(upload);
+					}
+				}
+			}
 		}
 
 		inline void VulkanGI::CmdSetViewport(CommandBuffer*  cmdBuffer, uint32_t   firstViewport, uint32_t  viewportCount, Viewport*  pViewports) override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdSetViewport(firstViewport, viewportCount, pViewports));
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			if (!pcmdBuffer->UpdateBoundViewports(firstViewport, viewportCount, pViewports)) {
+				return;
+			}
+			//the size of a packet is 16 bit, a long array is set by several packets
+			for (uint32_t i = 0; i < viewportCount; i += VKCmdSetViewport::GetMaxCount()) {
+				uint32_t count = (std::min)(viewportCount - i, VKCmdSetViewport::GetMaxCount());
+				pcmdBuffer->RecordCommandWithData<VKCmdSetViewport>(sizeof(VkViewport) * count, firstViewport + i, count, pViewports + i);
+			}
 		}
 
 		inline void VulkanGI::CmdSetScissor(CommandBuffer*  cmdBuffer, uint32_t  firstScissor, uint32_t   scissorCount, Rect2D*  pScissors)  override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdSetScissor(firstScissor, scissorCount, pScissors));
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			if (!pcmdBuffer->UpdateBoundScissors(firstScissor, scissorCount, pScissors)) {
+				return;
+			}
+			for (uint32_t i = 0; i < scissorCount; i += VKCmdSetScissor::GetMaxCount()) {
+				uint32_t count = (std::min)(scissorCount - i, VKCmdSetScissor::GetMaxCount());
+				pcmdBuffer->RecordCommandWithData<VKCmdSetScissor>(sizeof(VkRect2D) * count, firstScissor + i, count, pScissors + i);
+			}
 		}
 
 		inline void VulkanGI::CmdSetLineWidth(CommandBuffer*  cmdBuffer, float   lineWidth)  override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdSetLineWidth(lineWidth));
+			VKCommandBuffer::Cast(cmdBuffer)->RecordCommand<VKCmdSetLineWidth>(lineWidth);
 		}
 
 		inline void VulkanGI::CmdBindIndexBuffer(CommandBuffer* cmdBuffer, Buffer* pBuffer, uint32_t offset, Format indexFormat)  override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdBindIndexBuffer(pBuffer, offset, indexFormat));
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			if (pcmdBuffer->UpdateBoundIndexBuffer(pBuffer, offset, indexFormat)) {
+				pcmdBuffer->RecordCommand<VKCmdBindIndexBuffer>(pBuffer, offset, indexFormat);
+				useBuffer(pcmdBuffer, pBuffer);
+			}
 		}
 
 		inline void VulkanGI::CmdBindVertexBuffer(CommandBuffer* cmdBuffer, uint32_t  bindingIndex, Buffer*  pBuffer, uint32_t offset) override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdBindVertexBuffer(bindingIndex, pBuffer, offset));
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			if (pcmdBuffer->UpdateBoundVertexBuffer(bindingIndex, pBuffer, offset)) {
+				pcmdBuffer->RecordCommand<VKCmdBindVertexBuffer>(bindingIndex, pBuffer, offset);
+				useBuffer(pcmdBuffer, pBuffer);
+			}
+		}
+
+		inline void VulkanGI::CmdBindVertexBuffers(CommandBuffer* cmdBuffer, uint32_t firstBinding, uint32_t bindingCount, Buffer** ppBuffers, uint32_t* pOffsets) override {
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			if (pcmdBuffer->UpdateBoundVertexBuffers(firstBinding, bindingCount, ppBuffers, pOffsets)) {
+				for (uint32_t i = 0; i < bindingCount; i += VKCmdBindVertexBuffers::GetMaxCount()) {
+					uint32_t count = (std::min)(bindingCount - i, VKCmdBindVertexBuffers::GetMaxCount());
+					pcmdBuffer->RecordCommandWithData<VKCmdBindVertexBuffers>(VKCmdBindVertexBuffers::GetDataSize(count), firstBinding + i, count, ppBuffers + i, pOffsets + i);
+				}
+				for (uint32_t i = 0; i < bindingCount; ++i) {
+					useBuffer(pcmdBuffer, ppBuffers[i]);
+				}
+			}
 		}
 
 		inline void VulkanGI::CmdDraw(CommandBuffer* cmdBuffer, uint32_t vertexCount, uint32_t  instanceCount, uint32_t firstVertex, uint32_t  firstInstance) override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdDraw(vertexCount, instanceCount, firstVertex, firstInstance));
+			VKCommandBuffer::Cast(cmdBuffer)->RecordCommand<VKCmdDraw>(vertexCount, instanceCount, firstVertex, firstInstance);
 		}
 
 		inline void VulkanGI::CmdDrawIndexed(CommandBuffer* cmdBuffer, uint32_t indexCount, uint32_t   instanceCount, uint32_t  firstIndex, int32_t  vertexOffset, uint32_t  firstInstance)  override {
-			VKCommandBuffer::Cast(cmdBuffer)->PushCommand(new VKCmdDrawIndexed(indexCount, instanceCount, firstIndex, vertexOffset, firstInstance));
+			VKCommandBuffer::Cast(cmdBuffer)->RecordCommand<VKCmdDrawIndexed>(indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+		}
+
+		inline void VulkanGI::CmdFillBuffer(CommandBuffer* cmdBuffer, Buffer* dstBuffer, uint32_t dstOffset, uint32_t size, uint32_t  data) override {
+			auto pcmdBuffer = VKCommandBuffer::Cast(cmdBuffer);
+			pcmdBuffer->RecordCommand<VKCmdFillBuffer>(dstBuffer, dstOffset, size, data);
+			useBuffer(pcmdBuffer, dstBuffer);
 		}
+
+		void EnableCapture(bool enable) override {
+			mCaptureEnabled = enable;
+		}
+		bool CaptureCmdBuffer(CommandBuffer* cmdBuffer, const char* path) override;
+		bool ReplayCapture(const char* path, uint32_t numFrames, uint32_t numExternalResources, GraphicsResource** externalResources, CaptureReplayStatistics* pStatistics, const CommandBufferCreateInfo& create_info) override;
 	private:
 		bool getInstanceLevelExtensions();
 		bool createVKInstance(std::vector<char const *>& desired_extensions);
@@ -104,8 +190,58 @@ namespace ASGI {
 		bool createBuffer(uint64_t size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VKBuffer* pres);
 		bool updateBuffer(VKBuffer* buffer, uint32_t offset, uint32_t size, void* pdata, BufferUpdateContext* pUpdateContext);
 		bool BeginSingleTimeCommands();
-		bool EndSingleTimeCommands();
+		//submit the single time commands behind the work on the current graphics queue, the host does not wait for them.
+		//the stagings they read are released once they have finished. nullptr if they could not be submitted, the stagings are released
+		VKSubmission* EndSingleTimeCommands(uint32_t numStagings, VKStaging* pstagings);
+		//give back the command buffers and the stagings of the single time commands that have finished
+		void recycleSingleTimeCommands();
+		//the recorded commands use the buffer, the graphics family takes it over from the transfer queue when the submission is made
+		inline void useBuffer(VKCommandBuffer* pcmdBuffer, Buffer* pbuffer) {
+			if (pbuffer == nullptr) {
+				return;
+			}
+			auto tmp = VKBuffer::Cast(pbuffer);
+			tmp->mInUse.store(true, std::memory_order_relaxed);
+			if (tmp->mPendingUpload != nullptr) {
+				pcmdBuffer->AddUpload(tmp->mPendingUpload);
+			}
+		}
+		//take over a resource uploaded on the transfer queue on the single time command buffer, waits for the transfer batch
+		void acquireUpload(VKUpload* upload);
+		//a range of the staging ring, the finished batches of the transfer queue and single time commands give theirs back first
+		bool allocateStaging(uint64_t size, uint64_t alignment, VKStaging& staging);
+		//the stage the graphics family first reads a buffer uploaded on the transfer queue at
+		VkPipelineStageFlags getBufferDstStage(BufferUsageFlags usageFlags);
+		//the stage a batch on excuteQueue waits on another submission at, the stages the queue can't run are dropped
+		VkPipelineStageFlags getWaiteStage(VKExcuteQueue* excuteQueue, PipelineStageFlags stageFlags);
+		bool readbackBuffer(VKBuffer* buffer, void* pdata);
+		void replayCommands(CommandBuffer* cmdBuffer, const uint8_t* pdata, const uint8_t* pend);
+		//encode the command buffers of a submission whose second command buffers are all translated,
+		//runs on the thread that finished the last one. the submission is queued to the submit thread or submitted right away
+		void submitPending(VKSubmission* psubmission);
+		//hand an encoded submission to its queue, on the submit thread while it is enabled
+		void submitQueued(VKSubmission* psubmission);
+		void presentQueued(VKExcuteQueue* excuteQueue, uint32_t numSwapchain, VKSwapchain** swapchains, const uint32_t* imgIndexes, const VkSemaphore* waiteSemaphores, VkFence fence);
+		//keep a submission handed to its queue until IsFinished retired its sync objects, nobody may ask it again.
+		//the finished ones are dropped on every call
+		void trackSubmission(VKSubmission* psubmission);
+		//close the frame of excuteQueue without a present, behind the packets already pushed while the submit thread is enabled
+		void signalFrame(VKExcuteQueue* excuteQueue);
+		//translate and compile a slice of CreateGraphicsPipelines with one driver call, the handles of the pipelines that failed stay VK_NULL_HANDLE
+		void compileGraphicsPipelines(uint32_t numPipelines, const GraphicsPipelineCreateInfo* createInfos, VkPipeline* vkPipelines, VkPipelineLayout* pipelineLayouts);
+		static void compileGraphicsPipelinesTask(CommandBuffer* cmdBuffer, CommandBuffer* secondCmdBuffer, uintptr_t userData);
 	private:
+		//pipelines of a CreateGraphicsPipelines batch compiled by one task
+		static const uint32_t PIPELINE_CHUNK_SIZE = 8;
+		struct PipelineBatch;
+		struct GraphicsPipelineState;
+		//single time commands submitted and not seen finished yet
+		struct SingleTimeCommands {
+			VkCommandBuffer cmdBuffer;
+			submission_ptr submission;
+			std::vector<VKStaging> stagings;
+		};
+		//
 		ICmdBufferTaskQueue* mCmdBufferTaskQueue;
 		std::vector<VkExtensionProperties> mVkInstanceExtensions;
 		VkInstance mVkInstance;
@@ -117,5 +253,15 @@ namespace ASGI {
 		VKLogicDevice mLogicDevice;
 		VKSwapchain* mSwapchain = nullptr;
 		VKCmdBufferManager* mCmdBufferManger;
+		VKSubmitThread* mSubmitThread = nullptr;
+		std::mutex mSubmissionsMtx;
+		std::vector<submission_ptr> mSubmissionsInFlight;
+		std::mutex mSingleTimeMtx;
+		std::vector<SingleTimeCommands> mSingleTimeInFlight;
+		//buffers are created as copy sources for readbackBuffer
+		bool mCaptureEnabled = false;
+		//nullptr if the device has no transfer queue family
+		VKUploadEngine* mUploadEngine = nullptr;
+		VKStagingRing* mStagingRing = nullptr;
 	};
 }
\ No newline at end of file
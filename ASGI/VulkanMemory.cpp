@@ -77,6 +77,10 @@ namespace ASGI {
 			vmaFlushAllocation(mAllocator, ((VKMemoryVma*)pMemory)->mAllocation, offset, size);
 		}
 
+		void InvalidateAllocation(VKMemory* pMemory, uint32_t offset, uint32_t size) {
+			vmaInvalidateAllocation(mAllocator, ((VKMemoryVma*)pMemory)->mAllocation, offset, size);
+		}
+
 		void DestoryBuffer(VkBuffer buffer, VKMemory*& pMemory) override {
 			 vmaDestroyBuffer(mAllocator, buffer, ((VKMemoryVma*)pMemory)->mAllocation);
 			 delete (VKMemoryVma*)pMemory;
@@ -137,6 +137,7 @@ namespace ASGI {
 		virtual VkResult MapMemory(VKMemory* pMemory, void** pData) = 0;
 		virtual void UnMapMemory(VKMemory* pMemory) = 0;
 		virtual void FlushAllocation(VKMemory* pMemory, uint32_t offset, uint32_t size) = 0;
+		virtual void InvalidateAllocation(VKMemory* pMemory, uint32_t offset, uint32_t size) = 0;
 		virtual void DestoryBuffer(VkBuffer buffer, VKMemory*& pMemory) = 0;
 		virtual void DestoryImage(VkImage image, VKMemory*& pMemory) = 0;
 		virtual void DestoryImageView(VkImageView imageView) = 0;
@@ -1,4 +1,5 @@
 #include "VulkanResource.h"
+#include "VulkanDevice.h"
 
 #include "third_lib\SPIRV-Cross\spirv_cross.hpp"
 
@@ -6,29 +7,47 @@ namespace ASGI {
 	VKShaderModule::VKShaderModule(GraphicsContext* pcontext) : ShaderModule(pcontext) {
 	}
 	//
-	void VKCommandBuffer::ExcuteParallel(CommandBuffer* pCmdBuffer, CommandBuffer* pSecondCmdBuffer) {
+	void VKCommandBuffer::ExcuteParallel(CommandBuffer* pCmdBuffer, CommandBuffer* pSecondCmdBuffer, uintptr_t userData) {
 		auto tmp = VKCommandBuffer::Cast(pCmdBuffer);
-		//excute
-		auto pcmd = tmp->mHead->pnext;
-		while (pcmd != nullptr) {
-			pcmd->excute(pCmdBuffer);
-			pcmd = pcmd->pnext;
+		auto secondCmdBuffer = VKCommandBuffer::Cast(pSecondCmdBuffer);
+		//excute, the second buffer is encoded into a buffer of this worker's pool
+		if (secondCmdBuffer->AcquireThreadCmdBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY)) {
+			secondCmdBuffer->excuteCommands(secondCmdBuffer);
 		}
 		//
-		{
-			std::lock_guard<std::mutex> lock(tmp->mMtxSecondCmdBuffer);
-			--tmp->mUnExcuteSecondCmdBufferCount;
+		tmp->SecondCmdBufferFinished();
+	}
+
+	void VKCommandBuffer::SecondCmdBufferFinished() {
+		if (mNumPendingSecondCmdBuffers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			mPendingSubmission->DependencyFinished();
 		}
-		//
-		tmp->mCond.notify_all();
 	}
 
 	VkResult VKCommandBuffer::Excute() {
-		auto pcmd = mHead->pnext;
-		while (pcmd != nullptr) {
-			pcmd->excute(this);
-			pcmd = pcmd->pnext;
+		//the pools of an immediate buffer may have been recycled since it was recorded
+		if (mImmediateRecord) {
+			return mBindingItem != nullptr && mCmdBufferManager->IsValid(mBindingItem) ? VK_SUCCESS : VK_NOT_READY;
+		}
+		auto epoch = sResourceEpoch.load();
+		bool reusable = mSecondCmdBuffers.empty();
+		//the encode is kept for the submits of the frame it was made in, on the thread that made it. it is not pinned across frames,
+		//the pools of the frame are reset when the frame comes around again
+		if (reusable && mBindingItem != nullptr && mEncodedCmdBuffer == mBindingCmdBuffer && mEncodedHash == mStreamHash && mEncodedEpoch == epoch &&
+			mCmdBufferManager->IsCurrent(mBindingItem)) {
+			++mStatistics.numReusedEncodes;
+			return VK_SUCCESS;
 		}
+		//a recorded buffer can not be begun again, the stream is encoded into a fresh one
+		if (!AcquireThreadCmdBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY)) {
+			return VK_ERROR_OUT_OF_HOST_MEMORY;
+		}
+		//
+		excuteCommands(this);
+		//
+		mEncodedCmdBuffer = reusable ? mBindingCmdBuffer : nullptr;
+		mEncodedHash = mStreamHash;
+		mEncodedEpoch = epoch;
 		//
 		return VK_SUCCESS;
 	}
@@ -15,6 +15,7 @@
 
 #include "VulkanMemory.h"
 #include "VulkanCommand.h"
+#include "VulkanUpload.h"
 
 namespace spirv_cross {
 	class Compiler;
@@ -75,6 +76,28 @@ namespace ASGI {
 		const std::vector<VkDescriptorSet>& GetDescriptorSets() {
 			return mDescriptorSets;
 		}
+
+		//the upload of a resource bound to the descriptor sets, the command buffers that bind the program wait on it
+		inline void AddUpload(VKUpload* upload) {
+			for (size_t i = 0; i < mUploads.size();) {
+				if (mUploads[i] == upload) {
+					return;
+				}
+				if (mUploads[i]->IsClaimed()) {
+					mUploads[i] = mUploads.back();
+					mUploads.pop_back();
+					continue;
+				}
+				++i;
+			}
+			if (!upload->IsClaimed()) {
+				mUploads.push_back(upload);
+			}
+		}
+
+		inline const std::vector<upload_ptr>& GetUploads() {
+			return mUploads;
+		}
 	private:
 		VkDevice mLogicDevice;
 		shader_module_ptr mVertexShader;
@@ -87,24 +110,52 @@ namespace ASGI {
 		VkDescriptorPool mDescriptorPool;
 		std::vector<VkDescriptorSet> mDescriptorSets;
 		std::unordered_map<uint8_t, int> mIndexSet;
+		std::vector<upload_ptr> mUploads;
 	};
 
 	class VKImage2D;
+	//every frame in flight has its own acquire semaphore, render finished semaphore and fence.
+	//BeginFrame waits on the fence of the frame that used the slot numFramesInFlight frames ago,
+	//AcquireNextAttachment and Present without BeginFrame/EndFrame stay on the slot of the current frame
 	class VKSwapchain : public Swapchain {
 		friend class VulkanGI;
 	public:
 		inline static VKSwapchain* Cast(Swapchain* pchain) {
 			return (VKSwapchain*)pchain;
 		}
+
+		static const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+		struct Frame {
+			VkSemaphore acquireSemaphore;
+			VkSemaphore renderFinishedSemaphore;
+			VkFence fence;
+			//a submission signaled renderFinishedSemaphore, the present of the frame waits on it
+			bool rendered;
+			//a submission waits on acquireSemaphore, the other submissions of the frame do not wait on it again
+			bool acquireWaited;
+		};
 	public:
 		VKSwapchain(GraphicsContext* pcontext, VkDevice logicDevice) : Swapchain(pcontext) {
 			mLogicDevice = logicDevice;
+			mNumFramesInFlight = 2;
+			mFrameIndex = 0;
+			mInFrame = false;
 			//
 			VkSemaphoreCreateInfo semaphoreCreateInfo = {};
 			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 			semaphoreCreateInfo.pNext = nullptr;
 			semaphoreCreateInfo.flags = 0;
-			vkCreateSemaphore(mLogicDevice, &semaphoreCreateInfo, nullptr, &mPresentSemaphore);
+			VkFenceCreateInfo fenceCreateInfo = {};
+			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			fenceCreateInfo.pNext = nullptr;
+			fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+			for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+				vkCreateSemaphore(mLogicDevice, &semaphoreCreateInfo, nullptr, &mFrames[i].acquireSemaphore);
+				vkCreateSemaphore(mLogicDevice, &semaphoreCreateInfo, nullptr, &mFrames[i].renderFinishedSemaphore);
+				vkCreateFence(mLogicDevice, &fenceCreateInfo, nullptr, &mFrames[i].fence);
+				mFrames[i].rendered = false;
+				mFrames[i].acquireWaited = false;
+			}
 		}
 
 		inline Format GetColorFormat() override {
@@ -124,10 +175,38 @@ namespace ASGI {
 		}
 
 		inline uint32_t AcquireNextAttachment() override {
-			vkAcquireNextImageKHR(mLogicDevice, mVkSwapchain, UINT64_MAX, mPresentSemaphore, nullptr, &mCurrentAttachmentIndex);
+			//the submit thread may be presenting the swapchain
+			std::lock_guard<std::mutex> lock(mMtxPresent);
+			auto &frame = GetCurrentFrame();
+			vkAcquireNextImageKHR(mLogicDevice, mVkSwapchain, UINT64_MAX, frame.acquireSemaphore, nullptr, &mCurrentAttachmentIndex);
+			frame.acquireWaited = false;
 			return mCurrentAttachmentIndex;
 		}
 
+		//wait until the frame numFramesInFlight frames ago is finished and acquire the next attachment with the semaphore of its slot
+		inline uint32_t BeginFrame() {
+			auto &frame = GetCurrentFrame();
+			vkWaitForFences(mLogicDevice, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+			vkResetFences(mLogicDevice, 1, &frame.fence);
+			frame.rendered = false;
+			mInFrame = true;
+			return AcquireNextAttachment();
+		}
+
+		//the present of the frame is on its way and the fence is signaled after it, the next frame takes the next slot
+		inline void EndFrame() {
+			mInFrame = false;
+			++mFrameIndex;
+		}
+
+		inline bool IsInFrame() {
+			return mInFrame;
+		}
+
+		inline Frame& GetCurrentFrame() {
+			return mFrames[mFrameIndex % mNumFramesInFlight];
+		}
+
 		inline Image2D* GetColorAttachment(uint32_t index) override {
 			if (index >= mColorAttachments.size()) {
 				return nullptr;
@@ -147,7 +226,7 @@ namespace ASGI {
 		}
 
 		inline VkSemaphore& GetPresentSemaphore() {
-			return mPresentSemaphore;
+			return GetCurrentFrame().acquireSemaphore;
 		}
 	private:
 		VkDevice mLogicDevice;
@@ -157,11 +236,15 @@ namespace ASGI {
 		VkFormat mDepthStencilFormat;
 		VkPresentModeKHR mVkPresentMode;
 		VkSwapchainKHR mVkSwapchain = nullptr;
-		VkSemaphore mPresentSemaphore;
+		Frame mFrames[MAX_FRAMES_IN_FLIGHT];
+		uint32_t mNumFramesInFlight;
+		uint64_t mFrameIndex;
+		bool mInFrame;
 		std::vector<VKImage2D*> mColorAttachments;
 		std::vector<VKImage2D*> mDepthStencilAttachments;
 		Extent2D mExtent;
 		uint32_t mCurrentAttachmentIndex;
+		std::mutex mMtxPresent;
 	};
 
 	class VKContext : public GraphicsContext {
@@ -233,6 +316,10 @@ namespace ASGI {
 		inline VkPipelineLayout GetPipelineLayout() {
 			return mVkPipelineLayout;
 		}
+	protected:
+		~VKGraphicsPipeline() {
+			VKCommandBuffer::InvalidateEncodedCommands();
+		}
 	private:
 		VkPipelineLayout mVkPipelineLayout;
 		VkPipeline mVkPipeLine;
@@ -274,6 +361,8 @@ namespace ASGI {
 	public:
 		VKBuffer(GraphicsContext* pcontext, BufferUsageFlags usageFlags, uint64_t size) : Buffer(pcontext, usageFlags, size) {
 			mMemory = nullptr;
+			mVkUsageFlags = 0;
+			mInUse = false;
 		}
 
 		inline VkBuffer GetVKBuffer() {
@@ -281,12 +370,20 @@ namespace ASGI {
 		}
 	protected:
 		~VKBuffer() {
+			VKCommandBuffer::InvalidateEncodedCommands();
 			VKMemoryManager::Instance()->DestoryBuffer(mVkBuffer, mMemory);
 		}
 		
 	protected:
 		VkBuffer mVkBuffer;
 		VKMemory* mMemory;
+		VkBufferUsageFlags mVkUsageFlags;
+		//the last upload on the transfer queue, and whether the graphics family may use the buffer already.
+		//a buffer is uploaded on the transfer queue only before that
+		upload_ptr mPendingUpload;
+		std::atomic<bool> mInUse;
+		//the single time commands of the last copy on the graphics queue
+		submission_ptr mPendingCopy;
 	};
 
 	class VKBufferUpdateContext : public BufferUpdateContext {
@@ -314,6 +411,7 @@ namespace ASGI {
 		friend class VulkanGI;
 	public:
 		~VKImage() {
+			VKCommandBuffer::InvalidateEncodedCommands();
 			VKMemoryManager::Instance()->DestoryImage(mVkImage, mMemory);
 		}
 		VKImage2D* asVKImage2D() { return nullptr; }
@@ -348,6 +446,7 @@ namespace ASGI {
 		}
 	protected:
 		~VKImageView() {
+			VKCommandBuffer::InvalidateEncodedCommands();
 			VKMemoryManager::Instance()->DestoryImageView(mImageView);
 		}
 	private:
@@ -365,6 +464,7 @@ namespace ASGI {
 	public:
 		VKImage2D(GraphicsContext* pcontext, Format format, uint32_t sizeX, uint32_t sizeY, uint32_t numMip) : Image2D(pcontext, format, sizeX, sizeY, numMip) {
 			mLayoutBarrier.resize(numMip, VKImageLayoutBarrier::Undefined);
+			mInUse = false;
 		}
 		//
 		ImageView* GetOrigView() override {
@@ -372,6 +472,9 @@ namespace ASGI {
 		}
 	private:
 		std::vector<VKImageLayoutBarrier> mLayoutBarrier;
+		//same as VKBuffer
+		upload_ptr mPendingUpload;
+		std::atomic<bool> mInUse;
 	};
 
 
@@ -424,6 +527,8 @@ namespace ASGI {
 
 		inline void SetClearValue(uint32_t index, ClearValue clearValue) override{
 			mClearValue[index] = clearValue;
+			//clear values are read when the commands are encoded
+			VKCommandBuffer::InvalidateEncodedCommands();
 		}
 	public:
 		VKFrameBuffer(GraphicsContext* pcontext) : FrameBuffer(pcontext) {}
@@ -444,10 +549,20 @@ namespace ASGI {
 			return mFrameBuffer;
 		}
 
+		//ClearValue has the same layout as VkClearValue, so the stored values are passed to vulkan as they are
+		inline const VkClearValue* GetVKClearValues() {
+			static_assert(sizeof(ClearValue) == sizeof(VkClearValue), "ClearValue must match VkClearValue");
+			return (const VkClearValue*)mClearValue.data();
+		}
+
 		inline void AddAttachment(ImageView* attachment, const ClearValue& clearValue) {
 			mAttachments.push_back(attachment);
 			mClearValue.push_back(clearValue);
 		}
+	protected:
+		~VKFrameBuffer() {
+			VKCommandBuffer::InvalidateEncodedCommands();
+		}
 	private:
 		VkFramebuffer mFrameBuffer;
 		std::vector<image_view_ptr> mAttachments;
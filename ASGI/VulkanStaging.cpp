@@ -0,0 +1,174 @@
+#include "VulkanStaging.h"
+#include "VulkanMemory.h"
+
+namespace ASGI {
+	static inline VkDeviceSize alignOffset(VkDeviceSize offset, VkDeviceSize alignment) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	VKStagingRing::VKStagingRing(VkDeviceSize size, VkDeviceSize maxSize) {
+		mSize = size;
+		mMaxSize = maxSize;
+	}
+
+	VKStagingRing::~VKStagingRing() {
+		for (auto chunk : mChunks) {
+			destroyChunk(chunk);
+		}
+	}
+
+	bool VKStagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment, VKStaging& staging) {
+		if (size == 0) {
+			size = 1;
+		}
+		if (alignment == 0) {
+			alignment = 1;
+		}
+		if (STAGING_RING_ENABLED) {
+			std::lock_guard<std::mutex> lock(mMtx);
+			if (!mChunks.empty() && allocate(mChunks.back(), size, alignment, staging)) {
+				return true;
+			}
+			//the ranges in flight fill the ring, a larger chunk takes the new ones
+			auto chunkSize = mChunks.empty() ? mSize : mChunks.back()->size * 2;
+			while (chunkSize < size) {
+				chunkSize *= 2;
+			}
+			if (chunkSize <= mMaxSize) {
+				auto chunk = createChunk(chunkSize);
+				if (chunk != nullptr) {
+					if (!mChunks.empty() && mChunks.back()->ranges.empty()) {
+						destroyChunk(mChunks.back());
+						mChunks.pop_back();
+					}
+					mChunks.push_back(chunk);
+					if (allocate(chunk, size, alignment, staging)) {
+						return true;
+					}
+				}
+			}
+		}
+		//
+		VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		bufferInfo.size = size;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VKMemory* pmemory = nullptr;
+		if (VKMemoryManager::Instance()->CreateBuffer(bufferInfo, &staging.buffer, VKMemory::MemoryUsage::VK_MEMORY_USAGE_CPU_ONLY, pmemory) != VK_SUCCESS) {
+			return false;
+		}
+		if (VKMemoryManager::Instance()->MapMemory(pmemory, &staging.pdata) != VK_SUCCESS) {
+			VKMemoryManager::Instance()->DestoryBuffer(staging.buffer, pmemory);
+			return false;
+		}
+		staging.offset = 0;
+		staging.memory = pmemory;
+		staging.chunk = nullptr;
+		return true;
+	}
+
+	void VKStagingRing::Release(VKStaging& staging) {
+		if (staging.memory != nullptr) {
+			VKMemoryManager::Instance()->UnMapMemory(staging.memory);
+			VKMemoryManager::Instance()->DestoryBuffer(staging.buffer, staging.memory);
+			return;
+		}
+		if (staging.chunk == nullptr) {
+			return;
+		}
+		//
+		std::lock_guard<std::mutex> lock(mMtx);
+		auto chunk = staging.chunk;
+		staging.chunk = nullptr;
+		chunk->ranges[(size_t)(staging.id - chunk->firstId)].released = true;
+		while (!chunk->ranges.empty() && chunk->ranges.front().released) {
+			chunk->ranges.pop_front();
+			++chunk->firstId;
+		}
+		//a chunk that no longer takes new ranges is destroyed once drained
+		if (chunk != mChunks.back() && chunk->ranges.empty()) {
+			for (size_t i = 0; i < mChunks.size(); ++i) {
+				if (mChunks[i] == chunk) {
+					mChunks.erase(mChunks.begin() + i);
+					break;
+				}
+			}
+			destroyChunk(chunk);
+		}
+	}
+
+	bool VKStagingRing::allocate(Chunk* chunk, VkDeviceSize size, VkDeviceSize alignment, VKStaging& staging) {
+		VkDeviceSize offset = 0;
+		if (!chunk->ranges.empty()) {
+			auto &front = chunk->ranges.front();
+			auto &back = chunk->ranges.back();
+			auto head = alignOffset(back.end, alignment);
+			if (back.offset >= front.offset) {
+				//the ranges in flight are contiguous, the space behind them is taken first, then the space in front of them
+				if (head + size <= chunk->size) {
+					offset = head;
+				}
+				else if (size <= front.offset) {
+					offset = 0;
+				}
+				else {
+					return false;
+				}
+			}
+			else if (head + size <= front.offset) {
+				offset = head;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (size > chunk->size) {
+			return false;
+		}
+		//
+		Range range;
+		range.offset = offset;
+		range.end = offset + size;
+		range.released = false;
+		chunk->ranges.push_back(range);
+		staging.buffer = chunk->buffer;
+		staging.offset = offset;
+		staging.pdata = chunk->pdata + offset;
+		staging.memory = nullptr;
+		staging.chunk = chunk;
+		staging.id = chunk->firstId + chunk->ranges.size() - 1;
+		return true;
+	}
+
+	VKStagingRing::Chunk* VKStagingRing::createChunk(VkDeviceSize size) {
+		VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		bufferInfo.size = size;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VKMemory* pmemory = nullptr;
+		if (VKMemoryManager::Instance()->CreateBuffer(bufferInfo, &buffer, VKMemory::MemoryUsage::VK_MEMORY_USAGE_CPU_ONLY, pmemory) != VK_SUCCESS) {
+			return nullptr;
+		}
+		//mapped for the lifetime of the chunk
+		void* pdata = nullptr;
+		if (VKMemoryManager::Instance()->MapMemory(pmemory, &pdata) != VK_SUCCESS) {
+			VKMemoryManager::Instance()->DestoryBuffer(buffer, pmemory);
+			return nullptr;
+		}
+		//
+		auto chunk = new Chunk();
+		chunk->buffer = buffer;
+		chunk->memory = pmemory;
+		chunk->pdata = (uint8_t*)pdata;
+		chunk->size = size;
+		chunk->firstId = 0;
+		return chunk;
+	}
+
+	void VKStagingRing::destroyChunk(Chunk* chunk) {
+		VKMemoryManager::Instance()->UnMapMemory(chunk->memory);
+		VKMemoryManager::Instance()->DestoryBuffer(chunk->buffer, chunk->memory);
+		delete chunk;
+	}
+}
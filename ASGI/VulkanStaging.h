@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include "VulkanSDK\1.1.77.0\Include\vulkan\vulkan.h"
+#include "Definitions.hpp"
+
+namespace ASGI {
+	class VKMemory;
+	struct VKStaging;
+	//a persistently mapped CPU_ONLY buffer the uploads write their data into. the ranges are taken in order and wrap around,
+	//a range is reused once it and the ranges taken before it are released, which the owner of a range does after the fence of
+	//its copy has signaled. a full ring adds a chunk twice the size up to maxSize, the chunks before it are destroyed once drained
+	class VKStagingRing {
+	public:
+		//the offset of a buffer copy, an image copy passes the size of its texel block times 4
+		static const VkDeviceSize BUFFER_ALIGNMENT = 16;
+	public:
+		VKStagingRing(VkDeviceSize size, VkDeviceSize maxSize);
+		~VKStagingRing();
+
+		//an upload larger than the ring may grow, or one made while the largest ring is full, gets a buffer of its own. false if
+		//no staging memory could be created. the data is written through staging.pdata, the memory is coherent
+		bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VKStaging& staging);
+		//the copy reading the range has finished, or was never submitted
+		void Release(VKStaging& staging);
+	private:
+		struct Range {
+			VkDeviceSize offset;
+			VkDeviceSize end;
+			bool released;
+		};
+		struct Chunk {
+			VkBuffer buffer;
+			VKMemory* memory;
+			uint8_t* pdata;
+			VkDeviceSize size;
+			//the ranges in flight in the order they were taken, firstId is the id of the front one
+			std::deque<Range> ranges;
+			uint64_t firstId;
+		};
+		friend struct VKStaging;
+		//called with mMtx held
+		bool allocate(Chunk* chunk, VkDeviceSize size, VkDeviceSize alignment, VKStaging& staging);
+		Chunk* createChunk(VkDeviceSize size);
+		void destroyChunk(Chunk* chunk);
+	private:
+		std::mutex mMtx;
+		VkDeviceSize mSize;
+		VkDeviceSize mMaxSize;
+		//the last chunk takes the new ranges
+		std::vector<Chunk*> mChunks;
+	};
+
+	//the source of one upload, a range of the staging ring or a buffer of its own
+	struct VKStaging {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		void* pdata;
+		//the buffer of its own, nullptr for a range of the ring
+		VKMemory* memory;
+		VKStagingRing::Chunk* chunk;
+		uint64_t id;
+		//
+		VKStaging() {
+			buffer = VK_NULL_HANDLE;
+			offset = 0;
+			pdata = nullptr;
+			memory = nullptr;
+			chunk = nullptr;
+			id = 0;
+		}
+	};
+}
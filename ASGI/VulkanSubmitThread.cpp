@@ -0,0 +1,114 @@
+#include <chrono>
+#include "VulkanSubmitThread.h"
+#include "VulkanGI.h"
+
+namespace ASGI {
+	typedef std::chrono::steady_clock SubmitClock;
+
+	VKSubmitThread::VKSubmitThread(VulkanGI* pGI) : mRing(RING_CAPACITY) {
+		mGI = pGI;
+		mNumPending = 0;
+		mNumSleeping = 0;
+		mNumPushed = 0;
+		mMaxQueueDepth = 0;
+		mExit = false;
+		mNumProcessed = 0;
+		mTotalLatency = 0.0;
+		mMaxLatency = 0.0;
+		mTotalQueueTime = 0.0;
+		mThread = std::thread(&VKSubmitThread::threadLoop, this);
+	}
+
+	VKSubmitThread::~VKSubmitThread() {
+		{
+			std::lock_guard<std::mutex> lock(mMtx);
+			mExit = true;
+		}
+		mCond.notify_all();
+		mThread.join();
+	}
+
+	void VKSubmitThread::Push(Packet& packet) {
+		packet.pushTime = SubmitClock::now().time_since_epoch().count();
+		//counted before it is visible, so the thread never takes it while the count is still 0
+		auto depth = mNumPending.fetch_add(1, std::memory_order_seq_cst) + 1;
+		auto maxDepth = mMaxQueueDepth.load(std::memory_order_relaxed);
+		while (maxDepth < depth && !mMaxQueueDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed)) {
+		}
+		while (!mRing.Push(packet)) {
+			std::this_thread::yield();
+		}
+		mNumPushed.fetch_add(1, std::memory_order_release);
+		//the thread counts itself as sleeping before it checks mNumPending, so one of the two sees the other
+		if (mNumSleeping.load(std::memory_order_seq_cst) > 0) {
+			{
+				std::lock_guard<std::mutex> lock(mMtx);
+			}
+			mCond.notify_one();
+		}
+	}
+
+	void VKSubmitThread::Flush() {
+		auto numPushed = mNumPushed.load(std::memory_order_acquire);
+		std::unique_lock<std::mutex> lk(mMtx);
+		mFlushCond.wait(lk, [&] {return mNumProcessed >= numPushed; });
+	}
+
+	SubmitThreadStatistics VKSubmitThread::GetStatistics() {
+		SubmitThreadStatistics statistics;
+		std::lock_guard<std::mutex> lock(mMtx);
+		statistics.numPackets = mNumProcessed;
+		statistics.queueDepth = mNumPending.load(std::memory_order_relaxed);
+		statistics.maxQueueDepth = mMaxQueueDepth.load(std::memory_order_relaxed);
+		if (mNumProcessed > 0) {
+			statistics.averageLatency = mTotalLatency / mNumProcessed;
+			statistics.averageQueueTime = mTotalQueueTime / mNumProcessed;
+		}
+		statistics.maxLatency = mMaxLatency;
+		return statistics;
+	}
+
+	void VKSubmitThread::threadLoop() {
+		Packet packet;
+		while (true) {
+			if (mRing.Pop(packet)) {
+				mNumPending.fetch_sub(1, std::memory_order_relaxed);
+				auto start = SubmitClock::now();
+				if (packet.type == PACKET_SUBMIT) {
+					mGI->submitQueued(packet.submission);
+				}
+				else if (packet.type == PACKET_PRESENT) {
+					mGI->presentQueued(packet.excuteQueue, packet.numSwapchains, packet.swapchains, packet.imgIndexes, packet.waiteSemaphores, packet.fence);
+					if (packet.frameIndex != NO_FRAME) {
+						std::lock_guard<std::mutex> lock(packet.excuteQueue->GetSubmitMutex());
+						mGI->mCmdBufferManger->SignalFrame(packet.excuteQueue->GetVKQueue(), packet.frameIndex);
+					}
+				}
+				else {
+					std::lock_guard<std::mutex> lock(packet.excuteQueue->GetSubmitMutex());
+					mGI->mCmdBufferManger->SignalFrame(packet.excuteQueue->GetVKQueue(), packet.frameIndex);
+				}
+				auto end = SubmitClock::now();
+				//
+				auto latency = std::chrono::duration<double, std::milli>(start - SubmitClock::time_point(SubmitClock::duration(packet.pushTime))).count();
+				{
+					std::lock_guard<std::mutex> lock(mMtx);
+					++mNumProcessed;
+					mTotalLatency += latency;
+					mMaxLatency = latency > mMaxLatency ? latency : mMaxLatency;
+					mTotalQueueTime += std::chrono::duration<double, std::milli>(end - start).count();
+				}
+				mFlushCond.notify_all();
+				continue;
+			}
+			//
+			std::unique_lock<std::mutex> lk(mMtx);
+			mNumSleeping.fetch_add(1, std::memory_order_seq_cst);
+			mCond.wait(lk, [&] {return mExit || mNumPending.load(std::memory_order_seq_cst) > 0; });
+			mNumSleeping.fetch_sub(1, std::memory_order_relaxed);
+			if (mExit && mNumPending.load(std::memory_order_acquire) == 0) {
+				return;
+			}
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "MPMCRing.h"
+#include "VulkanDevice.h"
+#include "VulkanResource.h"
+
+namespace ASGI {
+	class VulkanGI;
+	//owns the queue calls while it is enabled, the submissions encoded on the recording threads and workers
+	//are pushed as packets and handed to the queues in the order they were pushed.
+	//a packet pushed while the ring is full waits for room, running it on the pushing thread would break that order
+	class VKSubmitThread {
+	public:
+		static const uint32_t MAX_PRESENT_SWAPCHAINS = 4;
+		static const uint32_t RING_CAPACITY = 256;
+		//
+		//frameIndex of a present that doesn't close the frame
+		static const uint64_t NO_FRAME = UINT64_MAX;
+		//
+		enum PacketType : uint32_t {
+			PACKET_SUBMIT,
+			PACKET_PRESENT,
+			//close the frame frameIndex of excuteQueue without a present
+			PACKET_SIGNAL_FRAME,
+		};
+		struct Packet {
+			PacketType type;
+			//PACKET_SUBMIT, the thread owns a reference of the submission
+			VKSubmission* submission;
+			//PACKET_PRESENT, the image indexes are taken when the present is pushed
+			VKExcuteQueue* excuteQueue;
+			uint32_t numSwapchains;
+			VKSwapchain* swapchains[MAX_PRESENT_SWAPCHAINS];
+			uint32_t imgIndexes[MAX_PRESENT_SWAPCHAINS];
+			//waited on besides the queue semaphore, VK_NULL_HANDLE for none. the fence is signaled after the present
+			VkSemaphore waiteSemaphores[MAX_PRESENT_SWAPCHAINS];
+			VkFence fence;
+			uint64_t frameIndex;
+			//steady clock ticks, set by Push
+			int64_t pushTime;
+		};
+	public:
+		VKSubmitThread(VulkanGI* pGI);
+		//the packets left are handed to the queues before the thread exits
+		~VKSubmitThread();
+		//
+		void Push(Packet& packet);
+		//block until every packet pushed so far is handed to its queue
+		void Flush();
+		SubmitThreadStatistics GetStatistics();
+	private:
+		void threadLoop();
+	private:
+		VulkanGI* mGI;
+		MPMCRing<Packet> mRing;
+		std::thread mThread;
+		//packets pushed and not taken yet, and whether the thread sleeps on mCond
+		std::atomic<uint32_t> mNumPending;
+		std::atomic<uint32_t> mNumSleeping;
+		std::atomic<uint64_t> mNumPushed;
+		std::atomic<uint32_t> mMaxQueueDepth;
+		std::mutex mMtx;
+		std::condition_variable mCond;
+		std::condition_variable mFlushCond;
+		bool mExit;
+		//guarded by mMtx
+		uint64_t mNumProcessed;
+		double mTotalLatency;
+		double mMaxLatency;
+		double mTotalQueueTime;
+	};
+}
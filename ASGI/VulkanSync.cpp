@@ -0,0 +1,117 @@
+#include "VulkanSync.h"
+
+namespace ASGI {
+	VKSyncPool::VKSyncPool(VkDevice logicDevice) {
+		mLogicDevice = logicDevice;
+	}
+
+	VKSyncPool::~VKSyncPool() {
+		for (auto &batch : mRetiredBatches) {
+			mFreeFences.push_back(batch.fence);
+			mFreeSemaphores.insert(mFreeSemaphores.end(), batch.semaphores.begin(), batch.semaphores.end());
+		}
+		for (auto fence : mFreeFences) {
+			vkDestroyFence(mLogicDevice, fence, nullptr);
+		}
+		for (auto semaphore : mFreeSemaphores) {
+			vkDestroySemaphore(mLogicDevice, semaphore, nullptr);
+		}
+	}
+
+	VkFence VKSyncPool::AcquireFence() {
+		{
+			std::lock_guard<std::mutex> lock(mMtx);
+			if (mFreeFences.empty()) {
+				recycle();
+			}
+			if (!mFreeFences.empty()) {
+				auto fence = mFreeFences.back();
+				mFreeFences.pop_back();
+				return fence;
+			}
+		}
+		//
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceCreateInfo.pNext = nullptr;
+		fenceCreateInfo.flags = 0;
+		VkFence fence = VK_NULL_HANDLE;
+		if (vkCreateFence(mLogicDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+			return VK_NULL_HANDLE;
+		}
+		return fence;
+	}
+
+	VkSemaphore VKSyncPool::AcquireSemaphore() {
+		{
+			std::lock_guard<std::mutex> lock(mMtx);
+			if (mFreeSemaphores.empty()) {
+				recycle();
+			}
+			if (!mFreeSemaphores.empty()) {
+				auto semaphore = mFreeSemaphores.back();
+				mFreeSemaphores.pop_back();
+				return semaphore;
+			}
+		}
+		//
+		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreCreateInfo.pNext = nullptr;
+		semaphoreCreateInfo.flags = 0;
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		if (vkCreateSemaphore(mLogicDevice, &semaphoreCreateInfo, nullptr, &semaphore) != VK_SUCCESS) {
+			return VK_NULL_HANDLE;
+		}
+		return semaphore;
+	}
+
+	void VKSyncPool::ReleaseFence(VkFence fence) {
+		if (fence == VK_NULL_HANDLE) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mMtx);
+		mFreeFences.push_back(fence);
+	}
+
+	void VKSyncPool::Retire(VkFence fence, uint32_t numSemaphores, const VkSemaphore* semaphores) {
+		if (fence == VK_NULL_HANDLE) {
+			for (uint32_t i = 0; i < numSemaphores; ++i) {
+				vkDestroySemaphore(mLogicDevice, semaphores[i], nullptr);
+			}
+			return;
+		}
+		//
+		RetiredBatch batch;
+		batch.fence = fence;
+		batch.semaphores.assign(semaphores, semaphores + numSemaphores);
+		std::lock_guard<std::mutex> lock(mMtx);
+		mRetiredBatches.push_back(std::move(batch));
+	}
+
+	bool VKSyncPool::IsSignaled(VkFence fence) {
+		return vkGetFenceStatus(mLogicDevice, fence) == VK_SUCCESS;
+	}
+
+	void VKSyncPool::recycle() {
+		//the batches run on different queues, every one of them is polled
+		std::vector<VkFence> signaledFences;
+		for (size_t i = 0; i < mRetiredBatches.size();) {
+			auto &batch = mRetiredBatches[i];
+			if (vkGetFenceStatus(mLogicDevice, batch.fence) != VK_SUCCESS) {
+				++i;
+				continue;
+			}
+			signaledFences.push_back(batch.fence);
+			mFreeSemaphores.insert(mFreeSemaphores.end(), batch.semaphores.begin(), batch.semaphores.end());
+			if (i + 1 < mRetiredBatches.size()) {
+				batch = std::move(mRetiredBatches.back());
+			}
+			mRetiredBatches.pop_back();
+		}
+		//
+		if (!signaledFences.empty() && vkResetFences(mLogicDevice, (uint32_t)signaledFences.size(), signaledFences.data()) == VK_SUCCESS) {
+			mFreeFences.insert(mFreeFences.end(), signaledFences.begin(), signaledFences.end());
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include "VulkanSDK\1.1.77.0\Include\vulkan\vulkan.h"
+
+namespace ASGI {
+	//fences and binary semaphores are recycled instead of being owned one per queue.
+	//a fence is handed out unsignaled, a semaphore unsignaled and without a pending wait.
+	//what a batch used is retired with the fence of that batch and comes back once the fence has signaled,
+	//the free lists are refilled from the retired batches only when they run empty
+	class VKSyncPool {
+	public:
+		VKSyncPool(VkDevice logicDevice);
+		//the device must be idle
+		~VKSyncPool();
+		//VK_NULL_HANDLE if the object can't be created
+		VkFence AcquireFence();
+		VkSemaphore AcquireSemaphore();
+		//the fence never reached the queue
+		void ReleaseFence(VkFence fence);
+		//the fence and the semaphores the batch of the fence waited on are reused once the fence has signaled.
+		//without a fence the batch never reached the queue, the semaphores may still be signaled and are destroyed
+		void Retire(VkFence fence, uint32_t numSemaphores, const VkSemaphore* semaphores);
+		//the fence has signaled, polled without blocking
+		bool IsSignaled(VkFence fence);
+	private:
+		//poll the retired batches, called with mMtx held
+		void recycle();
+	private:
+		struct RetiredBatch {
+			VkFence fence;
+			std::vector<VkSemaphore> semaphores;
+		};
+		VkDevice mLogicDevice;
+		std::mutex mMtx;
+		std::vector<VkFence> mFreeFences;
+		std::vector<VkSemaphore> mFreeSemaphores;
+		std::vector<RetiredBatch> mRetiredBatches;
+	};
+}
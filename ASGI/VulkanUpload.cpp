@@ -0,0 +1,366 @@
+#include "VulkanUpload.h"
+
+namespace ASGI {
+	VKUpload::VKUpload(VKUploadEngine* engine, uint64_t serial, VkPipelineStageFlags dstStage) {
+		mEngine = engine;
+		mClaimed = false;
+		mSerial = serial;
+		mFailed = false;
+		mSemaphore = VK_NULL_HANDLE;
+		mDstStage = dstStage;
+	}
+
+	VKUpload::~VKUpload() {
+		if (mSemaphore != VK_NULL_HANDLE) {
+			mEngine->mSyncPool->Retire(VK_NULL_HANDLE, 1, &mSemaphore);
+		}
+	}
+
+	void VKUpload::RecordAcquire(VkCommandBuffer cmdBuffer) {
+		std::vector<VkBufferMemoryBarrier> bufferBarriers(mBufferBarriers);
+		std::vector<VkImageMemoryBarrier> imageBarriers(mImageBarriers);
+		for (auto &barrier : bufferBarriers) {
+			barrier.srcAccessMask = 0;
+		}
+		for (auto &barrier : imageBarriers) {
+			barrier.srcAccessMask = 0;
+		}
+		//the semaphore wait is at mDstStage, the barrier starts there
+		vkCmdPipelineBarrier(cmdBuffer, mDstStage, mDstStage, 0,
+			0, nullptr,
+			(uint32_t)bufferBarriers.size(), bufferBarriers.empty() ? nullptr : bufferBarriers.data(),
+			(uint32_t)imageBarriers.size(), imageBarriers.empty() ? nullptr : imageBarriers.data());
+	}
+
+	VKUploadEngine::VKUploadEngine(VkDevice logicDevice, VkQueue transferQueue, uint32_t transferQueueFamilyIndex, uint32_t graphicsQueueFamilyIndex, VKSyncPool* syncPool, VKStagingRing* stagingRing) {
+		mLogicDevice = logicDevice;
+		mTransferQueue = transferQueue;
+		mTransferQueueFamilyIndex = transferQueueFamilyIndex;
+		mGraphicsQueueFamilyIndex = graphicsQueueFamilyIndex;
+		mSyncPool = syncPool;
+		mStagingRing = stagingRing;
+		mCmdPool = VK_NULL_HANDLE;
+		mOpenBatch.cmdBuffer = VK_NULL_HANDLE;
+		mSerial = 0;
+		mCompletedSerial = 0;
+	}
+
+	VKUploadEngine::~VKUploadEngine() {
+		std::lock_guard<std::mutex> lock(mMtx);
+		flush();
+		for (auto &batch : mBatches) {
+			vkWaitForFences(mLogicDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+			releaseBatch(batch);
+		}
+		mBatches.clear();
+		if (mCmdPool != VK_NULL_HANDLE) {
+			vkDestroyCommandPool(mLogicDevice, mCmdPool, nullptr);
+		}
+	}
+
+	bool VKUploadEngine::Init() {
+		VkCommandPoolCreateInfo cmdPoolInfo = {};
+		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmdPoolInfo.queueFamilyIndex = mTransferQueueFamilyIndex;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		return vkCreateCommandPool(mLogicDevice, &cmdPoolInfo, nullptr, &mCmdPool) == VK_SUCCESS;
+	}
+
+	upload_ptr VKUploadEngine::CopyBuffer(VKUpload* pendingUpload, const VKStaging& staging, VkBuffer dstBuffer, const VkBufferCopy& region, VkPipelineStageFlags dstStage) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		if (!isPending(pendingUpload) || (mOpenBatch.cmdBuffer == VK_NULL_HANDLE && !beginBatch())) {
+			return nullptr;
+		}
+		//
+		upload_ptr upload = pendingUpload;
+		if (upload != nullptr) {
+			//the copies of a batch may overlap, a second write to the resource waits for the first one
+			VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(mOpenBatch.cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		else {
+			upload = new VKUpload(this, mOpenBatch.serial, dstStage);
+			VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			barrier.srcQueueFamilyIndex = mTransferQueueFamilyIndex;
+			barrier.dstQueueFamilyIndex = mGraphicsQueueFamilyIndex;
+			barrier.buffer = dstBuffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+			upload->mBufferBarriers.push_back(barrier);
+			mOpenBatch.uploads.push_back(upload);
+		}
+		vkCmdCopyBuffer(mOpenBatch.cmdBuffer, staging.buffer, dstBuffer, 1, &region);
+		mOpenBatch.stagings.push_back(staging);
+		mOpenBatch.stagingSize += region.size;
+		endCopy();
+		//
+		return upload;
+	}
+
+	upload_ptr VKUploadEngine::CopyBufferToImage(VKUpload* pendingUpload, const VKStaging& staging, VkImage dstImage, const VkBufferImageCopy& region,
+		VkImageLayout finalLayout, VkAccessFlags finalAccess, VkPipelineStageFlags dstStage) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		if (!isPending(pendingUpload) || (mOpenBatch.cmdBuffer == VK_NULL_HANDLE && !beginBatch())) {
+			return nullptr;
+		}
+		//
+		upload_ptr upload = pendingUpload;
+		if (upload == nullptr) {
+			upload = new VKUpload(this, mOpenBatch.serial, dstStage);
+			mOpenBatch.uploads.push_back(upload);
+		}
+		bool levelCopied = false;
+		for (auto &barrier : upload->mImageBarriers) {
+			levelCopied |= barrier.subresourceRange.baseMipLevel == region.imageSubresource.mipLevel;
+		}
+		//
+		VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		barrier.image = dstImage;
+		barrier.subresourceRange.aspectMask = region.imageSubresource.aspectMask;
+		barrier.subresourceRange.baseMipLevel = region.imageSubresource.mipLevel;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		if (levelCopied) {
+			VkMemoryBarrier memoryBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+			memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(mOpenBatch.cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+		else {
+			//the resource was never used, what the level held before is dropped
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			vkCmdPipelineBarrier(mOpenBatch.cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			//
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = finalAccess;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = finalLayout;
+			barrier.srcQueueFamilyIndex = mTransferQueueFamilyIndex;
+			barrier.dstQueueFamilyIndex = mGraphicsQueueFamilyIndex;
+			upload->mImageBarriers.push_back(barrier);
+		}
+		vkCmdCopyBufferToImage(mOpenBatch.cmdBuffer, staging.buffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		mOpenBatch.stagings.push_back(staging);
+		endCopy();
+		//
+		return upload;
+	}
+
+	bool VKUploadEngine::Flush() {
+		std::lock_guard<std::mutex> lock(mMtx);
+		return flush();
+	}
+
+	bool VKUploadEngine::TakeSemaphore(VKUpload* upload, VkSemaphore& semaphore) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		semaphore = VK_NULL_HANDLE;
+		if (mOpenBatch.cmdBuffer != VK_NULL_HANDLE && upload->mSerial == mOpenBatch.serial) {
+			flush();
+		}
+		if (upload->mFailed) {
+			return false;
+		}
+		//a finished batch needs no wait
+		if (upload->mSerial <= mCompletedSerial) {
+			return true;
+		}
+		semaphore = upload->mSemaphore;
+		upload->mSemaphore = VK_NULL_HANDLE;
+		if (semaphore == VK_NULL_HANDLE) {
+			return waiteSerial(upload->mSerial);
+		}
+		return true;
+	}
+
+	bool VKUploadEngine::SignalSemaphore(VKUpload* upload, VkSemaphore& semaphore) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		semaphore = VK_NULL_HANDLE;
+		if (mOpenBatch.cmdBuffer != VK_NULL_HANDLE && upload->mSerial == mOpenBatch.serial) {
+			flush();
+		}
+		if (upload->mFailed) {
+			return false;
+		}
+		recycle();
+		if (upload->mSerial <= mCompletedSerial) {
+			return true;
+		}
+		//the semaphore of the upload is left for the graphics family, an empty batch behind the one of the upload signals another
+		semaphore = mSyncPool->AcquireSemaphore();
+		VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+		if (semaphore == VK_NULL_HANDLE || vkQueueSubmit(mTransferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+			if (semaphore != VK_NULL_HANDLE) {
+				mSyncPool->Retire(VK_NULL_HANDLE, 1, &semaphore);
+				semaphore = VK_NULL_HANDLE;
+			}
+			return waiteSerial(upload->mSerial);
+		}
+		return true;
+	}
+
+	bool VKUploadEngine::WaiteFinished(VKUpload* upload) {
+		std::lock_guard<std::mutex> lock(mMtx);
+		if (mOpenBatch.cmdBuffer != VK_NULL_HANDLE && upload->mSerial == mOpenBatch.serial) {
+			flush();
+		}
+		if (upload->mFailed) {
+			return false;
+		}
+		return waiteSerial(upload->mSerial);
+	}
+
+	void VKUploadEngine::Recycle() {
+		std::lock_guard<std::mutex> lock(mMtx);
+		recycle();
+	}
+
+	bool VKUploadEngine::isPending(VKUpload* upload) {
+		return upload == nullptr || (mOpenBatch.cmdBuffer != VK_NULL_HANDLE && upload->mSerial == mOpenBatch.serial);
+	}
+
+	bool VKUploadEngine::beginBatch() {
+		if (mFreeCmdBuffers.empty()) {
+			recycle();
+		}
+		VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+		if (!mFreeCmdBuffers.empty()) {
+			cmdBuffer = mFreeCmdBuffers.back();
+			mFreeCmdBuffers.pop_back();
+		}
+		else {
+			VkCommandBufferAllocateInfo cmdBufferAllocInfo = {};
+			cmdBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cmdBufferAllocInfo.commandPool = mCmdPool;
+			cmdBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			cmdBufferAllocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(mLogicDevice, &cmdBufferAllocInfo, &cmdBuffer) != VK_SUCCESS) {
+				return false;
+			}
+		}
+		//
+		VkCommandBufferBeginInfo cmdBufBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+		cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(cmdBuffer, &cmdBufBeginInfo) != VK_SUCCESS) {
+			mFreeCmdBuffers.push_back(cmdBuffer);
+			return false;
+		}
+		mOpenBatch.serial = ++mSerial;
+		mOpenBatch.cmdBuffer = cmdBuffer;
+		mOpenBatch.fence = VK_NULL_HANDLE;
+		mOpenBatch.stagingSize = 0;
+		return true;
+	}
+
+	void VKUploadEngine::endCopy() {
+		if (mOpenBatch.stagings.size() >= MAX_BATCH_COPIES || mOpenBatch.stagingSize >= MAX_BATCH_STAGING_SIZE) {
+			flush();
+		}
+	}
+
+	bool VKUploadEngine::flush() {
+		if (mOpenBatch.cmdBuffer == VK_NULL_HANDLE) {
+			return true;
+		}
+		Batch batch = std::move(mOpenBatch);
+		mOpenBatch = Batch();
+		mOpenBatch.cmdBuffer = VK_NULL_HANDLE;
+		//the release of every resource of the batch, after all the copies
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		std::vector<VkSemaphore> semaphores;
+		for (auto &upload : batch.uploads) {
+			bufferBarriers.insert(bufferBarriers.end(), upload->mBufferBarriers.begin(), upload->mBufferBarriers.end());
+			imageBarriers.insert(imageBarriers.end(), upload->mImageBarriers.begin(), upload->mImageBarriers.end());
+			upload->mSemaphore = mSyncPool->AcquireSemaphore();
+			if (upload->mSemaphore != VK_NULL_HANDLE) {
+				semaphores.push_back(upload->mSemaphore);
+			}
+		}
+		vkCmdPipelineBarrier(batch.cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr,
+			(uint32_t)bufferBarriers.size(), bufferBarriers.empty() ? nullptr : bufferBarriers.data(),
+			(uint32_t)imageBarriers.size(), imageBarriers.empty() ? nullptr : imageBarriers.data());
+		//
+		auto res = vkEndCommandBuffer(batch.cmdBuffer);
+		if (res == VK_SUCCESS) {
+			batch.fence = mSyncPool->AcquireFence();
+			res = batch.fence == VK_NULL_HANDLE ? VK_ERROR_OUT_OF_HOST_MEMORY : VK_SUCCESS;
+		}
+		if (res == VK_SUCCESS) {
+			VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &batch.cmdBuffer;
+			submitInfo.signalSemaphoreCount = (uint32_t)semaphores.size();
+			submitInfo.pSignalSemaphores = semaphores.empty() ? nullptr : semaphores.data();
+			res = vkQueueSubmit(mTransferQueue, 1, &submitInfo, batch.fence);
+		}
+		if (res != VK_SUCCESS) {
+			mSyncPool->ReleaseFence(batch.fence);
+			batch.fence = VK_NULL_HANDLE;
+			for (auto &upload : batch.uploads) {
+				upload->mFailed = true;
+			}
+			releaseBatch(batch);
+			return false;
+		}
+		mBatches.push_back(std::move(batch));
+		return true;
+	}
+
+	void VKUploadEngine::recycle() {
+		while (!mBatches.empty() && mSyncPool->IsSignaled(mBatches.front().fence)) {
+			mCompletedSerial = mBatches.front().serial;
+			releaseBatch(mBatches.front());
+			mBatches.pop_front();
+		}
+	}
+
+	bool VKUploadEngine::waiteSerial(uint64_t serial) {
+		if (serial <= mCompletedSerial) {
+			return true;
+		}
+		for (auto &batch : mBatches) {
+			if (batch.serial == serial) {
+				auto res = vkWaitForFences(mLogicDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX) == VK_SUCCESS;
+				recycle();
+				return res;
+			}
+		}
+		//
+		return false;
+	}
+
+	void VKUploadEngine::releaseBatch(Batch& batch) {
+		for (auto &staging : batch.stagings) {
+			mStagingRing->Release(staging);
+		}
+		batch.stagings.clear();
+		if (vkResetCommandBuffer(batch.cmdBuffer, 0) == VK_SUCCESS) {
+			mFreeCmdBuffers.push_back(batch.cmdBuffer);
+		}
+		if (batch.fence != VK_NULL_HANDLE) {
+			mSyncPool->Retire(batch.fence, 0, nullptr);
+		}
+		//the batch is finished or never reached the queue, a semaphore nobody took is not waited on any more.
+		//it is signaled or was never submitted, so it is destroyed instead of reused
+		for (auto &upload : batch.uploads) {
+			if (upload->mSemaphore != VK_NULL_HANDLE) {
+				mSyncPool->Retire(VK_NULL_HANDLE, 1, &upload->mSemaphore);
+				upload->mSemaphore = VK_NULL_HANDLE;
+			}
+		}
+		batch.uploads.clear();
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include "VulkanSDK\1.1.77.0\Include\vulkan\vulkan.h"
+#include "Resource.h"
+#include "VulkanSync.h"
+#include "VulkanStaging.h"
+
+namespace ASGI {
+	class VKUploadEngine;
+	//the upload of one resource by a batch of the transfer queue. the batch releases the resource to the graphics family
+	//and signals mSemaphore, the first submission on the graphics family that uses the resource claims the upload,
+	//waits on the semaphore at the stage the resource is used and records the acquire barriers before its own commands.
+	//the batch holds a reference until its fence has signaled, so the upload is never destroyed while the batch runs
+	class VKUpload : public Resource {
+		friend class VKUploadEngine;
+	public:
+		VKUpload(VKUploadEngine* engine, uint64_t serial, VkPipelineStageFlags dstStage);
+
+		//true for the one caller that takes over the resource
+		inline bool Claim() {
+			return !mClaimed.exchange(true, std::memory_order_acq_rel);
+		}
+
+		inline bool IsClaimed() {
+			return mClaimed.load(std::memory_order_acquire);
+		}
+
+		inline VkPipelineStageFlags GetDstStage() {
+			return mDstStage;
+		}
+
+		//the barriers that complete the ownership transfer on the graphics family
+		void RecordAcquire(VkCommandBuffer cmdBuffer);
+	protected:
+		//the batch retires the semaphore once it is finished, this covers an upload whose batch never ended
+		~VKUpload();
+	private:
+		VKUploadEngine* mEngine;
+		std::atomic<bool> mClaimed;
+		//the batch of the transfer queue, mFailed if it never reached the queue
+		uint64_t mSerial;
+		bool mFailed;
+		VkSemaphore mSemaphore;
+		VkPipelineStageFlags mDstStage;
+		//the release barriers, their dstAccessMask is what the acquire makes the data visible to
+		std::vector<VkBufferMemoryBarrier> mBufferBarriers;
+		std::vector<VkImageMemoryBarrier> mImageBarriers;
+	};
+	typedef ref_ptr<VKUpload> upload_ptr;
+
+	//records the uploads into one open command buffer of the transfer queue and submits it as a batch when a submission
+	//needs one of its uploads, when it grows past MAX_BATCH_COPIES or MAX_BATCH_STAGING_SIZE, or at the end of a frame.
+	//the staging ranges of a batch are released once its fence has signaled. a resource is uploaded here only
+	//until the graphics family has taken it over, later updates are recorded on the graphics queue
+	class VKUploadEngine {
+		friend class VKUpload;
+	public:
+		static const uint32_t MAX_BATCH_COPIES = 256;
+		static const uint64_t MAX_BATCH_STAGING_SIZE = 64 * 1024 * 1024;
+	public:
+		VKUploadEngine(VkDevice logicDevice, VkQueue transferQueue, uint32_t transferQueueFamilyIndex, uint32_t graphicsQueueFamilyIndex, VKSyncPool* syncPool, VKStagingRing* stagingRing);
+		//waits for the batches in flight
+		~VKUploadEngine();
+		bool Init();
+
+		//pendingUpload is the last upload of the resource, the copy is added to it while it is in the open batch.
+		//dstStage is the stage the graphics family uses the resource at. nullptr if the copy can't be recorded or the resource
+		//was released by an earlier batch, the staging is not taken over then, otherwise it is released once the batch is finished
+		upload_ptr CopyBuffer(VKUpload* pendingUpload, const VKStaging& staging, VkBuffer dstBuffer, const VkBufferCopy& region, VkPipelineStageFlags dstStage);
+		//the level is moved from UNDEFINED to TRANSFER_DST_OPTIMAL before its first copy in the batch and released in finalLayout
+		upload_ptr CopyBufferToImage(VKUpload* pendingUpload, const VKStaging& staging, VkImage dstImage, const VkBufferImageCopy& region,
+			VkImageLayout finalLayout, VkAccessFlags finalAccess, VkPipelineStageFlags dstStage);
+
+		//submit the batch being recorded
+		bool Flush();
+		//the semaphore signaled for the claimed upload, the batch is submitted first if it is still open. semaphore is VK_NULL_HANDLE
+		//if the batch was waited for here instead. false if the batch failed, the resource was never released then
+		bool TakeSemaphore(VKUpload* upload, VkSemaphore& semaphore);
+		//a semaphore signaled on the transfer queue once the batch of the upload is finished, for a queue of another family that only
+		//waits for the copy and leaves the resource to the graphics family. semaphore is VK_NULL_HANDLE if the batch is finished
+		//already or was waited for here instead. false if the batch failed
+		bool SignalSemaphore(VKUpload* upload, VkSemaphore& semaphore);
+		//block until the batch of the upload is finished, false if it failed
+		bool WaiteFinished(VKUpload* upload);
+		//release the staging of the finished batches, called before the staging ring is written
+		void Recycle();
+	private:
+		struct Batch {
+			uint64_t serial;
+			VkCommandBuffer cmdBuffer;
+			VkFence fence;
+			uint64_t stagingSize;
+			std::vector<VKStaging> stagings;
+			std::vector<upload_ptr> uploads;
+		};
+		//called with mMtx held. no upload yet, or one in the batch being recorded
+		bool isPending(VKUpload* upload);
+		bool beginBatch();
+		bool flush();
+		//drop the batches whose fence has signaled, they finish in submission order
+		void recycle();
+		bool waiteSerial(uint64_t serial);
+		void releaseBatch(Batch& batch);
+		void endCopy();
+	private:
+		VkDevice mLogicDevice;
+		VkQueue mTransferQueue;
+		uint32_t mTransferQueueFamilyIndex;
+		uint32_t mGraphicsQueueFamilyIndex;
+		VKSyncPool* mSyncPool;
+		VKStagingRing* mStagingRing;
+		VkCommandPool mCmdPool;
+		std::mutex mMtx;
+		std::vector<VkCommandBuffer> mFreeCmdBuffers;
+		//the batch being recorded has a command buffer, the batches in flight are in submission order
+		Batch mOpenBatch;
+		std::deque<Batch> mBatches;
+		uint64_t mSerial;
+		uint64_t mCompletedSerial;
+	};
+}
@@ -185,11 +185,9 @@ unsigned __stdcall window_thread(void* pdata) {
 			break;
 		}
 		//
+		ASGI::BeginFrame(pwindow->pSwapchain.get());
 		pwindow->Render();
-		//
-		auto swapChain = pwindow->pSwapchain.get();
-		ASGI::Present(pwindow->pExcuteQueue, 1, &swapChain);
-		ASGI::WaitQueueExcuteFinished(1, &pwindow->pExcuteQueue);
+		ASGI::EndFrame(pwindow->pExcuteQueue, pwindow->pSwapchain.get());
 	}
 	//
 	pwindow->is_running = false;
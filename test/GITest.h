@@ -1,5 +1,23 @@
 #pragma once
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#if defined(GITEST_BENCHMARK_RECORDING) || defined(GITEST_TEST_REPLAY_ALLOCATIONS)
+#include <atomic>
+#include <crtdbg.h>
+#endif
+#ifdef GITEST_BENCHMARK_CMD_BUFFER_POOLS
+#include <atomic>
+#include <thread>
+#endif
+#ifdef GITEST_BENCHMARK_TASKS
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#endif
 #include "GraphicWindow.h"
 #include "..\ASGI\ASGI.h"
 
@@ -26,6 +44,77 @@
 
 class GITest : public GraphicWindow {
 public:
+#ifdef GITEST_BENCHMARK_TASKS
+	//task queue of the context, forwards to the scheduler a benchmark sets while no task is pending. without one the task runs right away
+	class ForwardingTaskQueue : public ASGI::ICmdBufferTaskQueue {
+	public:
+		void PushTask(const ASGI::CmdBufferTask& task) override {
+			if (target != nullptr) {
+				target->PushTask(task);
+			}
+			else {
+				task.Run();
+			}
+		}
+		//
+		ASGI::ICmdBufferTaskQueue* target = nullptr;
+	};
+	//the task path before CmdBufferTask became a plain descriptor: the task holds a std::function, is pushed by value
+	//and waits in a deque behind one lock, the way a user of the old ICmdBufferTaskQueue interface wrote the queue
+	class LegacyTaskQueue {
+	public:
+		struct Task {
+			ASGI::CommandBuffer* mCmdBuffer;
+			ASGI::CommandBuffer* mSecondCmdBuffer;
+			std::function<void(ASGI::CommandBuffer*, ASGI::CommandBuffer*)> excute;
+		};
+		//
+		LegacyTaskQueue(uint32_t numWorkers) {
+			for (uint32_t i = 0; i < numWorkers; ++i) {
+				workers.emplace_back([this]() {
+					for (;;) {
+						Task task;
+						{
+							std::unique_lock<std::mutex> lk(mtx);
+							cond.wait(lk, [this] {return exit || !tasks.empty(); });
+							if (tasks.empty()) {
+								return;
+							}
+							task = tasks.front();
+							tasks.pop_front();
+						}
+						task.excute(task.mCmdBuffer, task.mSecondCmdBuffer);
+					}
+				});
+			}
+		}
+
+		~LegacyTaskQueue() {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				exit = true;
+			}
+			cond.notify_all();
+			for (auto &worker : workers) {
+				worker.join();
+			}
+		}
+
+		void PushTask(Task task) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				tasks.push_back(task);
+			}
+			cond.notify_one();
+		}
+	private:
+		std::vector<std::thread> workers;
+		std::deque<Task> tasks;
+		std::mutex mtx;
+		std::condition_variable cond;
+		bool exit = false;
+	};
+#endif
 	bool PrepareRender() override {
 
 		ASGI::SwapchainCreateInfo swapchain_create_info = {
@@ -35,10 +124,15 @@ public:
 			false,
 			ASGI::Format::FORMAT_B8G8R8A8_UNORM,
 			ASGI::Format::FORMAT_D24_UNORM_S8_UINT,
-			false
+			false,
+			2
 		};
 
+#ifdef GITEST_BENCHMARK_TASKS
+		pGraphicsContext = ASGI::CreateContext(ASGI::GIType::GI_VULKAN, &swapchain_create_info, "GeForce GTX 850M", &benchmarkTaskQueue);
+#else
 		pGraphicsContext = ASGI::CreateContext(ASGI::GIType::GI_VULKAN, &swapchain_create_info, "GeForce GTX 850M");
+#endif
 		if (pGraphicsContext == nullptr) {
 			return false;
 		}
@@ -100,6 +194,9 @@ public:
 		graphics_pipeline_create_info.renderPass = pRenderPass;
 		graphics_pipeline_create_info.subpassIndex = 0;
 		pGraphicsPipeline = ASGI::CreateGraphicsPipeline(graphics_pipeline_create_info);
+#ifdef GITEST_BENCHMARK_PIPELINES
+		BenchmarkPipelineCreation(graphics_pipeline_create_info);
+#endif
 		//create frame buffer
 		ASGI::Extent2D extent = pSwapchain->GetExtent();
 		for (int i = 0; i < pSwapchain->GetNumAttachment(); ++i) {
@@ -154,8 +251,20 @@ public:
 		pUniformBuffer = ASGI::CreateBuffer(sizeof(uboVS), ASGI::BufferUsageFlagBits::BUFFER_USAGE_UNIFORM_BIT | ASGI::BufferUsageFlagBits::BUFFER_USAGE_TRANSFER_DST_BIT);
 		ASGI::UpdateBuffer(pUniformBuffer, 0, sizeof(uboVS), &uboVS, bufferUpdateContex);
 		ASGI::EndUpdateBuffer(bufferUpdateContex);
+#ifdef GITEST_BENCHMARK_UPLOADS
+		benchmarkProjection = uboVS.projectionMatrix;
+#endif
+#ifdef GITEST_BENCHMARK_STAGING
+		BenchmarkStagingThroughput(256, 64 * 1024);
+#endif
 
 		ASGI::BindUniformBuffer(pGPUProgram, 0, 0, pUniformBuffer, 0, sizeof(uboVS));
+#ifdef GITEST_TEST_UPLOAD_LATENCY
+		//the uniform buffer is bound, its updates go to the graphics queue
+		if (!TestUploadLatency(pUniformBuffer, sizeof(uboVS), &uboVS, 64, 64 * 1024 * 1024)) {
+			return false;
+		}
+#endif
 		//
 		FreeImage_Initialise();
 		auto pimg = FreeImage_Load(FREE_IMAGE_FORMAT::FIF_JPEG, "G:\\picture\\girl1.jpg");
@@ -204,11 +313,26 @@ public:
 			//
 			cmdBuffers.push_back(pCmdBuffer);
 		}
+#ifdef GITEST_BENCHMARK_ASYNC_COMPUTE
+		BenchmarkAsyncCompute(200, 1000, 64 * 1024 * 1024);
+#endif
+#ifdef GITEST_BENCHMARK_RECORDING
+		BenchmarkRecording(100, 20000);
+#endif
+#ifdef GITEST_BENCHMARK_TASKS
+		BenchmarkSecondaryTranslation(20, 64, 500);
+		BenchmarkTaskThroughput(100000);
+#endif
+#ifdef GITEST_TEST_REPLAY_ALLOCATIONS
+		if (!TestReplayAllocations(3, 1000)) {
+			return false;
+		}
+#endif
 		return true;
 	}
 
 	void Render() override {
-		auto attachmentIndex = pSwapchain->AcquireNextAttachment();
+		auto attachmentIndex = ASGI::BeginFrame(pSwapchain);
 		auto pCmdBuffer = cmdBuffers[attachmentIndex];
 		//
 		ASGI::BeginCmdBuffer(pCmdBuffer);
@@ -240,11 +364,528 @@ public:
 		auto cmdBuffer = pCmdBuffer.get();
 		auto swapChain = pSwapchain;
 		//
-		pqueue = ASGI::AcquireExcuteQueue(ASGI::QueueType::QUEUE_TYPE_GRAPHICS);
+		//the queue takes the submissions of the frames in flight, it is only acquired once
+		if (pqueue == nullptr) {
+			pqueue = ASGI::AcquireExcuteQueue(ASGI::QueueType::QUEUE_TYPE_GRAPHICS);
+		}
 		ASGI::SubmitCommands(pqueue, 1, &cmdBuffer, 0, nullptr, 1, &swapChain);
-		ASGI::Present(pqueue, 1, &swapChain);
-		ASGI::WaitQueueExcuteFinished(1, &pqueue);
+		ASGI::EndFrame(pqueue, swapChain);
+#ifdef GITEST_BENCHMARK_UPLOADS
+		BenchmarkUploadLatency(10, 1000);
+#endif
+#ifdef GITEST_BENCHMARK_CMD_BUFFER_POOLS
+		BenchmarkCmdBufferContention(100, 256);
+#endif
+	}
+#ifdef GITEST_BENCHMARK_CMD_BUFFER_POOLS
+	//acquire/free throughput of the command buffer pools under contention, called once per frame for numFrames frames of each thread count.
+	//each frame the threads begin and end buffersPerThread immediate command buffers each, beginning one gives back the buffer it was
+	//bound to and acquires a new one from the pools of the thread. the buffers move to another thread every frame, so most of them
+	//are given back to the pools of other threads
+	void BenchmarkCmdBufferContention(uint32_t numFrames, uint32_t buffersPerThread) {
+		typedef std::chrono::high_resolution_clock Clock;
+		const uint32_t threadCounts[] = { 1, 2, 4, 8 };
+		if (contentionPhase >= sizeof(threadCounts) / sizeof(threadCounts[0])) {
+			return;
+		}
+		uint32_t numThreads = threadCounts[contentionPhase];
+		if (contentionBuffers.size() != numThreads * buffersPerThread) {
+			ASGI::CommandBufferCreateInfo createInfo;
+			createInfo.immediateRecord = true;
+			contentionBuffers.clear();
+			for (uint32_t i = 0; i < numThreads * buffersPerThread; ++i) {
+				contentionBuffers.push_back(ASGI::CreateCmdBuffer(createInfo));
+			}
+		}
+		//the threads are started before the clock and wait for go
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		for (uint32_t t = 0; t < numThreads; ++t) {
+			threads.emplace_back([&, t]() {
+				while (!go.load(std::memory_order_acquire)) {
+					std::this_thread::yield();
+				}
+				uint32_t group = (t + contentionFrame) % numThreads;
+				for (uint32_t i = 0; i < buffersPerThread; ++i) {
+					ASGI::CommandBuffer* cmdBuffer = contentionBuffers[group * buffersPerThread + i].get();
+					ASGI::BeginCmdBuffer(cmdBuffer);
+					ASGI::EndCmdBuffer(cmdBuffer);
+				}
+			});
+		}
+		auto start = Clock::now();
+		go.store(true, std::memory_order_release);
+		for (auto &thread : threads) {
+			thread.join();
+		}
+		contentionTime += std::chrono::duration<double>(Clock::now() - start).count();
+		if (++contentionFrame == numFrames) {
+			double numAcquires = (double)numFrames * numThreads * buffersPerThread;
+			std::cout << numThreads << " threads: " << numAcquires / contentionTime << " acquires per second, "
+				<< contentionTime * 1000.0 / numFrames << " ms per frame" << std::endl;
+			contentionFrame = 0;
+			contentionTime = 0.0;
+			++contentionPhase;
+			if (contentionPhase == sizeof(threadCounts) / sizeof(threadCounts[0])) {
+				contentionBuffers.clear();
+			}
+		}
+	}
+#endif
+#ifdef GITEST_BENCHMARK_UPLOADS
+	//latency of a stream of numUpdates small updates, updatesPerFrame of them after each frame is submitted. the uniform buffer
+	//is read by the frames in flight, so each update is copied on the current graphics queue behind them. the host does not wait
+	//for the copy, an update takes as long as recording and submitting it
+	void BenchmarkUploadLatency(uint32_t updatesPerFrame, uint32_t numUpdates) {
+		typedef std::chrono::high_resolution_clock Clock;
+		for (uint32_t i = 0; i < updatesPerFrame && numBenchmarkUpdates < numUpdates; ++i) {
+			auto start = Clock::now();
+			ASGI::UpdateBuffer(pUniformBuffer, 0, sizeof(benchmarkProjection), &benchmarkProjection);
+			auto latency = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			benchmarkUpdateTime += latency;
+			benchmarkMaxUpdateTime = (std::max)(benchmarkMaxUpdateTime, latency);
+			if (++numBenchmarkUpdates == numUpdates) {
+				std::cout << numUpdates << " updates: average " << benchmarkUpdateTime / numUpdates << " ms, max " << benchmarkMaxUpdateTime << " ms" << std::endl;
+			}
+		}
+	}
+#endif
+#ifdef GITEST_TEST_UPLOAD_LATENCY
+	//an update of a buffer the graphics queue uses must not wait for the work in flight on the queue. numFills fills of fillSize bytes
+	//are submitted to the current graphics queue, the update of pbuffer must return before they are finished.
+	//WaitBufferUpdated then waits for the copy, which runs behind the fills
+	bool TestUploadLatency(ASGI::Buffer* pbuffer, uint32_t size, void* pdata, uint32_t numFills, uint32_t fillSize) {
+		auto pQueue = ASGI::AcquireExcuteQueue(ASGI::QueueType::QUEUE_TYPE_GRAPHICS);
+		auto pFillBuffer = ASGI::CreateBuffer(fillSize, ASGI::BufferUsageFlagBits::BUFFER_USAGE_STORAGE_BIT | ASGI::BufferUsageFlagBits::BUFFER_USAGE_TRANSFER_DST_BIT);
+		if (pQueue == nullptr || pFillBuffer == nullptr) {
+			return false;
+		}
+		auto pCmdBuffer = ASGI::CreateCmdBuffer();
+		ASGI::CommandBuffer* cmdBuffer = pCmdBuffer.get();
+		ASGI::BeginCmdBuffer(cmdBuffer);
+		for (uint32_t i = 0; i < numFills; ++i) {
+			ASGI::CmdFillBuffer(cmdBuffer, pFillBuffer, 0, fillSize, i);
+		}
+		ASGI::EndCmdBuffer(cmdBuffer);
+		auto submission = ASGI::SubmitCommands(pQueue, 1, &cmdBuffer, 0, nullptr, 0, nullptr);
+		if (submission == nullptr) {
+			return false;
+		}
+		//
+		ASGI::UpdateBuffer(pbuffer, 0, size, pdata);
+		bool waited = ASGI::IsSubmissionFinished(submission);
+		bool updated = ASGI::WaitBufferUpdated(pbuffer);
+		bool ordered = ASGI::IsSubmissionFinished(submission);
+		ASGI::WaitSubmissionFinished(submission);
+		if (waited) {
+			std::cout << "upload latency test failed: the update returned after the work in flight on its queue had finished" << std::endl;
+			return false;
+		}
+		if (!updated || !ordered) {
+			std::cout << "upload latency test failed: WaitBufferUpdated returned before the copy behind the work in flight had finished" << std::endl;
+			return false;
+		}
+		std::cout << "upload latency test passed" << std::endl;
+		return true;
+	}
+#endif
+#ifdef GITEST_BENCHMARK_STAGING
+	//throughput of numUpdates updates of updateSize bytes, one by one and in one update context. the time is taken once the copies
+	//are finished. ASGI and the test built with ASGI_NO_STAGING_RING measure a staging buffer created and destroyed for each update,
+	//the path before the ring
+	void BenchmarkStagingThroughput(uint32_t numUpdates, uint32_t updateSize) {
+		typedef std::chrono::high_resolution_clock Clock;
+		std::vector<uint8_t> data(updateSize, 0x5a);
+		double megabytes = (double)numUpdates * updateSize / (1024.0 * 1024.0);
+		//a new buffer, the graphics queue has not used it and the copies can go to the transfer queue
+		auto pBuffer = ASGI::CreateBuffer((uint64_t)numUpdates * updateSize, ASGI::BufferUsageFlagBits::BUFFER_USAGE_VERTEX_BIT | ASGI::BufferUsageFlagBits::BUFFER_USAGE_TRANSFER_DST_BIT);
+		if (pBuffer == nullptr) {
+			return;
+		}
+		auto singleStart = Clock::now();
+		for (uint32_t i = 0; i < numUpdates; ++i) {
+			ASGI::UpdateBuffer(pBuffer, i * updateSize, updateSize, data.data());
+		}
+		ASGI::WaitBufferUpdated(pBuffer);
+		auto singleEnd = Clock::now();
+		auto updateContext = ASGI::BeginUpdateBuffer();
+		for (uint32_t i = 0; i < numUpdates; ++i) {
+			ASGI::UpdateBuffer(pBuffer, i * updateSize, updateSize, data.data(), updateContext);
+		}
+		ASGI::EndUpdateBuffer(updateContext);
+		ASGI::WaitBufferUpdated(pBuffer);
+		auto batchEnd = Clock::now();
+		//
+		std::cout << numUpdates << " updates of " << updateSize << " bytes, " << (ASGI::STAGING_RING_ENABLED ? "staging ring" : "per update staging") << ": one by one "
+			<< megabytes / std::chrono::duration<double>(singleEnd - singleStart).count()
+			<< " MB/s, in one context " << megabytes / std::chrono::duration<double>(batchEnd - singleEnd).count() << " MB/s" << std::endl;
+	}
+#endif
+#if defined(GITEST_BENCHMARK_RECORDING) || defined(GITEST_TEST_REPLAY_ALLOCATIONS)
+	//heap allocations made by the threads that set CountAllocations. ASGI.dll shares the debug CRT with the test,
+	//so the allocation hook of the CRT sees the allocations of both. the release CRT has no hook and counts nothing
+	static std::atomic<uint32_t>& NumAllocations() {
+		static std::atomic<uint32_t> numAllocations(0);
+		return numAllocations;
+	}
+	static bool& CountAllocations() {
+		static thread_local bool countAllocations = false;
+		return countAllocations;
+	}
+	static int RecordAllocationHook(int allocType, void* userData, size_t size, int blockType, long requestNumber, const unsigned char* fileName, int lineNumber) {
+		if (allocType != _HOOK_FREE && blockType != _CRT_BLOCK && CountAllocations()) {
+			++NumAllocations();
+		}
+		return TRUE;
+	}
+#endif
+#ifdef GITEST_TEST_REPLAY_ALLOCATIONS
+	//counts only while ASGI translates a command stream on the thread, the submission around it may allocate
+	static int ReplayAllocationHook(int allocType, void* userData, size_t size, int blockType, long requestNumber, const unsigned char* fileName, int lineNumber) {
+		if (allocType != _HOOK_FREE && blockType != _CRT_BLOCK && CountAllocations() && ASGI::IsReplayingCommands()) {
+			++NumAllocations();
+		}
+		return TRUE;
+	}
+	//replay of a warmed up command buffer must not allocate. the buffer is submitted numWarmupFrames times, then once more
+	//with the allocations of its replay counted. the draws change every frame so each submit translates the stream again
+	bool TestReplayAllocations(uint32_t numWarmupFrames, uint32_t numDraws) {
+#ifndef _DEBUG
+		std::cout << "replay allocation test skipped: allocations are only counted with the debug CRT" << std::endl;
+		return true;
+#else
+		auto pQueue = ASGI::AcquireExcuteQueue(ASGI::QueueType::QUEUE_TYPE_GRAPHICS);
+		if (pQueue == nullptr) {
+			return false;
+		}
+		auto pCmdBuffer = ASGI::CreateCmdBuffer();
+		ASGI::CommandBuffer* cmdBuffer = pCmdBuffer.get();
+		uint32_t numAllocations = 0;
+		for (uint32_t frame = 0; frame <= numWarmupFrames; ++frame) {
+			ASGI::BeginCmdBuffer(cmdBuffer);
+			ASGI::BeginRenderPass(cmdBuffer, pRenderPass, frameBuffers[0]);
+			ASGI::Viewport viewports[2] = {};
+			ASGI::Rect2D scissors[2] = {};
+			for (uint32_t i = 0; i < 2; ++i) {
+				viewports[i].height = (float)height;
+				viewports[i].width = (float)width;
+				viewports[i].maxDepth = 1.0f;
+				scissors[i].extent.width = width;
+				scissors[i].extent.height = height;
+			}
+			ASGI::CmdSetViewport(cmdBuffer, 0, 2, viewports);
+			ASGI::CmdSetScissor(cmdBuffer, 0, 2, scissors);
+			ASGI::CmdBindPipeline(cmdBuffer, pGraphicsPipeline);
+			ASGI::Buffer* vertexBuffers[2] = { pVertexBuffer.get(), pVertexBuffer.get() };
+			uint32_t vertexOffsets[2] = { 0, 0 };
+			ASGI::CmdBindVertexBuffers(cmdBuffer, 0, 2, vertexBuffers, vertexOffsets);
+			ASGI::CmdBindIndexBuffer(cmdBuffer, pIndexBuffer, 0, ASGI::Format::FORMAT_R32_UINT);
+			for (uint32_t i = 0; i < numDraws; ++i) {
+				ASGI::CmdDrawIndexed(cmdBuffer, 3, 1, 0, 0, frame);
+			}
+			ASGI::EndRenderPass(cmdBuffer, pRenderPass, 0, nullptr);
+			ASGI::EndCmdBuffer(cmdBuffer);
+			//
+			bool counted = frame == numWarmupFrames;
+			_CRT_ALLOC_HOOK prevHook = nullptr;
+			if (counted) {
+				NumAllocations() = 0;
+				CountAllocations() = true;
+				prevHook = _CrtSetAllocHook(ReplayAllocationHook);
+			}
+			auto submission = ASGI::SubmitCommands(pQueue, 1, &cmdBuffer, 0, nullptr, 0, nullptr, true);
+			if (counted) {
+				_CrtSetAllocHook(prevHook);
+				CountAllocations() = false;
+				numAllocations = NumAllocations();
+			}
+			if (submission == nullptr) {
+				return false;
+			}
+		}
+		std::cout << "replay allocation test " << (numAllocations == 0 ? "passed" : "FAILED") << ": " << numAllocations << " allocations" << std::endl;
+		return numAllocations == 0;
+#endif
+	}
+#endif
+#ifdef GITEST_BENCHMARK_RECORDING
+	//heap allocations and time of recording numFrames frames of numDraws draws into a deferred command buffer, nothing is submitted.
+	//the first frame grows the command arena of the buffer, the later frames rewind it. the per-node path this replaced
+	//allocated once per recorded command, the emitted commands are printed as its count
+	void BenchmarkRecording(uint32_t numFrames, uint32_t numDraws) {
+		typedef std::chrono::high_resolution_clock Clock;
+#ifndef _DEBUG
+		std::cout << "recording benchmark: allocations are only counted with the debug CRT" << std::endl;
+#endif
+		auto pCmdBuffer = ASGI::CreateCmdBuffer();
+		ASGI::CommandBuffer* cmdBuffer = pCmdBuffer.get();
+		auto prevHook = _CrtSetAllocHook(RecordAllocationHook);
+		uint32_t firstFrameAllocations = 0;
+		double firstFrameTime = 0.0;
+		uint32_t steadyAllocations = 0;
+		double steadyTime = 0.0;
+		for (uint32_t frame = 0; frame < numFrames; ++frame) {
+			NumAllocations() = 0;
+			CountAllocations() = true;
+			auto start = Clock::now();
+			ASGI::BeginCmdBuffer(cmdBuffer);
+			ASGI::BeginRenderPass(cmdBuffer, pRenderPass, frameBuffers[0]);
+			ASGI::Viewport viewport = {};
+			viewport.height = (float)height;
+			viewport.width = (float)width;
+			viewport.minDepth = (float) 0.0f;
+			viewport.maxDepth = (float) 1.0f;
+			ASGI::CmdSetViewport(cmdBuffer, 0, 1, &viewport);
+			ASGI::Rect2D scissor = {};
+			scissor.extent.width = width;
+			scissor.extent.height = height;
+			ASGI::CmdSetScissor(cmdBuffer, 0, 1, &scissor);
+			ASGI::CmdBindPipeline(cmdBuffer, pGraphicsPipeline);
+			ASGI::CmdBindVertexBuffer(cmdBuffer, 0, pVertexBuffer, 0);
+			ASGI::CmdBindIndexBuffer(cmdBuffer, pIndexBuffer, 0, ASGI::Format::FORMAT_R32_UINT);
+			for (uint32_t i = 0; i < numDraws; ++i) {
+				ASGI::CmdDrawIndexed(cmdBuffer, 3, 1, 0, 0, i);
+			}
+			ASGI::EndRenderPass(cmdBuffer, pRenderPass, 0, nullptr);
+			ASGI::EndCmdBuffer(cmdBuffer);
+			auto time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			CountAllocations() = false;
+			if (frame == 0) {
+				firstFrameAllocations = NumAllocations();
+				firstFrameTime = time;
+			}
+			else {
+				steadyAllocations += NumAllocations();
+				steadyTime += time;
+			}
+		}
+		_CrtSetAllocHook(prevHook);
+		auto statistics = ASGI::GetCmdBufferStatistics(cmdBuffer);
+		uint32_t numSteadyFrames = (std::max)(numFrames, 2u) - 1;
+		std::cout << numDraws << " draws: first frame " << firstFrameAllocations << " allocations " << firstFrameTime << " ms, later frames "
+			<< (double)steadyAllocations / numSteadyFrames << " allocations " << steadyTime / numSteadyFrames << " ms per frame, "
+			<< statistics.numEmittedCommands << " commands (allocations per frame of the per-node path)" << std::endl;
+	}
+#endif
+#ifdef GITEST_BENCHMARK_TASKS
+	//time of translating numSecondaries second command buffers of drawsPerSecondary draws each, by schedulers of 1 to N workers.
+	//the time runs from EndRenderPass, which hands the second command buffers to the scheduler, until the primary buffer is queued,
+	//which happens once the last of them is translated. the GPU work is waited for outside the time
+	void BenchmarkSecondaryTranslation(uint32_t numFrames, uint32_t numSecondaries, uint32_t drawsPerSecondary) {
+		typedef std::chrono::high_resolution_clock Clock;
+		auto pQueue = ASGI::AcquireExcuteQueue(ASGI::QueueType::QUEUE_TYPE_GRAPHICS);
+		if (pQueue == nullptr) {
+			return;
+		}
+		auto pCmdBuffer = ASGI::CreateCmdBuffer();
+		ASGI::CommandBuffer* cmdBuffer = pCmdBuffer.get();
+		std::vector<ASGI::command_buffer_ptr> secondBuffers;
+		std::vector<ASGI::CommandBuffer*> secondCmdBuffers;
+		for (uint32_t i = 0; i < numSecondaries; ++i) {
+			secondBuffers.push_back(ASGI::CreateCmdBuffer());
+			secondCmdBuffers.push_back(secondBuffers.back().get());
+		}
+		//the thread that records the primary buffer keeps a core
+		uint32_t maxWorkers = (std::max)(std::thread::hardware_concurrency(), 2u) - 1;
+		for (uint32_t numWorkers = 1; numWorkers <= maxWorkers; numWorkers = numWorkers < maxWorkers ? (std::min)(numWorkers * 2, maxWorkers) : numWorkers + 1) {
+			ASGI::CmdBufferTaskSchedulerCreateInfo createInfo;
+			createInfo.numWorkers = numWorkers;
+			benchmarkTaskQueue.target = ASGI::CreateCmdBufferTaskScheduler(createInfo);
+			double translateTime = 0.0;
+			for (uint32_t frame = 0; frame < numFrames; ++frame) {
+				for (auto secondCmdBuffer : secondCmdBuffers) {
+					ASGI::BeginCmdBuffer(secondCmdBuffer);
+					ASGI::CmdBindPipeline(secondCmdBuffer, pGraphicsPipeline);
+					ASGI::CmdBindVertexBuffer(secondCmdBuffer, 0, pVertexBuffer, 0);
+					ASGI::CmdBindIndexBuffer(secondCmdBuffer, pIndexBuffer, 0, ASGI::Format::FORMAT_R32_UINT);
+					for (uint32_t i = 0; i < drawsPerSecondary; ++i) {
+						ASGI::CmdDrawIndexed(secondCmdBuffer, 3, 1, 0, 0, 0);
+					}
+					ASGI::EndCmdBuffer(secondCmdBuffer);
+				}
+				ASGI::BeginCmdBuffer(cmdBuffer);
+				ASGI::BeginRenderPass(cmdBuffer, pRenderPass, frameBuffers[0]);
+				auto start = Clock::now();
+				ASGI::EndRenderPass(cmdBuffer, pRenderPass, numSecondaries, secondCmdBuffers.data());
+				ASGI::EndCmdBuffer(cmdBuffer);
+				auto submission = ASGI::SubmitCommands(pQueue, 1, &cmdBuffer, 0, nullptr, 0, nullptr);
+				if (submission != nullptr) {
+					ASGI::WaitSubmission(submission);
+				}
+				translateTime += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+				if (submission != nullptr) {
+					ASGI::WaitSubmissionFinished(submission);
+				}
+			}
+			delete benchmarkTaskQueue.target;
+			benchmarkTaskQueue.target = nullptr;
+			std::cout << numSecondaries << " second command buffers of " << drawsPerSecondary << " draws, " << numWorkers << " workers: "
+				<< translateTime / numFrames << " ms per frame" << std::endl;
+		}
+	}
+#endif
+#ifdef GITEST_BENCHMARK_TASKS
+	static void CountTask(ASGI::CommandBuffer* cmdBuffer, ASGI::CommandBuffer* secondCmdBuffer, uintptr_t userData) {
+		((std::atomic<uint32_t>*)userData)->fetch_add(1, std::memory_order_relaxed);
+	}
+	//tasks per second pushed by this thread and run by the workers, through the built-in scheduler and through the old path.
+	//the tasks only count themselves, so the numbers are the cost of handing a task over
+	void BenchmarkTaskThroughput(uint32_t numTasks) {
+		typedef std::chrono::high_resolution_clock Clock;
+		uint32_t maxWorkers = (std::max)(std::thread::hardware_concurrency(), 2u) - 1;
+		for (uint32_t numWorkers = 1; numWorkers <= maxWorkers; numWorkers = numWorkers < maxWorkers ? (std::min)(numWorkers * 2, maxWorkers) : numWorkers + 1) {
+			std::atomic<uint32_t> numFinished(0);
+			ASGI::CmdBufferTaskSchedulerCreateInfo createInfo;
+			createInfo.numWorkers = numWorkers;
+			auto scheduler = ASGI::CreateCmdBufferTaskScheduler(createInfo);
+			auto schedulerStart = Clock::now();
+			for (uint32_t i = 0; i < numTasks; ++i) {
+				scheduler->PushTask(ASGI::CmdBufferTask(nullptr, nullptr, CountTask, (uintptr_t)&numFinished));
+			}
+			while (numFinished.load(std::memory_order_relaxed) < numTasks) {
+				std::this_thread::yield();
+			}
+			auto schedulerTime = std::chrono::duration<double>(Clock::now() - schedulerStart).count();
+			delete scheduler;
+			//
+			numFinished = 0;
+			{
+				LegacyTaskQueue legacyQueue(numWorkers);
+				auto legacyStart = Clock::now();
+				for (uint32_t i = 0; i < numTasks; ++i) {
+					LegacyTaskQueue::Task task;
+					task.mCmdBuffer = nullptr;
+					task.mSecondCmdBuffer = nullptr;
+					task.excute = [&numFinished](ASGI::CommandBuffer* cmdBuffer, ASGI::CommandBuffer* secondCmdBuffer) {
+						CountTask(cmdBuffer, secondCmdBuffer, (uintptr_t)&numFinished);
+					};
+					legacyQueue.PushTask(task);
+				}
+				while (numFinished.load(std::memory_order_relaxed) < numTasks) {
+					std::this_thread::yield();
+				}
+				auto legacyTime = std::chrono::duration<double>(Clock::now() - legacyStart).count();
+				std::cout << numTasks << " tasks, " << numWorkers << " workers: scheduler " << numTasks / schedulerTime
+					<< " tasks per second, old path " << numTasks / legacyTime << " tasks per second" << std::endl;
+			}
+		}
+	}
+#endif
+#ifdef GITEST_BENCHMARK_PIPELINES
+	//startup cost of numPipelines pipelines created one by one and as one CreateGraphicsPipelines batch.
+	//the states differ so the driver compiles each of them, the batch runs in parallel only if the context has a task queue.
+	//a driver with its own pipeline cache favors the batch that runs second, clear that cache for cold numbers
+	void BenchmarkPipelineCreation(const ASGI::GraphicsPipelineCreateInfo& baseInfo) {
+		typedef std::chrono::high_resolution_clock Clock;
+		const uint32_t counts[] = { 1, 8, 32, 128, 512 };
+		for (auto numPipelines : counts) {
+			std::vector<ASGI::GraphicsPipelineCreateInfo> createInfos(numPipelines, baseInfo);
+			for (uint32_t i = 0; i < numPipelines; ++i) {
+				createInfos[i].depthStencilState.depthCompareOp = (ASGI::CompareOp)(i % 8);
+				createInfos[i].depthStencilState.depthWriteEnable = (i / 8) % 2 == 0;
+				createInfos[i].colorBlendState.Attachments[0].blendEnable = (i / 16) % 2 == 1;
+				createInfos[i].rasterizationState.cullMode = (i / 32) % 4;
+			}
+			//
+			std::vector<ASGI::graphics_pipeline_ptr> pipelines(numPipelines);
+			auto serialStart = Clock::now();
+			for (uint32_t i = 0; i < numPipelines; ++i) {
+				pipelines[i] = ASGI::CreateGraphicsPipeline(createInfos[i]);
+			}
+			auto serialEnd = Clock::now();
+			pipelines.assign(numPipelines, nullptr);
+			//
+			auto batchStart = Clock::now();
+			ASGI::CreateGraphicsPipelines(numPipelines, createInfos.data(), pipelines.data());
+			auto batchEnd = Clock::now();
+			std::cout << numPipelines << " pipelines: one by one " << std::chrono::duration<double, std::milli>(serialEnd - serialStart).count()
+				<< " ms, batched " << std::chrono::duration<double, std::milli>(batchEnd - batchStart).count() << " ms" << std::endl;
+		}
+	}
+#endif
+#ifdef GITEST_BENCHMARK_ASYNC_COMPUTE
+	//wall time of numFrames frames of a compute queue submission and an offscreen pass that depends on it, no swapchain is used.
+	//serialized waits for the compute submission on the CPU before the pass is submitted, overlapped submits both at once and the pass
+	//waits on the compute submission at the fragment shader, so its vertex work runs beside the compute work.
+	//no compute pipeline can be created yet, the compute work is a fill of fillSize bytes the pass doesn't read.
+	//the fills of consecutive frames write the same value, so they are not ordered against each other
+	void BenchmarkAsyncCompute(uint32_t numFrames, uint32_t numInstances, uint32_t fillSize) {
+		typedef std::chrono::high_resolution_clock Clock;
+		auto pComputeQueue = ASGI::AcquireExcuteQueue(ASGI::QueueType::QUEUE_TYPE_COMPUTE);
+		auto pGraphicsQueue = ASGI::AcquireExcuteQueue(ASGI::QueueType::QUEUE_TYPE_GRAPHICS);
+		if (pComputeQueue == nullptr || pGraphicsQueue == nullptr) {
+			return;
+		}
+		auto pColor = ASGI::CreateImage2D(width, height, pSwapchain->GetColorFormat(), 1, ASGI::SampleCountFlagBits::SAMPLE_COUNT_1_BIT,
+			ASGI::ImageUsageFlagBits::IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+		auto pDepth = ASGI::CreateImage2D(width, height, ASGI::Format::FORMAT_D24_UNORM_S8_UINT, 1, ASGI::SampleCountFlagBits::SAMPLE_COUNT_1_BIT,
+			ASGI::ImageUsageFlagBits::IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+		if (pColor == nullptr || pDepth == nullptr) {
+			return;
+		}
+		ASGI::ImageView* attachments[2] = { pColor->GetOrigView(), pDepth->GetOrigView() };
+		ASGI::ClearValue clearValues[2];
+		clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		clearValues[1].depthStencil = { 1.0f, 0 };
+		ASGI::frame_buffer_ptr pFrameBuffer = ASGI::CreateFrameBuffer(pRenderPass, 2, attachments, clearValues, width, height);
+		if (pFrameBuffer == nullptr) {
+			return;
+		}
+		auto pFillBuffer = ASGI::CreateBuffer(fillSize, ASGI::BufferUsageFlagBits::BUFFER_USAGE_STORAGE_BIT | ASGI::BufferUsageFlagBits::BUFFER_USAGE_TRANSFER_DST_BIT);
+		if (pFillBuffer == nullptr) {
+			return;
+		}
+		//
+		auto pComputeCmdBuffer = ASGI::CreateCmdBuffer();
+		auto pGraphicsCmdBuffer = ASGI::CreateCmdBuffer();
+		ASGI::CommandBuffer* computeCmdBuffer = pComputeCmdBuffer.get();
+		ASGI::CommandBuffer* graphicsCmdBuffer = pGraphicsCmdBuffer.get();
+		const char* names[] = { "serialized", "overlapped" };
+		for (uint32_t pass = 0; pass < 2; ++pass) {
+			ASGI::submission_ptr graphicsSubmission;
+			auto start = Clock::now();
+			for (uint32_t i = 0; i < numFrames; ++i) {
+				ASGI::BeginCmdBuffer(computeCmdBuffer);
+				ASGI::CmdFillBuffer(computeCmdBuffer, pFillBuffer, 0, fillSize, 0);
+				ASGI::EndCmdBuffer(computeCmdBuffer);
+				//
+				ASGI::BeginCmdBuffer(graphicsCmdBuffer);
+				ASGI::BeginRenderPass(graphicsCmdBuffer, pRenderPass, pFrameBuffer);
+				ASGI::Viewport viewport = {};
+				viewport.height = (float)height;
+				viewport.width = (float)width;
+				viewport.minDepth = (float) 0.0f;
+				viewport.maxDepth = (float) 1.0f;
+				ASGI::CmdSetViewport(graphicsCmdBuffer, 0, 1, &viewport);
+				ASGI::Rect2D scissor = {};
+				scissor.extent.width = width;
+				scissor.extent.height = height;
+				ASGI::CmdSetScissor(graphicsCmdBuffer, 0, 1, &scissor);
+				ASGI::CmdBindPipeline(graphicsCmdBuffer, pGraphicsPipeline);
+				ASGI::CmdBindVertexBuffer(graphicsCmdBuffer, 0, pVertexBuffer, 0);
+				ASGI::CmdBindIndexBuffer(graphicsCmdBuffer, pIndexBuffer, 0, ASGI::Format::FORMAT_R32_UINT);
+				ASGI::CmdDrawIndexed(graphicsCmdBuffer, 3, numInstances, 0, 0, 0);
+				ASGI::EndRenderPass(graphicsCmdBuffer, pRenderPass, 0, nullptr);
+				ASGI::EndCmdBuffer(graphicsCmdBuffer);
+				//
+				auto computeSubmission = ASGI::SubmitCommands(pComputeQueue, 1, &computeCmdBuffer, 0, nullptr, 0, nullptr);
+				ASGI::Submission* waiteSubmission = computeSubmission.get();
+				ASGI::PipelineStageFlags waiteStage = ASGI::PipelineStageFlagBits::PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+				ASGI::SubmitBatch batch = { 1, &graphicsCmdBuffer, 0, 1, &waiteSubmission, &waiteStage, 0, nullptr };
+				if (pass == 0) {
+					ASGI::WaitSubmissionFinished(waiteSubmission);
+					batch.numWaiteSubmission = 0;
+				}
+				graphicsSubmission = ASGI::SubmitBatches(pGraphicsQueue, 1, &batch);
+			}
+			if (graphicsSubmission != nullptr) {
+				ASGI::WaitSubmissionFinished(graphicsSubmission);
+			}
+			auto end = Clock::now();
+			std::cout << numFrames << " frames " << names[pass] << " " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+		}
 	}
+#endif
 private:
 	std::string readfile(char *path)
 	{
@@ -263,6 +904,10 @@ private:
 		return std::string(buffer.data(), buffer.size());
 	}
 	private:
+#ifdef GITEST_BENCHMARK_TASKS
+		//declared before the context, which uses it until it is destroyed
+		ForwardingTaskQueue benchmarkTaskQueue;
+#endif
 		ASGI::graphics_context_ptr pGraphicsContext = nullptr;
 		ASGI::Swapchain* pSwapchain = nullptr;
 		ASGI::shader_program_ptr pGPUProgram = nullptr;
@@ -271,7 +916,7 @@ private:
 		std::vector<ASGI::frame_buffer_ptr> frameBuffers;
 		//ASGI::command_buffer_ptr pCmdBuffer;
 		std::vector<ASGI::command_buffer_ptr> cmdBuffers;
-		ASGI::ExcuteQueue* pqueue;
+		ASGI::ExcuteQueue* pqueue = nullptr;
 
 		ASGI::buffer_ptr pVertexBuffer;
 		ASGI::buffer_ptr pIndexBuffer;
@@ -279,4 +924,16 @@ private:
 
 		ASGI::image_2d_ptr pImage;
 		ASGI::sampler_ptr pSampler;
+#ifdef GITEST_BENCHMARK_CMD_BUFFER_POOLS
+		std::vector<ASGI::command_buffer_ptr> contentionBuffers;
+		uint32_t contentionPhase = 0;
+		uint32_t contentionFrame = 0;
+		double contentionTime = 0.0;
+#endif
+#ifdef GITEST_BENCHMARK_UPLOADS
+		glm::mat4 benchmarkProjection;
+		uint32_t numBenchmarkUpdates = 0;
+		double benchmarkUpdateTime = 0.0;
+		double benchmarkMaxUpdateTime = 0.0;
+#endif
 };
\ No newline at end of file